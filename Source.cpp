@@ -7,6 +7,20 @@
 
 #include <iostream>             // cout, cerr
 #include <cstdlib>              // EXIT_FAILURE
+#include <cmath>                // ceil, sqrt
+#include <vector>               // vector
+#include <string>               // string
+#include <sstream>              // ostringstream
+#include <algorithm>            // sort
+#include <chrono>               // steady_clock
+#include <memory>               // shared_ptr
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>            // FindFirstFile
+#else
+#include <dirent.h>             // opendir
+#endif
 #include <GL/glew.h>            // GLEW library
 #include <GLFW/glfw3.h>         // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
@@ -19,6 +33,28 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <learnOpengl/camera.h> // Camera class
+#include "shader.h"             // Reflected shader program class
+#include "mesh_builder.h"       // Indexed mesh construction
+#include "geometry_arena.h"     // Shared vertex/index buffers for all meshes
+#include "render_queue.h"       // Sort-keyed draw queue
+#include "mesh_optimizer.h"     // Vertex cache, overdraw and fetch optimization
+#include "indirect_renderer.h"  // Multi-draw indirect submission
+#include "primitives.h"         // Procedural primitive meshes
+#include "lod.h"                // Level of detail selection
+#include "frustum.h"            // View-frustum culling
+#include "batch_culler.h"       // SIMD frustum culling over structure-of-arrays bounds
+#include "scene_bvh.h"          // Bounding volume hierarchy for hierarchical culling and queries
+#include "mesh_picking.h"       // Ray picking against CPU copies of mesh triangles
+#include "mesh_simplifier.h"    // Quadric error mesh simplification
+#include "thread_pool.h"        // Worker threads for offline tools
+#include "hiz_culler.h"         // Hierarchical depth occlusion culling in compute shaders
+#include "software_occlusion.h" // Multithreaded CPU occlusion rasterizer
+#include "occlusion_queries.h"  // Conditional rendering on bounding box occlusion queries
+#include "texture_loader.h"     // Texture decoding on worker threads with streaming uploads
+#include "texture_cooker.h"     // Offline BC1/BC7 compression into KTX2 files
+#include "texture_cache.h"      // Memory-mapped cache of decoded textures
+#include "mip_generator.h"      // Gamma-correct mip chains built on the CPU
+#include "image_ops.h"          // SIMD flips, channel expansion, swizzles and premultiplied alpha
 
 using namespace std; // Standard namespace
 
@@ -39,20 +75,71 @@ namespace
     // Stores the GL data relative to a given mesh
     struct GLMesh
     {
-        GLuint vao;         // Handle for the vertex array object
-        GLuint vbo;         // Handle for the vertex buffer object
-        GLuint nVertices;   // Number of indices of the mesh
+        MeshRange range;    // Location of the mesh in the geometry arena (base vertex, first index, index type)
+        GLuint nVertices;   // Number of unique vertices of the mesh
+        GLuint nIndices;    // Number of indices of the mesh
+        glm::vec3 center;   // Object-space bounding sphere
+        float radius;
+        BoundingBox bounds; // Object-space bounding box
+        shared_ptr<PickMesh> pick; // CPU positions and triangle hierarchy, shared by copies of the mesh
     };
 
+    // Every mesh is suballocated from these shared buffers and drawn through its single VAO
+    const GLuint ARENA_VERTEX_CAPACITY = 1 << 20;        // 32 MB of vertices
+    const GLuint ARENA_INDEX_BYTE_CAPACITY = 16 << 20;  // 16 MB of indices
+    GeometryArena gGeometryArena;
+
+    // Meshes whose vertices compress within tolerance live in a second arena with the 16-byte layout
+    GeometryArena gCompactArena;
+    bool gCompactVertices = true; // Disabled with --float-vertices
+
     // Main GLFW window
     GLFWwindow* gWindow = nullptr;
 
+    // Generated primitive meshes, one per (type, segments); the scene meshes below are copies of cached entries
+    PrimitiveCache<GLMesh> gPrimitiveMeshes;
+    const int CYLINDER_SEGMENTS = 32;
+
     // Triangle mesh data
-    GLMesh planeMesh;
-    GLMesh pyramidMesh;
     GLMesh cubeMesh;
-    GLMesh rectPrismMesh;
-    GLMesh cylinderMesh;
+
+    // Detail levels of each kind of object, finest first
+    LodChain planeLods;
+    LodChain pyramidLods;
+    LodChain cubeLods;
+    LodChain rectPrismLods;
+    LodChain cylinderLods;
+
+    // An object placed in the scene once and submitted every frame at the detail its screen size needs
+    struct SceneObject
+    {
+        const LodChain* lods;
+        RenderPass pass;
+        GLuint program;     // Render queue program slot
+        GLuint texture;
+        glm::mat4 model;
+        glm::vec2 uvScale;
+        unsigned lodLevel;  // Level drawn last frame, the starting point of hysteresis
+        BoundingBox bounds; // World space, filled by UBuildCullBounds
+        bool occluder;      // Also drawn into the occluder depth of the Hi-Z pass and the software occlusion buffer
+    };
+    vector<SceneObject> gSceneObjects;
+
+    // Level of detail selection from projected bounding sphere size
+    LodSelector gLodSelector;
+
+    // Planes of the current view-projection; objects entirely outside are not submitted
+    Frustum gFrustum;
+    BatchCuller gCuller;                // World-space bounds of gSceneObjects, same order
+    SceneBvh gSceneBvh;                 // Hierarchy over the same bounds; items are gSceneObjects indices
+    bool gBvhCulling = true;            // Toggled with B (hierarchy) and V (flat SIMD scan)
+
+    // Object under the view center when the left mouse button was last pressed, -1 for none
+    int gSelectedObject = -1;
+    glm::mat4 gViewProjection;          // Of the last frame, to turn screen points back into rays
+    vector<uint32_t> gVisibleObjects;   // Indices into gSceneObjects that passed culling this frame
+    CullStats gCullStats;               // Counts of the last frame
+    float gLastTitleUpdate = 0.0f;
 
     // Textures
     GLuint texTorchHandleId;
@@ -61,11 +148,82 @@ namespace
     GLuint texBirchId;
     GLuint texPlasticId;
 
+    // Textures decode on worker threads and stream in while frames render, each showing a placeholder until then
+    AsyncTextureLoader gTextureLoader;
+    const size_t TEXTURE_STAGING_BYTES = 32 << 20; // Staging ring shared by the uploads in flight
+    bool gSyncTextures = false;         // Set with --sync-textures: decode and upload on the render thread before the first frame
+    bool gCookedTextures = true;        // Prefer the .ktx2 next to a texture source when --cook-textures made one; --source-textures ignores them
+
+    // Decoded, flipped and mipmapped sources kept on disk, so warm starts map them instead of decoding
+    TextureCache gTextureCache;
+    const char* const TEXTURE_CACHE_DIRECTORY = "../../resources/texture_cache";
+    bool gTextureCaching = true;        // Cleared with --no-texture-cache
+    float gTextureLoadStart = 0.0f;     // Time the texture requests were made, to report how long streaming took
+    double gMipMilliseconds = 0.0;      // Spent building mip chains on the CPU during blocking texture loads
+
     GLint gTexWrapMode = GL_REPEAT;
 
     // Shader program
-    GLuint gProgramId;
-    GLuint gLightProgramId;
+    ShaderProgram gProgram;
+    ShaderProgram gLightProgram;
+    ShaderProgram gDepthProgram;    // Position-only program of the depth prepass
+    ShaderProgram gIndirectProgram; // Object shading fed from the per-object storage buffer and texture array
+
+    // Uniform handles of the object shader program, resolved once after linking.
+    // Model matrices and texture scales are per-instance vertex attributes, not uniforms
+    struct ObjectUniforms
+    {
+        Uniform<glm::vec3> objectColor;
+        Uniform<glm::vec3> lightColor;
+        Uniform<glm::vec3> lightPos;
+        Uniform<GLint> uTexture;
+    } gObjectUniforms, gIndirectUniforms;
+
+    // Draws of the current frame, sorted by state and merged into instanced draws before they are issued
+    RenderQueue gRenderQueue;
+    GLuint gObjectSlot; // Render queue index of the object shader program
+    GLuint gLightSlot;  // Render queue index of the light shader program
+    GLuint gDepthSlot;  // Render queue index of the depth prepass program
+
+    // Instanced opaque draws lay down depth first, so the shading pass runs Phong only on the visible fragments
+    bool gDepthPrepass = false; // Toggled with Z (on) and U (off)
+
+    // Opaque pass drawn with one multi-draw indirect call instead of the queue's instanced draws
+    IndirectRenderer gIndirectRenderer;
+    bool gIndirectDraw = false; // Toggled with M (indirect) and N (instanced)
+    vector<ArrayTexture> gArrayTextures; // Layers of the indirect pass's texture array, built when M or H first needs it
+
+    // Occlusion culling of the indirect pass against a depth pyramid of the occluders, built on the GPU
+    HiZCuller gHiZCuller;
+    ShaderProgram gHiZDownsampleProgram;
+    ShaderProgram gHiZCullProgram;
+    bool gOcclusionCulling = false; // Toggled with H (on, switches to indirect submission) and G (off)
+
+    // Occlusion culling on the CPU against a small software depth buffer of the occluders, before anything is submitted
+    SoftwareOcclusion gSoftwareOcclusion;
+    unique_ptr<ThreadPool> gWorkers;    // One thread per core, shared by the occlusion tiles and the mip chains of blocking texture loads
+    bool gCpuOcclusion = false;     // Toggled with C (on) and X (off)
+
+    // Expensive objects of the instanced path drawn under last frame's occlusion query of their bounding box
+    OcclusionQueries gOcclusionQueries;
+    vector<uint32_t> gQueriedObjects;   // Objects whose boxes are queried this frame
+    bool gQueryCulling = false;         // Toggled with K (on) and J (off)
+    const GLsizei CONDITIONAL_MIN_INDICES = 256; // Cheaper draws cost less than their query
+
+    // Extra props scattered under the desk to stress submission, set with --props <count>
+    int gPropCount = 0;
+
+    // Per-frame camera data shared by every shader program through a uniform buffer (std140 layout)
+    struct CameraBlock
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        glm::vec4 position; // w is unused, kept for std140 alignment
+    };
+
+    const GLuint CAMERA_BLOCK_BINDING = 0; // Must match the binding of CameraBlock in the shaders
+    GLuint gCameraUbo;
 
     // Camera
     Camera gCamera(glm::vec3(0.0f, 1.5f, 7.0f)); // Default camera position
@@ -98,22 +256,46 @@ void processView(GLFWwindow* window); // Toggle between views
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
-void createPlaneMesh(GLMesh& mesh);
-void createPyramidMesh(GLMesh& mesh);
 void createCubeMesh(GLMesh& mesh);
-void createRectPrismMesh(GLMesh& mesh);
-void createCylinderMesh(GLMesh& mesh);
+const GLMesh& UGetPrimitiveMesh(PrimitiveType type, int segments);
+void UBuildPrimitiveLods(LodChain& chain, PrimitiveType type, std::initializer_list<int> segments);
+void UBuildSingleLod(LodChain& chain, const GLMesh& mesh);
+void buildScene(); // Places every object of the scene once
 void drawScene(); // Functiont that draws all the shapes at once
-void drawPlane(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will draw a plane with passed values
-void drawPyramid(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will draw a pyramid with passed values
-void drawCube(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will draw a cube with passed values
-void drawRectPrism(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will draw a rectangular prism with passed values
-void drawCylinder(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will draw a cylinder with passed values
+void UBuildCullBounds(); // Fills the culler and the scene hierarchy with the world bounds of every scene object
+int UPickObject(float ndcX, float ndcY, float& distance); // Closest scene object along a ray through the viewport
+size_t UCullOccludedObjects(size_t visibleCount); // Drops frustum-visible objects hidden behind occluders
+void updateWindowTitle(float time); // Shows the culling and draw counts
+void addPlane(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will add a plane with passed values
+void addPyramid(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will add a pyramid with passed values
+void addCube(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will add a cube with passed values
+void addRectPrism(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will add a rectangular prism with passed values
+void addCylinder(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle); // Will add a cylinder with passed values
+void addProps(); // Will add the stress test props
+void UCreateMesh(GLMesh& mesh, MeshBuilder& builder);
+void UPrintOptimizationStats(const char* name, const MeshOptimizationStats& stats);
+void UPrintCompressionStats(const char* name, size_t vertexCount, const VertexCompressionResult& encoding, bool compressed);
+bool UOptimizeObjFile(const char* filename);
+bool UListFiles(const string& directory, const vector<string>& extensions, vector<string>& files);
+bool UListObjFiles(const string& directory, vector<string>& files);
+bool UBuildLodsForDirectory(const char* directory);
+bool UCookTexturesForDirectory(const char* directory);
+void UBenchmarkCulling();
+bool UBenchmarkMips(const char* directory);
+bool UBenchmarkImageOps(const char* filename);
 void UDestroyMesh(GLMesh& mesh);
+void UCreateCameraBlock(GLuint& ubo);
+void UDestroyCameraBlock(GLuint ubo);
 bool UCreateTexture(const char* filename, GLuint& textureId);
+bool UCreateCompressedTexture(const char* filename, GLuint& textureId);
+string UResolveTexturePath(const char* filename);
+string UResolveLayerPath(const char* filename);
+void UBuildTextureArray();
 void UDestroyTexture(GLuint textureId);
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
-void UDestroyShaderProgram(GLuint programId);
+void UUpdateTextures();
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, ShaderProgram& program);
+bool UCreateComputeProgram(const char* computeShaderSource, ShaderProgram& program);
+void UDestroyShaderProgram(ShaderProgram& program);
 
 
 // Vertex shader source code
@@ -122,24 +304,45 @@ const GLchar* vertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
 layout(location = 1) in vec3 normal; // VAP position 1 for normals
 layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in mat4 instanceModel; // Per-instance model matrix (locations 3 to 6)
+layout(location = 7) in vec4 instanceUVTransform; // Per-instance texture scale (xy) and offset (zw)
+layout(location = 9) in vec2 packedNormal; // Octahedral normal of compact vertices, whose normal attribute reads zero
+
+invariant gl_Position; // Must match the depth prepass exactly, which the GL_EQUAL depth test relies on
 
 out vec3 vertexNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Camera matrices, updated once per frame
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
+
+// Decodes an octahedral normal
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+    vec3 objectNormal = dot(normal, normal) > 0.0f ? normal : octahedralDecode(packedNormal);
 
-    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+    gl_Position = viewProjection * instanceModel * vec4(position, 1.0f); // Transforms vertices into clip coordinates
 
-    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
-    vertexTextureCoordinate = textureCoordinate;
+    vertexFragmentPos = vec3(instanceModel * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+
+    vertexNormal = mat3(transpose(inverse(instanceModel))) * objectNormal; // get normal vectors in world space only and exclude normal translation properties
+    vertexTextureCoordinate = textureCoordinate * instanceUVTransform.xy + instanceUVTransform.zw; // Scale the texture proportional to the object
 }
 );
 
@@ -153,14 +356,21 @@ in vec2 vertexTextureCoordinate;
 
 out vec4 fragmentColor; // For outgoing cube color to the GPU
 
-// Uniform / Global variables for object color, light color, light position, and camera/view position
+// Camera matrices and position, updated once per frame
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
+
+// Uniform / Global variables for object color, light color and light position
 uniform vec3 objectColor;
 uniform vec3 lightColor;
 uniform vec3 torchColor;
 uniform vec3 lightPos;
-uniform vec3 viewPosition;
 uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
 
 void main()
 {
@@ -177,7 +387,7 @@ void main()
     // Specular calculation
     float specularIntensity = 1.0f; // Set specular light strength
     float highlightSize = 10.0f; // Set specular highlight size
-    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+    vec3 viewDir = normalize(viewPosition.xyz - vertexFragmentPos); // Calculate view direction
     vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
 
                                                      // Specualr component calculation
@@ -185,7 +395,129 @@ void main()
     vec3 specular = specularIntensity * specularComponent * lightColor;
 
     // Texture holds the color to be used for all three components
-    vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+    vec4 textureColor = texture(uTexture, vertexTextureCoordinate);
+
+    // Calculate phong result
+    vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
+
+    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
+}
+);
+
+
+
+// Indirect vertex shader source code. Per-object data comes from a storage buffer indexed by objectIndex,
+// an instanced attribute that reads gl_InstanceID + baseInstance from an identity buffer
+const GLchar* indirectVertexShaderSource = GLSL(440,
+
+    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+layout(location = 1) in vec3 normal; // VAP position 1 for normals
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 8) in uint objectIndex; // Index of this object in the storage buffer
+layout(location = 9) in vec2 packedNormal; // Octahedral normal of compact vertices, whose normal attribute reads zero
+
+out vec3 vertexNormal; // For outgoing normals to fragment shader
+out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+out vec2 vertexTextureCoordinate;
+flat out float vertexTextureLayer; // Texture array layer of the object
+
+// Camera matrices, updated once per frame
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
+
+struct ObjectData
+{
+    mat4 model;
+    vec4 uvTransform; // xy texture scale, zw offset
+    vec4 layer; // x texture array layer
+};
+
+// Every object of the pass, rewritten once per frame
+layout(std430, binding = 1) readonly buffer ObjectBlock
+{
+    ObjectData objects[];
+};
+
+// Decodes an octahedral normal
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    vec3 objectNormal = dot(normal, normal) > 0.0f ? normal : octahedralDecode(packedNormal);
+    mat4 model = objects[objectIndex].model;
+    vec4 uvTransform = objects[objectIndex].uvTransform;
+
+    gl_Position = viewProjection * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+
+    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+
+    vertexNormal = mat3(transpose(inverse(model))) * objectNormal; // get normal vectors in world space only and exclude normal translation properties
+    vertexTextureCoordinate = textureCoordinate * uvTransform.xy + uvTransform.zw; // Scale the texture proportional to the object
+    vertexTextureLayer = objects[objectIndex].layer.x;
+}
+);
+
+
+// Indirect fragment shader source code, the object shading with the texture taken from an array layer
+const GLchar* indirectFragmentShaderSource = GLSL(440,
+
+    in vec3 vertexNormal; // For incoming normals
+in vec3 vertexFragmentPos; // For incoming fragment position
+in vec2 vertexTextureCoordinate;
+flat in float vertexTextureLayer;
+
+out vec4 fragmentColor; // For outgoing cube color to the GPU
+
+// Camera matrices and position, updated once per frame
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
+
+// Uniform / Global variables for object color, light color and light position
+uniform vec3 objectColor;
+uniform vec3 lightColor;
+uniform vec3 lightPos;
+uniform sampler2DArray uTexture; // Every object texture, one per layer
+
+void main()
+{
+    // Ambient calculation
+    float ambientStrength = 0.3f; // Set ambient or global lighting strength
+    vec3 ambient = ambientStrength * lightColor; // Generate ambient light color
+
+    // Diffuse calculation
+    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
+    vec3 lightDirection = normalize(lightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
+    float impact = max(dot(norm, lightDirection), 0.0);// Calculate diffuse impact by generating dot product of normal and light
+    vec3 diffuse = impact * lightColor; // Generate diffuse light color
+
+    // Specular calculation
+    float specularIntensity = 1.0f; // Set specular light strength
+    float highlightSize = 10.0f; // Set specular highlight size
+    vec3 viewDir = normalize(viewPosition.xyz - vertexFragmentPos); // Calculate view direction
+    vec3 reflectDir = reflect(-lightDirection, norm);// Calculate reflection vector
+
+    float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+    vec3 specular = specularIntensity * specularComponent * lightColor;
+
+    // Texture holds the color to be used for all three components
+    vec4 textureColor = texture(uTexture, vec3(vertexTextureCoordinate, vertexTextureLayer));
 
     // Calculate phong result
     vec3 phong = (ambient + diffuse + specular) * textureColor.xyz;
@@ -199,15 +531,20 @@ void main()
 // Light shader source code
 const GLchar* lightVertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+layout(location = 3) in mat4 instanceModel; // Per-instance model matrix (locations 3 to 6)
 
-    // Uniform / Global variables for transform matrix
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Camera matrices, updated once per frame
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f); // Trasnform vertices into clip coordinates
+    gl_Position = viewProjection * instanceModel * vec4(position, 1.0f); // Trasnform vertices into clip coordinates
 }
 );
 
@@ -226,7 +563,178 @@ void main()
 
 
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
+// Depth prepass vertex shader source code: positions only, transformed exactly like the object shader
+const GLchar* depthVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+layout(location = 3) in mat4 instanceModel; // Per-instance model matrix (locations 3 to 6)
+
+invariant gl_Position;
+
+// Camera matrices, updated once per frame
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
+
+void main()
+{
+    gl_Position = viewProjection * instanceModel * vec4(position, 1.0f); // Same expression as the object shader
+}
+);
+
+
+
+// Depth prepass fragment shader source code: writes nothing, depth comes from rasterization
+const GLchar* depthFragmentShaderSource = GLSL(440,
+
+void main()
+{
+}
+);
+
+
+
+// Hi-Z downsample compute shader: every texel of a pyramid level keeps the farthest depth of the texels it covers one
+// level up. Work groups are HIZ_GROUP_SIZE squared
+const GLchar* hizDownsampleShaderSource = GLSL(440,
+
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D source; // Occluder depth for level 0, the pyramid itself for the other levels
+layout(binding = 0, r32f) writeonly uniform image2D destination;
+uniform int sourceLevel;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 destinationSize = imageSize(destination);
+    if (texel.x >= destinationSize.x || texel.y >= destinationSize.y)
+        return;
+
+    // Source texels overlapping this one: two per axis, three where an odd source size leaves a remainder
+    ivec2 sourceSize = textureSize(source, sourceLevel);
+    ivec2 first = texel * sourceSize / destinationSize;
+    ivec2 last = min(((texel + 1) * sourceSize + destinationSize - 1) / destinationSize, sourceSize) - 1;
+
+    float farthest = 0.0f;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, texelFetch(source, ivec2(x, y), sourceLevel).r);
+
+    imageStore(destination, texel, vec4(farthest));
+}
+);
+
+
+
+// Hi-Z cull compute shader: tests the world box of every object of the indirect pass against the pyramid and appends
+// the survivors to their draw command. Work groups are CULL_GROUP_SIZE objects
+const GLchar* hizCullShaderSource = GLSL(440,
+
+    layout(local_size_x = 64) in;
+
+// Camera matrices, updated once per frame
+layout(std140, binding = 0) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 viewPosition;
+};
+
+struct ObjectBounds
+{
+    vec3 boundsMin;
+    uint command;
+    vec3 boundsMax;
+    uint padding;
+};
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 3) readonly buffer BoundsBlock
+{
+    ObjectBounds bounds[];
+};
+
+layout(std430, binding = 4) buffer CommandBlock
+{
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 5) writeonly buffer VisibleBlock
+{
+    uint visible[];
+};
+
+layout(binding = 0) uniform sampler2D hiz; // Farthest occluder depth, one level per halving of the resolution
+uniform uint objectCount;
+
+// false when the whole box lies behind the occluders
+bool boxVisible(vec3 boxMin, vec3 boxMax)
+{
+    vec2 screenMin = vec2(1.0f);
+    vec2 screenMax = vec2(0.0f);
+    float nearest = 1.0f;
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = mix(boxMin, boxMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+        vec4 clip = viewProjection * vec4(corner, 1.0f);
+
+        // A corner behind the eye has no meaningful projection; the box straddles the camera and is kept
+        if (clip.w <= 0.0f)
+            return true;
+
+        vec3 window = clip.xyz / clip.w * 0.5f + 0.5f;
+        screenMin = min(screenMin, window.xy);
+        screenMax = max(screenMax, window.xy);
+        nearest = min(nearest, window.z);
+    }
+    screenMin = clamp(screenMin, 0.0f, 1.0f);
+    screenMax = clamp(screenMax, 0.0f, 1.0f);
+
+    // Level where the rectangle spans at most two texels per axis
+    vec2 extent = (screenMax - screenMin) * vec2(textureSize(hiz, 0));
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0f)))), 0, textureQueryLevels(hiz) - 1);
+    ivec2 size = textureSize(hiz, level);
+    ivec2 first = clamp(ivec2(screenMin * vec2(size)), ivec2(0), size - 1);
+    ivec2 last = clamp(ivec2(screenMax * vec2(size)), ivec2(0), size - 1);
+
+    float farthest = 0.0f;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, texelFetch(hiz, ivec2(x, y), level).r);
+
+    return nearest <= farthest;
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= objectCount || !boxVisible(bounds[index].boundsMin, bounds[index].boundsMax))
+        return;
+
+    // Append to the command's instance range; the draw reads the object index back through the visible buffer
+    uint command = bounds[index].command;
+    uint slot = atomicAdd(commands[command].instanceCount, 1u);
+    visible[commands[command].baseInstance + slot] = index;
+}
+);
+
+
+
+// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it. Loaders now use the
+// image_ops.h kernels; this byte loop is kept as the baseline --bench-image-ops measures them against
 void flipImageVertically(unsigned char* image, int width, int height, int channels)
 {
     for (int j = 0; j < height / 2; ++j)
@@ -248,24 +756,113 @@ void flipImageVertically(unsigned char* image, int width, int height, int channe
 
 int main(int argc, char* argv[])
 {
+    // Offline tool: report vertex cache efficiency of an OBJ model before and after optimization
+    if (argc >= 3 && string(argv[1]) == "--optimize-mesh")
+        return UOptimizeObjFile(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Offline tool: simplify every OBJ model of a directory into an LOD chain, one model per core
+    if (argc >= 3 && string(argv[1]) == "--build-lods")
+        return UBuildLodsForDirectory(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Offline tool: compress every JPG and PNG texture of a directory to BC1/BC7 KTX2 files next to the sources
+    if (argc >= 3 && string(argv[1]) == "--cook-textures")
+        return UCookTexturesForDirectory(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Offline tool: time every frustum culling kernel over growing random scenes
+    if (argc >= 2 && string(argv[1]) == "--bench-cull") {
+        UBenchmarkCulling();
+        return EXIT_SUCCESS;
+    }
+
+    // Offline tool: time CPU mip chain generation of every JPG and PNG texture of a directory
+    if (argc >= 3 && string(argv[1]) == "--bench-mips")
+        return UBenchmarkMips(argv[2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Offline tool: time the image kernels the loaders run after decoding, on Birch.jpg unless a file is given
+    if (argc >= 2 && string(argv[1]) == "--bench-image-ops")
+        return UBenchmarkImageOps(argc >= 3 ? argv[2] : "../../resources/textures/Birch.jpg") ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    // Scene options
+    for (int i = 1; i < argc; ++i) {
+        string option = argv[i];
+        if (option == "--props" && i + 1 < argc)
+            gPropCount = atoi(argv[++i]); // Stress test: scatter extra props so submission cost dominates the frame
+        else if (option == "--float-vertices")
+            gCompactVertices = false; // Keep every mesh in the 32-byte float layout
+        else if (option == "--sync-textures")
+            gSyncTextures = true; // Blocking texture loads, to compare startup time with streaming
+        else if (option == "--source-textures")
+            gCookedTextures = false; // Decode the JPG and PNG sources even where cooked files exist
+        else if (option == "--no-texture-cache")
+            gTextureCaching = false; // Decode every source on every start
+    }
+
     if (!UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
-    // Create the meshes
-    createPlaneMesh(planeMesh);
-    createPyramidMesh(pyramidMesh);
+    // Create the shared geometry buffers and the instance buffer their VAOs read per-instance data from
+    gGeometryArena.Create(ARENA_VERTEX_CAPACITY, ARENA_INDEX_BYTE_CAPACITY);
+    gCompactArena.Create(ARENA_VERTEX_CAPACITY, ARENA_INDEX_BYTE_CAPACITY, VERTEX_FORMAT_COMPACT);
+    gRenderQueue.Create();
+    gRenderQueue.SetupInstanceAttributes(gGeometryArena.Vao);
+    gRenderQueue.SetupInstanceAttributes(gCompactArena.Vao);
+    gIndirectRenderer.Create();
+    gIndirectRenderer.AttachVao(gGeometryArena.Vao);
+    gIndirectRenderer.AttachVao(gCompactArena.Vao);
+    gOcclusionQueries.Create();
+
+    // Create the meshes and their detail levels; flat primitives need a single level
+    UBuildPrimitiveLods(planeLods, PRIMITIVE_PLANE, { 1 });
+    UBuildPrimitiveLods(pyramidLods, PRIMITIVE_PYRAMID, { 1 });
+    UBuildPrimitiveLods(rectPrismLods, PRIMITIVE_BOX, { 1 });
+    UBuildPrimitiveLods(cylinderLods, PRIMITIVE_CYLINDER, { CYLINDER_SEGMENTS, CYLINDER_SEGMENTS / 2, CYLINDER_SEGMENTS / 4, CYLINDER_SEGMENTS / 8 });
     createCubeMesh(cubeMesh);
-    createRectPrismMesh(rectPrismMesh);
-    createCylinderMesh(cylinderMesh);
+    UBuildSingleLod(cubeLods, cubeMesh);
 
     // Create the shader programs
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
+    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgram))
         return EXIT_FAILURE;
 
 
-    if (!UCreateShaderProgram(lightVertexShaderSource, lightFragmentShaderSource, gLightProgramId))
+    if (!UCreateShaderProgram(lightVertexShaderSource, lightFragmentShaderSource, gLightProgram))
         return EXIT_FAILURE;
 
+    if (!UCreateShaderProgram(indirectVertexShaderSource, indirectFragmentShaderSource, gIndirectProgram))
+        return EXIT_FAILURE;
+
+    if (!UCreateShaderProgram(depthVertexShaderSource, depthFragmentShaderSource, gDepthProgram))
+        return EXIT_FAILURE;
+
+    if (!UCreateComputeProgram(hizDownsampleShaderSource, gHiZDownsampleProgram)
+        || !UCreateComputeProgram(hizCullShaderSource, gHiZCullProgram))
+        return EXIT_FAILURE;
+
+    // Occluder depth at the window resolution; the pyramid starts at half of it
+    if (!gHiZCuller.Create(WINDOW_WIDTH, WINDOW_HEIGHT, &gHiZDownsampleProgram, &gHiZCullProgram))
+        return EXIT_FAILURE;
+
+    // Resolve uniform handles once; the draw loop never looks uniforms up by name
+    gObjectUniforms.objectColor = gProgram.GetUniform<glm::vec3>("objectColor");
+    gObjectUniforms.lightColor = gProgram.GetUniform<glm::vec3>("lightColor");
+    gObjectUniforms.lightPos = gProgram.GetUniform<glm::vec3>("lightPos");
+    gObjectUniforms.uTexture = gProgram.GetUniform<GLint>("uTexture");
+    gIndirectUniforms.objectColor = gIndirectProgram.GetUniform<glm::vec3>("objectColor");
+    gIndirectUniforms.lightColor = gIndirectProgram.GetUniform<glm::vec3>("lightColor");
+    gIndirectUniforms.lightPos = gIndirectProgram.GetUniform<glm::vec3>("lightPos");
+    gIndirectUniforms.uTexture = gIndirectProgram.GetUniform<GLint>("uTexture");
+
+    // Register the queue's programs with the render queue
+    gObjectSlot = gRenderQueue.AddProgram(&gProgram);
+    gLightSlot = gRenderQueue.AddProgram(&gLightProgram);
+    gDepthSlot = gRenderQueue.AddProgram(&gDepthProgram);
+
+    if (!gProgram.HasUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING) || !gLightProgram.HasUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING)
+        || !gIndirectProgram.HasUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING) || !gDepthProgram.HasUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING))
+        cout << "WARNING: CameraBlock is not declared at binding " << CAMERA_BLOCK_BINDING << endl;
+
+    // Create the camera uniform buffer shared by both programs
+    UCreateCameraBlock(gCameraUbo);
+
 
     // Load textures
     const char* filenameTorchHandle = "../../resources/textures/Torch_Stick.png";
@@ -274,37 +871,79 @@ int main(int argc, char* argv[])
     const char* filenameBirch = "../../resources/textures/Birch.jpg";
     const char* filenamePlastic = "../../resources/textures/White_Plastic.jpg";
 
-    // Check if textures loaded
-    if (!UCreateTexture(filenameTorchHandle, texTorchHandleId)) {
-        cout << "Failed to load texture: " << filenameTorchHandle << endl;
-        return EXIT_FAILURE;
+    if (gTextureCaching && !gTextureCache.Create(TEXTURE_CACHE_DIRECTORY)) {
+        cout << "WARNING: Cannot create the texture cache in " << TEXTURE_CACHE_DIRECTORY << endl;
+        gTextureCaching = false;
     }
 
-    if (!UCreateTexture(filenameTorchLight, texTorchLightId)) {
-        cout << "Failed to load texture: " << filenameTorchLight << endl;
-        return EXIT_FAILURE;
-    }
+    // Blocking texture loads build their mip chains across these; streaming ones use the loader's own threads
+    gWorkers.reset(new ThreadPool());
 
-    if (!UCreateTexture(filenameShinyBlue, texShinyBlueId)) {
-        cout << "Failed to load texture: " << filenameShinyBlue << endl;
-        return EXIT_FAILURE;
-    }
+    gTextureLoadStart = (float)glfwGetTime();
+    if (gSyncTextures) {
+        // Check if textures loaded
+        if (!UCreateTexture(filenameTorchHandle, texTorchHandleId)) {
+            cout << "Failed to load texture: " << filenameTorchHandle << endl;
+            return EXIT_FAILURE;
+        }
 
-    if (!UCreateTexture(filenameBirch, texBirchId)) {
-        cout << "Failed to load texture: " << filenameBirch << endl;
-        return EXIT_FAILURE;
-    }
+        if (!UCreateTexture(filenameTorchLight, texTorchLightId)) {
+            cout << "Failed to load texture: " << filenameTorchLight << endl;
+            return EXIT_FAILURE;
+        }
 
-    if (!UCreateTexture(filenamePlastic, texPlasticId)) {
-        cout << "Failed to load texture: " << filenamePlastic << endl;
-        return EXIT_FAILURE;
+        if (!UCreateTexture(filenameShinyBlue, texShinyBlueId)) {
+            cout << "Failed to load texture: " << filenameShinyBlue << endl;
+            return EXIT_FAILURE;
+        }
+
+        if (!UCreateTexture(filenameBirch, texBirchId)) {
+            cout << "Failed to load texture: " << filenameBirch << endl;
+            return EXIT_FAILURE;
+        }
+
+        if (!UCreateTexture(filenamePlastic, texPlasticId)) {
+            cout << "Failed to load texture: " << filenamePlastic << endl;
+            return EXIT_FAILURE;
+        }
+        cout << "INFO: Loaded 5 textures in " << ((float)glfwGetTime() - gTextureLoadStart) * 1000.0f << " ms (" << gTextureCache.Stats.Hits
+            << " cache hits, " << gMipMilliseconds + gTextureCache.Stats.MipMicroseconds / 1000.0 << " ms building mip chains)" << endl;
+    }
+    else {
+        // Requests return at once; UUpdateTextures swaps the real images in as the workers finish them
+        if (!gTextureLoader.Create(TEXTURE_STAGING_BYTES))
+            return EXIT_FAILURE;
+        gTextureLoader.Cache = gTextureCaching ? &gTextureCache : nullptr;
+        texTorchHandleId = gTextureLoader.Load(UResolveTexturePath(filenameTorchHandle));
+        texTorchLightId = gTextureLoader.Load(UResolveTexturePath(filenameTorchLight));
+        texShinyBlueId = gTextureLoader.Load(UResolveTexturePath(filenameShinyBlue));
+        texBirchId = gTextureLoader.Load(UResolveTexturePath(filenameBirch));
+        texPlasticId = gTextureLoader.Load(UResolveTexturePath(filenamePlastic));
     }
 
+    // Textures of the one array the indirect pass samples, so it never rebinds a texture. Built on first use
+    gArrayTextures = {
+        { texTorchHandleId, filenameTorchHandle, UResolveLayerPath(filenameTorchHandle) },
+        { texTorchLightId, filenameTorchLight, UResolveLayerPath(filenameTorchLight) },
+        { texShinyBlueId, filenameShinyBlue, UResolveLayerPath(filenameShinyBlue) },
+        { texBirchId, filenameBirch, UResolveLayerPath(filenameBirch) },
+        { texPlasticId, filenamePlastic, UResolveLayerPath(filenamePlastic) } };
+    gIndirectRenderer.Workers = gWorkers.get();
+
     // Tell OpenGL for each sampler to which texture unit it belongs to. (Only needs to be done once).
-    glUseProgram(gProgramId);
+    gProgram.Use();
 
     // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
+    gObjectUniforms.uTexture.Set(0);
+
+    gIndirectProgram.Use();
+    gIndirectUniforms.uTexture.Set(0);
+
+    // Place the objects; from here on frames only select detail levels and submit
+    buildScene();
+
+    // Tiles of the software occlusion buffer are rasterized across every core
+    gSoftwareOcclusion.Workers = gWorkers.get();
 
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -321,26 +960,51 @@ int main(int argc, char* argv[])
         UProcessInput(gWindow);
         processView(gWindow);
 
+        // Streamed textures that finished decoding
+        UUpdateTextures();
+
         // Render current frame
         drawScene();
+        updateWindowTitle(currentFrame);
         glfwPollEvents();
     }
 
     // Release mesh data
-    UDestroyMesh(planeMesh);
-    UDestroyMesh(pyramidMesh);
+    gPrimitiveMeshes.ForEach(UDestroyMesh);
+    gPrimitiveMeshes.Clear();
     UDestroyMesh(cubeMesh);
-    UDestroyMesh(rectPrismMesh);
 
     // Release texture
     UDestroyTexture(texTorchHandleId);
     UDestroyTexture(texTorchLightId);
     UDestroyTexture(texShinyBlueId);
     UDestroyTexture(texBirchId);
+    UDestroyTexture(texPlasticId);
+    gTextureLoader.Destroy();
+
+    // Release instance buffer, indirect buffers and geometry arena
+    gRenderQueue.Destroy();
+    gIndirectRenderer.Destroy();
+    gHiZCuller.Destroy();
+    gOcclusionQueries.Destroy();
+    gGeometryArena.Destroy();
+    gCompactArena.Destroy();
+
+    // Release camera uniform buffer
+    UDestroyCameraBlock(gCameraUbo);
 
     // Release shader program
-    UDestroyShaderProgram(gProgramId);
-    UDestroyShaderProgram(gLightProgramId);
+    UDestroyShaderProgram(gProgram);
+    UDestroyShaderProgram(gLightProgram);
+    UDestroyShaderProgram(gIndirectProgram);
+    UDestroyShaderProgram(gDepthProgram);
+    UDestroyShaderProgram(gHiZDownsampleProgram);
+    UDestroyShaderProgram(gHiZCullProgram);
+
+    // Join the workers
+    gSoftwareOcclusion.Workers = nullptr;
+    gIndirectRenderer.Workers = nullptr;
+    gWorkers.reset();
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
@@ -468,10 +1132,18 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     {
     case GLFW_MOUSE_BUTTON_LEFT:
     {
-        if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
-        else
-            cout << "Left mouse button released" << endl;
+        // The cursor is captured by the camera, so selection picks whatever is under the center of the view
+        if (action == GLFW_PRESS) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            float distance = 0.0f;
+            gSelectedObject = UPickObject(0.0f, 0.0f, distance);
+            double microseconds = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+            if (gSelectedObject >= 0)
+                cout << "INFO: Selected object " << gSelectedObject << " at distance " << distance << " (" << microseconds << " us)" << endl;
+            else
+                cout << "INFO: Nothing to select (" << microseconds << " us)" << endl;
+        }
     }
     break;
 
@@ -510,97 +1182,236 @@ void processView(GLFWwindow* window) {
         //std::cout << "O was pressed! Switching to PERSPECTIVE mode." << std::endl;
         gPerspectiveView = true;
     }
-}
 
+    // Submission mode: M draws the opaque pass with multi-draw indirect, N with instanced draws
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && !gIndirectDraw) {
+        cout << "INFO: Multi-draw indirect submission" << endl;
+        gIndirectDraw = true;
+        UBuildTextureArray();
+    }
+    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS && gIndirectDraw) {
+        cout << "INFO: Instanced submission" << endl;
+        gIndirectDraw = false;
+    }
 
-// Update camera
-void updateCamera(glm::mat4 model) {
-    glm::mat4 view = gCamera.GetViewMatrix();
-    glm::mat4 projection; // Initialize projection
+    // Culling mode: B walks the scene hierarchy, V scans every object's bounds with the SIMD culler
+    if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && !gBvhCulling) {
+        cout << "INFO: Hierarchical culling" << endl;
+        gBvhCulling = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS && gBvhCulling) {
+        cout << "INFO: Flat culling" << endl;
+        gBvhCulling = false;
+    }
 
-    // Determine whether the projection is perspective or ortho.
-    if (gPerspectiveView) {
-        // Creates perspective projection
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    // Occlusion culling: H tests the indirect pass against the Hi-Z pyramid of the occluders, G turns it off.
+    // The test writes the indirect draw buffer, so it needs multi-draw indirect submission
+    if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS && !gOcclusionCulling) {
+        cout << "INFO: Hi-Z occlusion culling, multi-draw indirect submission" << endl;
+        gOcclusionCulling = true;
+        gIndirectDraw = true;
+        UBuildTextureArray();
     }
-    else {
-        // Creates ortho projection
-        projection = glm::ortho(-2.0f, 2.0f, -2.0f, 2.0f, 0.1f, 100.0f);
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && gOcclusionCulling) {
+        cout << "INFO: No occlusion culling" << endl;
+        gOcclusionCulling = false;
     }
 
-    // Shader selection
-    glUseProgram(gProgramId);
+    // CPU occlusion culling: C rasterizes the occluders in software and drops hidden objects before submission, X turns it off
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && !gCpuOcclusion) {
+        cout << "INFO: CPU occlusion culling on " << gWorkers->Size() << " threads" << endl;
+        gCpuOcclusion = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS && gCpuOcclusion) {
+        cout << "INFO: No CPU occlusion culling" << endl;
+        gCpuOcclusion = false;
+    }
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    // Occlusion queries: K draws expensive objects conditioned on last frame's query of their box, J always draws them.
+    // Multi-draw indirect submission has no per-draw condition, so queries only apply to instanced submission
+    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && !gQueryCulling) {
+        cout << "INFO: Conditional rendering on occlusion queries" << (gIndirectDraw ? " (instanced submission only)" : "") << endl;
+        gQueryCulling = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS && gQueryCulling) {
+        cout << "INFO: No occlusion queries" << endl;
+        gQueryCulling = false;
+    }
+
+    // Depth prepass: Z draws opaque depth front to back before shading with GL_EQUAL, U shades in a single pass.
+    // Like the queries, the prepass belongs to instanced submission
+    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS && !gDepthPrepass) {
+        cout << "INFO: Depth prepass" << (gIndirectDraw ? " (instanced submission only)" : "") << endl;
+        gDepthPrepass = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS && gDepthPrepass) {
+        cout << "INFO: No depth prepass" << endl;
+        gDepthPrepass = false;
+    }
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    // Reference matrix uniforms from object shader program for color and position
-    GLint objectColorLoc = glGetUniformLocation(gProgramId, "objectColor");
-    GLint lightColorLoc = glGetUniformLocation(gProgramId, "lightColor");
-    GLint lightPositionLoc = glGetUniformLocation(gProgramId, "lightPos");
-    GLint viewPositionLoc = glGetUniformLocation(gProgramId, "viewPosition");
+// Pass color and light data to an object shader program's corresponding uniforms
+void updateLights(const ShaderProgram& program, const ObjectUniforms& uniforms) {
+    // Shader selection
+    program.Use();
 
-    // Pass color, light, and camera data to the object Shader program's corresponding uniforms
     // Pass data to sun light
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, sunColor.r, sunColor.g, sunColor.b);
-    glUniform3f(lightPositionLoc, sunPosition.x, sunPosition.y, sunPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    uniforms.objectColor.Set(gObjectColor);
+    uniforms.lightColor.Set(sunColor);
+    uniforms.lightPos.Set(sunPosition);
 
     // Pass data to torch light
-    glUniform3f(objectColorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(lightColorLoc, torchLightColor.r, torchLightColor.g, torchLightColor.b);
-    glUniform3f(lightPositionLoc, torchLightPosition.x, torchLightPosition.y, torchLightPosition.z);
+    uniforms.objectColor.Set(gObjectColor);
+    uniforms.lightColor.Set(torchLightColor);
+    uniforms.lightPos.Set(torchLightPosition);
 }
 
 
-// Renders
-void drawPlane(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
-    glUseProgram(gProgramId); // Shader to be used
+// Update camera, called once per frame before any object is drawn
+void updateCamera() {
+    CameraBlock camera;
+    camera.view = gCamera.GetViewMatrix();
 
-    // Apply scale
-    glm::mat4 scale = glm::scale(glm::vec3(xScale, yScale, zScale));
-    // Apply Rotation
-    glm::mat4 rotation = glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f));
-    // Apply Translation
-    glm::mat4 translation = glm::translate(glm::vec3(xPos, yPos, zPos));
-    // Apply model matrix
-    glm::mat4 model = translation * rotation * scale;
+    // Determine whether the projection is perspective or ortho.
+    if (gPerspectiveView) {
+        // Creates perspective projection
+        camera.projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+        gLodSelector.SetPerspective(gCamera.Position, glm::radians(gCamera.Zoom), (float)WINDOW_HEIGHT);
+    }
+    else {
+        // Creates ortho projection
+        camera.projection = glm::ortho(-2.0f, 2.0f, -2.0f, 2.0f, 0.1f, 100.0f);
+        gLodSelector.SetOrthographic(gCamera.Position, 4.0f, (float)WINDOW_HEIGHT);
+    }
 
-    // Update camera transformation
-    updateCamera(model);
+    camera.viewProjection = camera.projection * camera.view;
+    camera.position = glm::vec4(gCamera.Position, 1.0f);
+    gFrustum.Extract(camera.viewProjection);
+    gViewProjection = camera.viewProjection;
 
-    // Scale the texture proportional to the object
-    glm::vec2 gUVScale(1.0f, 1.0f);
+    // Upload the whole block at once; every program reads it through CAMERA_BLOCK_BINDING
+    glBindBuffer(GL_UNIFORM_BUFFER, gCameraUbo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &camera);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Both object programs share the lighting
+    updateLights(gProgram, gObjectUniforms);
+    updateLights(gIndirectProgram, gIndirectUniforms);
+}
 
-    GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
 
-    // Bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texBirchId);
+// Scene objects never move, so their world bounds are transformed once when the scene is built
+// and the hierarchy gets a full SAH build
+void UBuildCullBounds() {
+    gCuller.Clear();
+    vector<BoundingBox> boxes(gSceneObjects.size());
+    for (size_t i = 0; i < gSceneObjects.size(); ++i) {
+        const SceneObject& object = gSceneObjects[i];
+        const LodChain& lods = *object.lods;
+        glm::vec3 center = glm::vec3(object.model * glm::vec4(lods.Center, 1.0f));
+        boxes[i] = transformBox(lods.Bounds, object.model);
+        gSceneObjects[i].bounds = boxes[i];
+        gCuller.Add(center, lods.Radius * maxAxisScale(object.model), boxes[i]);
+    }
+    gSceneBvh.Build(boxes);
+    gVisibleObjects.resize(gCuller.Size());
+    cout << "INFO: frustum culling on the " << cullPathName(gCuller.Path) << " path, scene hierarchy cost " << gSceneBvh.Cost() << endl;
+}
+
+
+// Rasterizes the frustum-visible occluders into the software depth buffer, at their finest level so the buffer never
+// claims coverage a coarser mesh would add, then removes the objects hidden behind them from gVisibleObjects.
+// Returns how many objects remain
+size_t UCullOccludedObjects(size_t visibleCount) {
+    gSoftwareOcclusion.Begin(gViewProjection);
+    for (size_t i = 0; i < visibleCount; ++i) {
+        const SceneObject& object = gSceneObjects[gVisibleObjects[i]];
+        const PickMesh* occluder = object.occluder ? object.lods->Levels[0].Pick : nullptr;
+        if (occluder)
+            gSoftwareOcclusion.AddOccluder(occluder->Positions(), occluder->Indices(), object.model);
+    }
+    gSoftwareOcclusion.Rasterize();
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, planeMesh.nVertices);
+    return gSoftwareOcclusion.Cull(gVisibleObjects.data(), visibleCount,
+        [](uint32_t item) -> const BoundingBox& { return gSceneObjects[item].bounds; });
+}
 
 
+// Unprojects a viewport point (normalized device coordinates) at the near and far planes into a world ray and returns
+// the closest scene object it hits, or -1. The scene hierarchy finds candidate objects by their boxes; each candidate is
+// then intersected exactly, in object space, against the triangles of the detail level it is drawn with.
+// distance is measured from the near plane, which also works for the orthographic camera
+int UPickObject(float ndcX, float ndcY, float& distance) {
+    glm::mat4 inverseViewProjection = glm::inverse(gViewProjection);
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin; // Ray parameter 0 is the near plane, 1 the far plane
+
+    RayHit hit;
+    bool found = gSceneBvh.Raycast(origin, direction, 1.0f, [&](uint32_t item, float closest) {
+        const SceneObject& object = gSceneObjects[item];
+        const PickMesh* pick = object.lods->Levels[object.lodLevel].Pick;
+        if (!pick)
+            return -1.0f;
+
+        // An affine transform keeps ray parameters, so the object-space hit distance compares directly
+        glm::mat4 toObject = glm::inverse(object.model);
+        PickHit meshHit;
+        bool meshFound = pick->Raycast(glm::vec3(toObject * glm::vec4(origin, 1.0f)), glm::vec3(toObject * glm::vec4(direction, 0.0f)),
+            closest, meshHit);
+        return meshFound ? meshHit.Distance : -1.0f;
+    }, hit);
+
+    if (!found)
+        return -1;
+    distance = hit.Distance * glm::length(direction);
+    return (int)hit.Item;
+}
 
 
+// Shows last frame's visible and culled object counts and its queue draws and binds in the title, a few times per second
+void updateWindowTitle(float time) {
+    if (time - gLastTitleUpdate < 0.25f)
+        return;
+    gLastTitleUpdate = time;
+
+    string title = string(WINDOW_TITLE) + (gBvhCulling ? " | BVH" : " | flat") + (gIndirectDraw && gOcclusionCulling ? " + Hi-Z" : "") + " visible " + to_string(gCullStats.Visible) + ", culled " + to_string(gCullStats.Culled);
+    if (gCpuOcclusion)
+        title += ", occluded " + to_string(gCullStats.Occluded);
+    if (gQueryCulling && !gIndirectDraw)
+        title += " | queries " + to_string(gOcclusionQueries.Stats.Queries) + ", skipped " + to_string(gOcclusionQueries.Stats.Skipped)
+            + " of " + to_string(gOcclusionQueries.Stats.Gated);
+    if (gDepthPrepass && !gIndirectDraw)
+        title += " | prepass";
+    const RenderQueueStats& queue = gRenderQueue.Stats;
+    title += " | draws " + to_string(queue.Draws) + ", instances " + to_string(queue.Instances) + ", binds " + to_string(queue.ProgramBinds)
+        + "/" + to_string(queue.TextureBinds) + "/" + to_string(queue.VaoBinds);
+    if (gIndirectDraw)
+        title += " + " + to_string(gIndirectRenderer.Stats.MultiDraws) + " multi-draws";
+    if (gSelectedObject >= 0)
+        title += " | selected " + to_string(gSelectedObject);
+    glfwSetWindowTitle(gWindow, title.c_str());
+}
 
 
+// Normalized distance from the camera to an object's origin, used to order draws front to back
+float viewDepth(const glm::mat4& model) {
+    return glm::distance(glm::vec3(model[3]), gCamera.Position) / 100.0f; // 100 is the far plane
 }
 
 
-void drawCube(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
-    glUseProgram(gProgramId); // Shader to be used
+// Adds an object to the scene, by default rendered with the lit object shader program
+void addObject(const LodChain& lods, GLuint textureId, const glm::mat4& model, const glm::vec2& uvScale,
+    RenderPass pass = RENDER_PASS_OPAQUE, GLuint program = gObjectSlot) {
+    SceneObject object = { &lods, pass, program, textureId, model, uvScale, 0, BoundingBox(), false };
+    gSceneObjects.push_back(object);
+}
+
 
+// Renders
+void addPlane(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
     // Apply scale
     glm::mat4 scale = glm::scale(glm::vec3(xScale, yScale, zScale));
     // Apply Rotation
@@ -610,68 +1421,41 @@ void drawCube(float xScale, float yScale, float zScale, float xPos, float yPos,
     // Apply model matrix
     glm::mat4 model = translation * rotation * scale;
 
-    // Updates the camera and selects shader
-    glm::mat4 view = gCamera.GetViewMatrix();
-    glm::mat4 projection; // Initialize projection
+    // Scale the texture proportional to the object
+    glm::vec2 gUVScale(1.0f, 1.0f);
 
+    // Add the plane with its texture. The desk hides everything below it, so it is the occluder of both occlusion culling paths
+    addObject(planeLods, texBirchId, model, gUVScale);
+    gSceneObjects.back().occluder = true;
+}
 
-    // Determine whether the projection is perspective or ortho.
-    if (gPerspectiveView) {
-        // Creates perspective projection
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    }
-    else {
-        // Creates ortho projection
-        projection = glm::ortho(-2.0f, 2.0f, -2.0f, 2.0f, 0.1f, 100.0f);
-    }
 
-    // Update camera
-    updateCamera(model);
+void addCube(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
+    // Apply scale
+    glm::mat4 scale = glm::scale(glm::vec3(xScale, yScale, zScale));
+    // Apply Rotation
+    glm::mat4 rotation = glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f));
+    // Apply Translation
+    glm::mat4 translation = glm::translate(glm::vec3(xPos, yPos, zPos));
+    // Apply model matrix
+    glm::mat4 model = translation * rotation * scale;
 
     // Scale the texture proportional to the object
     glm::vec2 gUVScale(1.0f, 1.0f);
 
-    GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(cubeMesh.vao);
-
-    // Bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texTorchLightId);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, cubeMesh.nVertices);
+    // Add the cube with its texture
+    addObject(cubeLods, texTorchLightId, model, gUVScale);
 
     // Draw the light source
-    GLint modelLoc;
-    GLint viewLoc;
-    GLint projLoc;
-
-    // Select shader program
-    glUseProgram(gLightProgramId);
-
     //Transform the smaller cube used as a visual que for the light source
     model = glm::translate(torchLightPosition) * glm::scale(gLightScale);
 
-    // Reference matrix uniforms from the Light Shader program
-    modelLoc = glGetUniformLocation(gLightProgramId, "model");
-    viewLoc = glGetUniformLocation(gLightProgramId, "view");
-    projLoc = glGetUniformLocation(gLightProgramId, "projection");
-
-    // Pass matrix data to the Light Shader program's matrix uniforms
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    glDrawArrays(GL_TRIANGLES, 0, cubeMesh.nVertices);
+    // The light marker uses the light shader program and is drawn in its own pass
+    addObject(cubeLods, 0, model, gUVScale, RENDER_PASS_EMISSIVE, gLightSlot);
 }
 
 
-void drawRectPrism(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
-    glUseProgram(gProgramId); // Shader to be used
-
+void addRectPrism(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
     // Apply scale
     glm::mat4 scale = glm::scale(glm::vec3(xScale, yScale, zScale));
     // Apply Rotation
@@ -681,30 +1465,15 @@ void drawRectPrism(float xScale, float yScale, float zScale, float xPos, float y
     // Apply model matrix
     glm::mat4 model = translation * rotation * scale;
 
-    // Updates the camera and selects shader
-    updateCamera(model);
-
     // Scale the texture proportional to the object
     glm::vec2 gUVScale(1.0f, 1.0f);
 
-    GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(rectPrismMesh.vao);
-
-    // Bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texTorchHandleId);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, rectPrismMesh.nVertices);
+    // Add the prism with its texture
+    addObject(rectPrismLods, texTorchHandleId, model, gUVScale);
 }
 
 
-void drawPyramid(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
-    glUseProgram(gProgramId); // Shader to be used
-
+void addPyramid(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
     // Apply scale
     glm::mat4 scale = glm::scale(glm::vec3(xScale, yScale, zScale));
     // Apply Rotation
@@ -716,30 +1485,15 @@ void drawPyramid(float xScale, float yScale, float zScale, float xPos, float yPo
     // Apply model matrix
     glm::mat4 model = translation * (rotation * adjustment) * scale;
 
-    // Update the camera's position
-    updateCamera(model);
-
     // Scale the texture proportional to the object
     glm::vec2 gUVScale(1.0f, 1.0f);
 
-    GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(pyramidMesh.vao);
-
-    // Bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texShinyBlueId);
-
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, pyramidMesh.nVertices);
+    // Add the pyramid with its texture
+    addObject(pyramidLods, texShinyBlueId, model, gUVScale);
 }
 
 
-void drawCylinder(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
-    glUseProgram(gProgramId); // Shader to be used
-
+void addCylinder(float xScale, float yScale, float zScale, float xPos, float yPos, float zPos, float angle) {
     // Apply scale
     glm::mat4 scale = glm::scale(glm::vec3(xScale, yScale, zScale));
     // Apply Rotation
@@ -749,30 +1503,64 @@ void drawCylinder(float xScale, float yScale, float zScale, float xPos, float yP
     // Apply model matrix
     glm::mat4 model = translation * rotation * scale;
 
-    // Updates the camera and selects shader
-    updateCamera(model);
-
     // Scale the texture proportional to the object
     glm::vec2 gUVScale(1.0f, 1.0f);
 
-    GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
+    // Add the cylinder with its texture
+    addObject(cylinderLods, texPlasticId, model, gUVScale);
+}
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(cylinderMesh.vao);
 
-    // Bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texPlasticId);
+// Stress test props: a square grid of small bottles, pyramids and posts on a floor under the desk
+void addProps() {
+    int side = (int)ceil(sqrt((float)gPropCount));
+    float spacing = 0.6f;
+    float origin = -0.5f * spacing * (side - 1);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, cylinderMesh.nVertices);
+    for (int i = 0; i < gPropCount; ++i) {
+        float x = origin + spacing * (i % side);
+        float z = origin + spacing * (i / side);
+        float angle = 0.37f * i;
+
+        switch (i % 3) {
+        case 0: addCylinder(0.15f, 0.5f, 0.15f, x, -3.0f, z, angle); break;
+        case 1: addPyramid(0.3f, 0.3f, 0.3f, x, -3.0f, z, angle); break;
+        default: addRectPrism(0.2f, 0.6f, 0.2f, x, -3.0f, z, angle); break;
+        }
+    }
 }
 
 
 
 
 
+// Function to place all the shapes
+void buildScene() {
+    gSceneObjects.clear();
+
+    // Desk
+    addPlane(12.5, 1.0, 10.0, 0.0, 0.0, 0.0, 0.0);
+
+    // Blue pyramid
+    addPyramid(1.0, 1.0, 1.0, 0.0, 0.0, 0.0, 0.0);
+
+    // Minecraft Torch light
+    addRectPrism(0.8, 3.2, 0.8, 1.4, 0.0, -0.15, 5.0); // Torch handle
+    addCube(0.8, 0.8, 0.8, 1.4, 3.2, -0.15, 5.0); // Torch head
+
+    // Water bottle
+    addCylinder(0.6, 2.8, 0.6, 0.0, 0.0, -2.0, 0.0);
+    addCylinder(0.55, 0.3, 0.55, 0.0, 2.8, -2.0, 0.0);
+    addCylinder(0.2, 0.2, 0.2, 0.0, 3.1, -2.0, 0.0);
+
+    // Stress test props, if any
+    addProps();
+
+    UBuildCullBounds();
+    gOcclusionQueries.Reset(gSceneObjects.size());
+}
+
+
 // Function to draw all the shapes
 void drawScene() {
     glEnable(GL_DEPTH_TEST);
@@ -781,20 +1569,90 @@ void drawScene() {
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Desk
-    drawPlane(12.5, 1.0, 10.0, 0.0, 0.0, 0.0, 0.0);
+    // Camera matrices and lighting only change once per frame
+    updateCamera();
+
+    // Queue every visible object at the detail level its projected size needs
+    gRenderQueue.Clear();
+    size_t visibleCount = 0;
+    if (gBvhCulling)
+        gSceneBvh.QueryFrustum(gFrustum, [&visibleCount](uint32_t item) { gVisibleObjects[visibleCount++] = item; });
+    else
+        visibleCount = gCuller.Cull(gFrustum, gVisibleObjects.data());
+    gCullStats.Occluded = 0;
+    if (gCpuOcclusion) {
+        visibleCount = UCullOccludedObjects(visibleCount);
+        gCullStats.Occluded = gSoftwareOcclusion.Stats.Occluded;
+    }
+    gCullStats.Visible = (unsigned)visibleCount;
+    gCullStats.Culled = (unsigned)(gSceneObjects.size() - visibleCount - gCullStats.Occluded);
+    bool occlusion = gIndirectDraw && gOcclusionCulling;
+    bool queries = gQueryCulling && !gIndirectDraw;
+    bool prepass = gDepthPrepass && !gIndirectDraw;
+    if (queries) {
+        gOcclusionQueries.BeginFrame();
+        gQueriedObjects.clear();
+    }
+    for (size_t i = 0; i < visibleCount; ++i) {
+        SceneObject& object = gSceneObjects[gVisibleObjects[i]];
+        object.lodLevel = gLodSelector.Select(*object.lods, object.model, object.lodLevel);
+        const MeshRange& mesh = object.lods->Levels[object.lodLevel].Mesh;
+        float depth = viewDepth(object.model);
+
+        // Expensive opaque draws are left for the GPU to skip when their box was hidden last frame
+        GLuint condition = 0;
+        if (queries && object.pass == RENDER_PASS_OPAQUE && mesh.IndexCount >= CONDITIONAL_MIN_INDICES) {
+            gQueriedObjects.push_back(gVisibleObjects[i]);
+            condition = gOcclusionQueries.Condition(gVisibleObjects[i]);
+        }
+        gRenderQueue.Submit(object.pass, object.program, object.texture, mesh, object.model, object.uvScale, object.bounds, depth, condition);
 
-    // Blue pyramid
-    drawPyramid(1.0, 1.0, 1.0, 0.0, 0.0, 0.0, 0.0);
+        // Opaque objects are drawn a second time, depth only, front to back ahead of shading
+        if (prepass && object.pass == RENDER_PASS_OPAQUE)
+            gRenderQueue.Submit(RENDER_PASS_DEPTH, gDepthSlot, 0, mesh, object.model, object.uvScale, object.bounds, depth, condition);
 
-    // Minecraft Torch light
-    drawRectPrism(0.8, 3.2, 0.8, 1.4, 0.0, -0.15, 5.0); // Torch handle
-    drawCube(0.8, 0.8, 0.8, 1.4, 3.2, -0.15, 5.0); // Torch head
+        // Occluders are drawn a second time, depth only, before anything is tested against them
+        if (occlusion && object.occluder)
+            gRenderQueue.Submit(RENDER_PASS_OCCLUDER, gLightSlot, 0, mesh, object.model, object.uvScale, object.bounds, depth);
+    }
 
-    // Water bottle
-    drawCylinder(0.6, 2.8, 0.6, 0.0, 0.0, -2.0, 0.0);
-    drawCylinder(0.55, 0.3, 0.55, 0.0, 2.8, -2.0, 0.0);
-    drawCylinder(0.2, 0.2, 0.2, 0.0, 3.1, -2.0, 0.0);
+    // Sort by pass, program, texture and VAO, then issue the draws with redundant binds skipped
+    gRenderQueue.Sort();
+    if (gIndirectDraw) {
+        // Occluder depth, reduced into the pyramid the indirect pass is culled against
+        HiZCuller* occlusionCuller = nullptr;
+        if (occlusion) {
+            gHiZCuller.BeginOccluders();
+            gRenderQueue.Execute(1u << RENDER_PASS_OCCLUDER);
+            gHiZCuller.EndOccluders();
+            gHiZCuller.BuildPyramid();
+            occlusionCuller = &gHiZCuller;
+        }
+
+        // The whole opaque pass in one multi-draw; only the light marker goes through the queue
+        gIndirectRenderer.Draw(gRenderQueue, RENDER_PASS_OPAQUE, gIndirectProgram, occlusionCuller);
+        gRenderQueue.Execute(1u << RENDER_PASS_EMISSIVE);
+    }
+    else if (prepass) {
+        // Depth first without color writes, then shade only the fragments whose depth matches it exactly
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        gRenderQueue.Execute(1u << RENDER_PASS_DEPTH);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+        gRenderQueue.Execute(1u << RENDER_PASS_OPAQUE);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+        gRenderQueue.Execute(1u << RENDER_PASS_EMISSIVE);
+    }
+    else
+        gRenderQueue.Execute();
+
+    // Query the boxes against the finished depth buffer; the results gate next frame's draws
+    if (queries)
+        gOcclusionQueries.Issue(gQueriedObjects.data(), gQueriedObjects.size(),
+            [](uint32_t item) -> const BoundingBox& { return gSceneObjects[item].bounds; }, gLightProgram, gCamera.Position);
 
     // Deactviate VAO
     glBindVertexArray(0);
@@ -805,513 +1663,743 @@ void drawScene() {
 }
 
 // Meshes
-void createPlaneMesh(GLMesh& mesh) {
-    // Vertex data
-    GLfloat verts[] = {
-        // Vertex Positions||  Normal vectors  || Texture coordinates
-        // Base (Facing Y+)
-       -0.5f,  0.0f,  0.5f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,    // A
-        0.5f,  0.0f,  0.5f,   0.0f, 0.0f, 1.0f,   1.0f, 0.0f,    // B
-        0.5f,  0.0f, -0.5f,   0.0f, 0.0f, 1.0f,   1.0f, 1.0f,    // C
-       -0.5f,  0.0f,  0.5f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,    // A
-       -0.5f,  0.0f, -0.5f,   0.0f, 0.0f, 1.0f,   0.0f, 1.0f,    // D
-        0.5f,  0.0f, -0.5f,   0.0f, 0.0f, 1.0f,   1.0f, 1.0f     // C
-    };
+// Torch head: a box lit from the inside, so its normals point inwards and the torch light passes through
+void createCubeMesh(GLMesh& mesh) {
+    MeshBuilder builder;
+    generatePrimitive(PRIMITIVE_BOX, 1, builder);
+    invertNormals(builder.Vertices);
+    UCreateMesh(mesh, builder);
+}
+
+
+// Fills a detail chain with a primitive at decreasing segment counts (finest first); bounds come from the finest mesh
+void UBuildPrimitiveLods(LodChain& chain, PrimitiveType type, std::initializer_list<int> segments) {
+    chain = LodChain();
+    for (int count : segments) {
+        const GLMesh& mesh = UGetPrimitiveMesh(type, count);
+        if (chain.Levels.empty()) {
+            chain.Center = mesh.center;
+            chain.Radius = mesh.radius;
+            chain.Bounds = mesh.bounds;
+        }
+        LodLevel level = { mesh.range, primitiveError(type, count), mesh.pick.get() };
+        chain.Levels.push_back(level);
+    }
+}
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
 
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+// Makes a chain holding a single mesh
+void UBuildSingleLod(LodChain& chain, const GLMesh& mesh) {
+    chain = LodChain();
+    LodLevel level = { mesh.range, 0.0f, mesh.pick.get() };
+    chain.Levels.push_back(level);
+    chain.Center = mesh.center;
+    chain.Radius = mesh.radius;
+    chain.Bounds = mesh.bounds;
+}
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+// Returns the mesh of a primitive at a detail level, generating and uploading it on first use
+const GLMesh& UGetPrimitiveMesh(PrimitiveType type, int segments) {
+    GLMesh* cached = gPrimitiveMeshes.Find(type, segments);
+    if (cached)
+        return *cached;
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+    MeshBuilder builder;
+    generatePrimitive(type, segments, builder);
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    GLMesh mesh;
+    UCreateMesh(mesh, builder);
+    return gPrimitiveMeshes.Insert(type, segments, mesh);
+}
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+// Cooked version of a texture source when one exists and cooked textures are enabled, else the source itself
+string UResolveTexturePath(const char* filename)
+{
+    if (!gCookedTextures)
+        return filename;
+    string cooked = cookedTexturePath(filename);
+    FILE* file = fopen(cooked.c_str(), "rb");
+    if (!file)
+        return filename;
+    fclose(file);
+    return cooked;
 }
 
+// Cooked texture array layer of a texture source when one exists and cooked textures are enabled, else empty
+string UResolveLayerPath(const char* filename)
+{
+    if (!gCookedTextures)
+        return string();
+    string layer = cookedLayerPath(filename);
+    FILE* file = fopen(layer.c_str(), "rb");
+    if (!file)
+        return string();
+    fclose(file);
+    return layer;
+}
 
-void createPyramidMesh(GLMesh& mesh) {
-    // Vertex Data
-    GLfloat verts[] = {
-        // Vertex Positions||  Normal vectors   || Texture coordinates
-        // Base (Facing Y-)
-       -0.5f, -0.5f, 0.0f,   0.0f,  0.0f, -1.0f,   0.0f, 0.0f,  // A
-        0.5f, -0.5f, 0.0f,   0.0f,  0.0f, -1.0f,   1.0f, 0.0f,  // B
-        0.5f,  0.5f, 0.0f,   0.0f,  0.0f, -1.0f,   1.0f, 1.0f,  // C
-       -0.5f, -0.5f, 0.0f,   0.0f,  0.0f, -1.0f,   0.0f, 0.0f,  // A
-       -0.5f,  0.5f, 0.0f,   0.0f,  0.0f, -1.0f,   0.0f, 1.0f,  // D
-        0.5f,  0.5f, 0.0f,   0.0f,  0.0f, -1.0f,   1.0f, 1.0f,  // C
+// Builds the indirect pass's texture array the first time indirect drawing is turned on, so instanced-only runs
+// never pay for it
+void UBuildTextureArray()
+{
+    if (gIndirectRenderer.TextureArray)
+        return;
+    gIndirectRenderer.BuildTextureArray(gArrayTextures);
+    cout << "INFO: Texture array of " << gArrayTextures.size() << " layers" << (gIndirectRenderer.CookedLayers ? ", cooked BC7" : ", copied RGBA8") << endl;
+}
 
-        // Side 1 (Facing Z+)
-       -0.5f, -0.5f, 0.0f,   0.0f, -1.0f,  1.0f,   0.0f, 0.0f,  // A
-        0.5f, -0.5f, 0.0f,   0.0f, -1.0f,  1.0f,   1.0f, 0.0f,  // B
-        0.0f, -0.0f, 1.0f,   0.0f, -1.0f,  1.0f,   0.5f, 1.0f,  // E
+// Generate and load texture
+bool UCreateTexture(const char* filename, GLuint& textureId)
+{
+    string path = UResolveTexturePath(filename);
+    if (isKtx2Path(path))
+        return UCreateCompressedTexture(path.c_str(), textureId);
 
-        // Side 2 (Facing X+)
-        0.5f, -0.5f, 0.0f,   1.0f,  0.0f, 1.0f,    0.0f, 0.0f,  // B
-        0.5f,  0.5f, 0.0f,   1.0f,  0.0f, 1.0f,    1.0f, 0.0f,  // C
-        0.0f, -0.0f, 1.0f,   1.0f,  0.0f, 1.0f,    0.5f, 1.0f,  // E
+    // A cache entry carries the flipped image and its mipmaps; upload them straight from the mapped file, or from memory when the entry could not be written
+    shared_ptr<CachedTexture> cached = gTextureCaching ? gTextureCache.Load(path, gWorkers.get()) : nullptr;
+    if (cached)
+    {
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
 
-        // Side 3 (Facing Z-)
-        0.5f,  0.5f, 0.0f,   0.0f,  1.0f, 1.0f,    0.0f, 0.0f,  // C
-       -0.5f,  0.5f, 0.0f,   0.0f,  1.0f, 1.0f,    1.0f, 0.0f,  // D
-        0.0f, -0.0f, 1.0f,   0.0f,  1.0f, 1.0f,    0.5f, 1.0f,  // E
+        // set the texture wrapping parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        // set texture filtering parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-        // Side 4 (Facing X-)
-       -0.5f,  0.5f, 0.0f,   -1.0f,  0.0f, 1.0f,   0.0f, 0.0f,  // D
-       -0.5f, -0.5f, 0.0f,   -1.0f,  0.0f, 1.0f,   1.0f, 0.0f,  // A
-        0.0f, -0.0f, 1.0f,   -1.0f,  0.0f, 1.0f,   0.5f, 1.0f   // E
-    };
+        cached->Upload();
+        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
+        return true;
+    }
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
+    int width, height, channels;
+    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+    if (image)
+    {
+        if (channels != 3 && channels != 4)
+        {
+            cout << "Not implemented to handle image with " << channels << " channels" << endl;
+            stbi_image_free(image);
+            return false;
+        }
 
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+        // Flip for OpenGL and expand RGB to RGBA in one pass, so the driver gets 4-byte texels
+        vector<uint8_t> level0((size_t)width * height * 4);
+        prepareForUpload(image, width, height, channels, level0.data(), gWorkers.get());
+        stbi_image_free(image);
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+        // Build the mip chain on the CPU in linear light rather than leaving it to the driver's glGenerateMipmap
+        chrono::steady_clock::time_point mipStart = chrono::steady_clock::now();
+        vector<MipLevel> levels;
+        buildMipChain(level0, width, height, 4, levels, MIP_FILTER_BOX, gWorkers.get());
+        gMipMilliseconds += chrono::duration<double, milli>(chrono::steady_clock::now() - mipStart).count();
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+        glGenTextures(1, &textureId);
+        glBindTexture(GL_TEXTURE_2D, textureId);
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+        // set the texture wrapping parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        // set texture filtering parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+        for (size_t level = 0; level < levels.size(); ++level)
+            glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGBA8, levels[level].Width, levels[level].Height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                levels[level].Pixels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+        return true;
+    }
+
+    // Error loading the image
+    return false;
 }
 
+// Load a cooked texture: its block compressed mip chain is uploaded as stored, with no decoding or mipmap generation
+bool UCreateCompressedTexture(const char* filename, GLuint& textureId)
+{
+    vector<uint8_t> file;
+    Ktx2Image image;
+    if (!readFileBytes(filename, file) || !parseKtx2(file.data(), file.size(), image))
+        return false;
 
-void createCubeMesh(GLMesh& mesh) {
-    // Vertex Data
-    GLfloat verts[] = {
-        // Normal vectors must be opposite for light to pass through
-        // Vertex Positions||  Normal vectors   || Texture coordinates
-        // Base (Facing Y-)
-       -0.5f,  0.0f, -0.5f,   0.0f, 1.0f, 0.0f,    0.0f, 0.0f,    // A
-        0.5f,  0.0f, -0.5f,   0.0f, 1.0f, 0.0f,    1.0f, 0.0f,    // B
-        0.5f,  0.0f,  0.5f,   0.0f, 1.0f, 0.0f,    1.0f, 1.0f,    // C
-       -0.5f,  0.0f, -0.5f,   0.0f, 1.0f, 0.0f,    0.0f, 0.0f,    // A
-       -0.5f,  0.0f,  0.5f,   0.0f, 1.0f, 0.0f,    0.0f, 1.0f,    // D
-        0.5f,  0.0f,  0.5f,   0.0f, 1.0f, 0.0f,    1.0f, 1.0f,    // C
-
-        // Top (Facing Y+)
-       -0.5f,  1.0f, -0.5f,   0.0f, -1.0f, 0.0f,   0.0f, 0.0f,    // E
-        0.5f,  1.0f, -0.5f,   0.0f, -1.0f, 0.0f,   1.0f, 0.0f,    // F
-        0.5f,  1.0f,  0.5f,   0.0f, -1.0f, 0.0f,   1.0f, 1.0f,    // G
-       -0.5f,  1.0f, -0.5f,   0.0f, -1.0f, 0.0f,   0.0f, 0.0f,    // E
-       -0.5f,  1.0f,  0.5f,   0.0f, -1.0f, 0.0f,   0.0f, 1.0f,    // H
-        0.5f,  1.0f,  0.5f,   0.0f, -1.0f, 0.0f,   1.0f, 1.0f,    // G
-
-        // Side #1 (Facing Z-)
-       -0.5f,  0.0f, -0.5f,   0.0f,  0.0f, 1.0f,  0.0f, 0.0f,    // A
-        0.5f,  0.0f, -0.5f,   0.0f,  0.0f, 1.0f,  1.0f, 0.0f,    // B
-        0.5f,  1.0f, -0.5f,   0.0f,  0.0f, 1.0f,  1.0f, 1.0f,    // F
-       -0.5f,  0.0f, -0.5f,   0.0f,  0.0f, 1.0f,  0.0f, 0.0f,    // A
-       -0.5f,  1.0f, -0.5f,   0.0f,  0.0f, 1.0f,  0.0f, 1.0f,    // E
-        0.5f,  1.0f, -0.5f,   0.0f,  0.0f, 1.0f,  1.0f, 1.0f,    // F
-
-        // Side #2 (Facing X-)
-       -0.5f,  1.0f, -0.5f,   1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // E
-       -0.5f,  0.0f, -0.5f,   1.0f,  0.0f, 0.0f,  1.0f, 0.0f,    // A
-       -0.5f,  0.0f,  0.5f,   1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // D
-       -0.5f,  1.0f, -0.5f,   1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // E
-       -0.5f,  1.0f,  0.5f,   1.0f,  0.0f, 0.0f,  0.0f, 1.0f,    // H
-       -0.5f,  0.0f,  0.5f,   1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // D
-
-        // Side #3 (Facing X+)
-        0.5f,  0.0f, -0.5f,    -1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // B
-        0.5f,  1.0f, -0.5f,    -1.0f,  0.0f, 0.0f,  1.0f, 0.0f,    // F
-        0.5f,  1.0f,  0.5f,    -1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // G
-        0.5f,  0.0f, -0.5f,    -1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // B
-        0.5f,  0.0f,  0.5f,    -1.0f,  0.0f, 0.0f,  0.0f, 1.0f,    // C
-        0.5f,  1.0f,  0.5f,    -1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // G
-
-        // Side #4 (Facing Z+)
-       -0.5f,  0.0f,  0.5f,    0.0f,  0.0f, -1.0f,  0.0f, 0.0f,    // D
-        0.5f,  0.0f,  0.5f,    0.0f,  0.0f, -1.0f,  1.0f, 0.0f,    // C
-        0.5f,  1.0f,  0.5f,    0.0f,  0.0f, -1.0f,  1.0f, 1.0f,    // G
-       -0.5f,  0.0f,  0.5f,    0.0f,  0.0f, -1.0f,  0.0f, 0.0f,    // D
-       -0.5f,  1.0f,  0.5f,    0.0f,  0.0f, -1.0f,  0.0f, 1.0f,    // H
-        0.5f,  1.0f,  0.5f,    0.0f,  0.0f, -1.0f,  1.0f, 1.0f,    // G
-    };
+    GLenum format = ktx2GlFormat(image.VkFormat);
+    if (format == 0)
+    {
+        cout << "Not implemented to handle KTX2 format " << image.VkFormat << endl;
+        return false;
+    }
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
-
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
-}
-
-
-void createRectPrismMesh(GLMesh& mesh) {
-    // Vertex Data
-    GLfloat verts[] = {
-        // Vertex Positions||  Normal vectors   || Texture coordinates
-        // Base (Facing Y-)
-       -0.5f,  0.0f, -0.5f,   0.0f, -1.0f, 0.0f,   0.0f, 0.0f,    // A
-        0.5f,  0.0f, -0.5f,   0.0f, -1.0f, 0.0f,   1.0f, 0.0f,    // B
-        0.5f,  0.0f,  0.5f,   0.0f, -1.0f, 0.0f,   1.0f, 1.0f,    // C
-       -0.5f,  0.0f, -0.5f,   0.0f, -1.0f, 0.0f,   0.0f, 0.0f,    // A
-       -0.5f,  0.0f,  0.5f,   0.0f, -1.0f, 0.0f,   0.0f, 1.0f,    // D
-        0.5f,  0.0f,  0.5f,   0.0f, -1.0f, 0.0f,   1.0f, 1.0f,    // C
-
-        // Top (Facing Y+)
-       -0.5f,  1.0f, -0.5f,   0.0f,  1.0f, 0.0f,   0.0f, 0.0f,    // E
-        0.5f,  1.0f, -0.5f,   0.0f,  1.0f, 0.0f,   1.0f, 0.0f,    // F
-        0.5f,  1.0f,  0.5f,   0.0f,  1.0f, 0.0f,   1.0f, 1.0f,    // G
-       -0.5f,  1.0f, -0.5f,   0.0f,  1.0f, 0.0f,   0.0f, 0.0f,    // E
-       -0.5f,  1.0f,  0.5f,   0.0f,  1.0f, 0.0f,   0.0f, 1.0f,    // H
-        0.5f,  1.0f,  0.5f,   0.0f,  1.0f, 0.0f,   1.0f, 1.0f,    // G
-
-        // Side #1 (Facing Z-)
-       -0.5f,  0.0f, -0.5f,   0.0f,  0.0f, -1.0f,  0.0f, 0.0f,    // A
-        0.5f,  0.0f, -0.5f,   0.0f,  0.0f, -1.0f,  1.0f, 0.0f,    // B
-        0.5f,  1.0f, -0.5f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f,    // F
-       -0.5f,  0.0f, -0.5f,   0.0f,  0.0f, -1.0f,  0.0f, 0.0f,    // A
-       -0.5f,  1.0f, -0.5f,   0.0f,  0.0f, -1.0f,  0.0f, 1.0f,    // E
-        0.5f,  1.0f, -0.5f,   0.0f,  0.0f, -1.0f,  1.0f, 1.0f,    // F
-
-        // Side #2 (Facing X-)
-       -0.5f,  1.0f, -0.5f,   -1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // E
-       -0.5f,  0.0f, -0.5f,   -1.0f,  0.0f, 0.0f,  0.0f, 1.0f,    // A
-       -0.5f,  0.0f,  0.5f,   -1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // D
-       -0.5f,  1.0f, -0.5f,   -1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // E
-       -0.5f,  1.0f,  0.5f,   -1.0f,  0.0f, 0.0f,  1.0f, 0.0f,    // H
-       -0.5f,  0.0f,  0.5f,   -1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // D
-
-        // Side #3 (Facing X+)
-        0.5f,  0.0f, -0.5f,    1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // B
-        0.5f,  1.0f, -0.5f,    1.0f,  0.0f, 0.0f,  1.0f, 0.0f,    // F
-        0.5f,  1.0f,  0.5f,    1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // G
-        0.5f,  0.0f, -0.5f,    1.0f,  0.0f, 0.0f,  1.0f, 1.0f,    // B
-        0.5f,  0.0f,  0.5f,    1.0f,  0.0f, 0.0f,  0.0f, 1.0f,    // C
-        0.5f,  1.0f,  0.5f,    1.0f,  0.0f, 0.0f,  0.0f, 0.0f,    // G
-
-        // Side #4 (Facing Z+)
-       -0.5f,  0.0f,  0.5f,    0.0f,  0.0f, 1.0f,  0.0f, 0.0f,    // D
-        0.5f,  0.0f,  0.5f,    0.0f,  0.0f, 1.0f,  1.0f, 0.0f,    // C
-        0.5f,  1.0f,  0.5f,    0.0f,  0.0f, 1.0f,  1.0f, 1.0f,    // G
-       -0.5f,  0.0f,  0.5f,    0.0f,  0.0f, 1.0f,  0.0f, 0.0f,    // D
-       -0.5f,  1.0f,  0.5f,    0.0f,  0.0f, 1.0f,  0.0f, 1.0f,    // H
-        0.5f,  1.0f,  0.5f,    0.0f,  0.0f, 1.0f,  1.0f, 1.0f,    // G
-    };
+    glGenTextures(1, &textureId);
+    glBindTexture(GL_TEXTURE_2D, textureId);
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
+    // set the texture wrapping parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // set texture filtering parameters
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+    for (size_t level = 0; level < image.Levels.size(); ++level)
+    {
+        const Ktx2Level& data = image.Levels[level];
+        glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, format, data.Width, data.Height, 0, (GLsizei)data.Size, file.data() + data.Offset);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.Levels.size() - 1);
+    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+    return true;
+}
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+// Optimizes an indexed mesh and copies it into the geometry arena
+void UCreateMesh(GLMesh& mesh, MeshBuilder& builder)
+{
+    // Reorder triangles and vertices for the post-transform cache, overdraw and vertex fetch
+    MeshOptimizationStats stats = optimizeMesh(builder.Vertices, builder.Indices);
+
+    mesh.nVertices = (GLuint)builder.Vertices.size();
+    mesh.nIndices = (GLuint)builder.Indices.size();
+    boundingSphere(builder.Vertices, mesh.center, mesh.radius);
+    mesh.bounds = boundingBox(builder.Vertices);
+    mesh.pick = make_shared<PickMesh>();
+    mesh.pick->Build(builder.Vertices, builder.Indices);
+
+    // Suballocate vertex and index space; the arena's VAO already describes the vertex layout.
+    // Compact vertices are used when every decoded attribute stays within tolerance
+    mesh.range = MeshRange();
+    vector<CompactVertex> compact;
+    VertexCompressionResult encoding;
+    bool compressed = gCompactVertices && compressVertices(builder.Vertices, compact, encoding);
+    bool allocated = compressed ? gCompactArena.Allocate(builder, compact, encoding, mesh.range) : gGeometryArena.Allocate(builder, mesh.range);
+    if (!allocated)
+    {
+        mesh.nIndices = 0;
+        return;
+    }
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+    cout << "INFO: Mesh welded to " << mesh.nVertices << " vertices, " << mesh.nIndices << " indices ("
+        << (mesh.range.IndexType == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit) at base vertex " << mesh.range.BaseVertex << endl;
+    UPrintOptimizationStats("Mesh", stats);
+    if (gCompactVertices)
+        UPrintCompressionStats("Mesh", builder.Vertices.size(), encoding, compressed);
+}
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+// Destroy mesh
+void UDestroyMesh(GLMesh& mesh)
+{
+    if (mesh.range.QuantizedPositions)
+        gCompactArena.Free(mesh.range);
+    else
+        gGeometryArena.Free(mesh.range);
+    mesh.pick.reset();
+}
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+// Prints ACMR/ATVR before and after optimization
+void UPrintOptimizationStats(const char* name, const MeshOptimizationStats& stats)
+{
+    cout << "INFO: " << name << " ACMR " << stats.Before.Acmr << " -> " << stats.After.Acmr
+        << ", ATVR " << stats.Before.Atvr << " -> " << stats.After.Atvr << endl;
+}
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+// Prints the vertex size and the largest decode errors of a compressed mesh
+void UPrintCompressionStats(const char* name, size_t vertexCount, const VertexCompressionResult& encoding, bool compressed)
+{
+    cout << "INFO: " << name << (compressed ? " compact vertices, " : " kept float vertices (over tolerance), ")
+        << vertexCount * sizeof(Vertex) << " -> " << vertexCount * (compressed ? sizeof(CompactVertex) : sizeof(Vertex)) << " bytes"
+        << ", max error position " << encoding.PositionError << ", normal " << encoding.NormalErrorDegrees << " deg"
+        << ", uv " << encoding.TexCoordError << endl;
 }
 
+// Loads an OBJ model, optimizes it and reports the vertex cache statistics
+bool UOptimizeObjFile(const char* filename)
+{
+    MeshBuilder builder;
+    if (!builder.LoadObj(filename))
+    {
+        cout << "Failed to load model: " << filename << endl;
+        return false;
+    }
 
-void createCylinderMesh(GLMesh& mesh) {
-    GLfloat verts[] = {
-        // Vertex Positions  ||  Normal vectors   || Texture coordinates
-        // Base (Facing Y-)
-        
-        -1.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // A
-        -0.7f,  0.0f, -0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // B
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
+    cout << "INFO: " << filename << ": " << builder.Vertices.size() << " vertices, " << builder.Indices.size() / 3 << " triangles" << endl;
+    MeshOptimizationStats stats = optimizeMesh(builder.Vertices, builder.Indices);
+    UPrintOptimizationStats(filename, stats);
 
-        -0.7f,  0.0f, -0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // B
-         0.0f,  0.0f, -1.0f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // C
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
+    vector<CompactVertex> compact;
+    VertexCompressionResult encoding;
+    bool compressed = compressVertices(builder.Vertices, compact, encoding);
+    UPrintCompressionStats(filename, builder.Vertices.size(), encoding, compressed);
+    return true;
+}
 
-         0.0f,  0.0f, -1.0f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // C
-         0.7f,  0.0f, -0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // D
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
+// Collects the files of a directory whose names end in one of the extensions, sorted by name
+bool UListFiles(const string& directory, const vector<string>& extensions, vector<string>& files)
+{
+    vector<string> names;
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE)
+        return GetLastError() == ERROR_FILE_NOT_FOUND;
+    do
+    {
+        if (!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            names.push_back(entry.cFileName);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+        return false;
+    while (dirent* entry = readdir(dir))
+        names.push_back(entry->d_name);
+    closedir(dir);
+#endif
 
-         0.7f,  0.0f, -0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // D
-         1.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // E
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
+    sort(names.begin(), names.end());
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        for (size_t e = 0; e < extensions.size(); ++e)
+        {
+            const string& extension = extensions[e];
+            if (names[i].size() > extension.size() && names[i].compare(names[i].size() - extension.size(), extension.size(), extension) == 0)
+            {
+                files.push_back(directory + "/" + names[i]);
+                break;
+            }
+        }
+    }
+    return true;
+}
 
-         1.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // E
-         0.7f,  0.0f,  0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // F
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
+// Collects the .obj files of a directory, skipping LOD outputs of a previous --build-lods run
+bool UListObjFiles(const string& directory, vector<string>& files)
+{
+    vector<string> models;
+    if (!UListFiles(directory, { ".obj" }, models))
+        return false;
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        if (models[i].find(".lod", directory.size()) == string::npos)
+            files.push_back(models[i]);
+    }
+    return true;
+}
 
-         0.7f,  0.0f,  0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // F
-         0.0f,  0.0f,  1.0f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // G
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
+// Simplifies every OBJ model of a directory into an LOD chain and writes each coarser level next to the
+// source as <name>.lod<N>.obj. Models are processed in parallel; reports are printed in file order afterwards
+bool UBuildLodsForDirectory(const char* directory)
+{
+    // Fraction of the source triangles kept by each level
+    const vector<float> LOD_RATIOS = { 1.0f, 0.5f, 0.25f, 0.125f };
 
-         0.0f,  0.0f,  1.0f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // G
-        -0.7f,  0.0f,  0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // H
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
+    vector<string> files;
+    if (!UListObjFiles(directory, files))
+    {
+        cout << "Failed to open directory: " << directory << endl;
+        return false;
+    }
+    if (files.empty())
+    {
+        cout << "WARNING: no OBJ models in " << directory << endl;
+        return true;
+    }
 
-        -0.7f,  0.0f,  0.7f,    0.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // H
-        -1.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    0.0f, 1.0f,     // A
-         0.0f,  0.0f,  0.0f,    0.0f, 0.0f, 0.0f,    1.0f, 1.0f,     // O
-         
-
-         // Side #1
-        -1.0f,  0.0f,  0.0f,   -1.0f, 0.0f,  0.0f,    0.0f, 0.0f,     // A
-        -1.0f,  1.0f,  0.0f,   -1.0f, 0.0f,  0.0f,    0.0f, 0.0f,     // A2
-        -0.7f,  1.0f, -0.7f,   -1.0f, 0.0f,  0.0f,    0.0f, 0.0f,     // B2
-
-        -1.0f,  0.0f,  0.0f,   -1.0f, 0.0f,  0.0f,    0.0f, 0.0f,     // A
-        -0.7f,  0.0f, -0.7f,   -1.0f, 0.0f,  0.0f,    0.0f, 0.0f,     // B
-        -0.7f,  1.0f, -0.7f,   -1.0f, 0.0f,  0.0f,    0.0f, 0.0f,     // B2
-
-         // Side #2
-        -0.7f,  0.0f, -0.7f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // B
-        -0.7f,  1.0f, -0.7f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // B2
-         0.0f,  1.0f, -1.0f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // C2
-
-        -0.7f,  0.0f, -0.7f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // B
-         0.0f,  0.0f, -1.0f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // C
-         0.0f,  1.0f, -1.0f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // C2
-
-          // Side #3
-         0.0f,  0.0f, -1.0f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // C
-         0.0f,  1.0f, -1.0f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // C2
-         0.7f,  1.0f, -0.7f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // D2
-
-         0.0f,  0.0f, -1.0f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // C
-         0.7f,  0.0f, -0.7f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // D
-         0.7f,  1.0f, -0.7f,    0.0f, 0.0f, -1.0f,    0.0f, 0.0f,     // D2
-
-         // Side #4
-         0.7f,  0.0f, -0.7f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // D
-         0.7f,  1.0f, -0.7f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // D2
-         1.0f,  1.0f,  0.0f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // E2
-
-         0.7f,  0.0f, -0.7f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // D
-         1.0f,  0.0f,  0.0f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // E
-         1.0f,  1.0f,  0.0f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // E2
-
-          // Side #5
-         1.0f,  0.0f,  0.0f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // E
-         1.0f,  1.0f,  0.0f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // E2
-         0.7f,  1.0f,  0.7f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // F2
-
-         1.0f,  0.0f,  0.0f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // E
-         0.7f,  0.0f,  0.7f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // F
-         0.7f,  1.0f,  0.7f,    1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // F2
-
-          // Side #6
-         0.7f,  0.0f,  0.7f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // F
-         0.7f,  1.0f,  0.7f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // F2
-         0.0f,  1.0f,  1.0f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // G2
-
-         0.7f,  0.0f,  0.7f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // F
-         0.0f,  0.0f,  1.0f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // G
-         0.0f,  1.0f,  1.0f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // G2 
-
-         // Side #7
-         0.0f,  0.0f,  1.0f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // G
-         0.0f,  1.0f,  1.0f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // G2
-        -0.7f,  1.0f,  0.7f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // H2
-
-         0.0f,  0.0f,  1.0f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // G
-        -0.7f,  0.0f,  0.7f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // H
-        -0.7f,  1.0f,  0.7f,    0.0f, 0.0f, 1.0f,    0.0f, 0.0f,     // H2
-
-        // Side #8
-        -0.7f,  0.0f,  0.7f,    -1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // H
-        -0.7f,  1.0f,  0.7f,    -1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // H2 
-        -1.0f,  1.0f,  0.0f,    -1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // A2
-
-        -0.7f,  0.0f,  0.7f,    -1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // H
-        -1.0f,  0.0f,  0.0f,    -1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // A
-        -1.0f,  1.0f,  0.0f,    -1.0f, 0.0f, 0.0f,    0.0f, 0.0f,     // A2
-
-
-         // Top (Facing Y+)
-        -1.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // A2
-        -0.7f,  1.0f, -0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // B2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-
-        -0.7f,  1.0f, -0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // B2
-         0.0f,  1.0f, -1.0f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // C2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-             
-         0.0f,  1.0f, -1.0f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // C2
-         0.7f,  1.0f, -0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // D2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-
-         0.7f,  1.0f, -0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // D2
-         1.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // E2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-
-         1.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // E2
-         0.7f,  1.0f,  0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // F2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-
-         0.7f,  1.0f,  0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // F2
-         0.0f,  1.0f,  1.0f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // G2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-
-         0.0f,  1.0f,  1.0f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // G2
-        -0.7f,  1.0f,  0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // H2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-
-        -0.7f,  1.0f,  0.7f,    0.0f, 1.0f, 0.0f,    0.0f, 0.0f,     // H2
-        -1.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    0.0f, 1.0f,     // A2
-         0.0f,  1.0f,  0.0f,    0.0f, 1.0f, 0.0f,    1.0f, 1.0f,     // O2
-    };
+    vector<string> reports(files.size());
+    vector<char> succeeded(files.size(), 0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
+    ThreadPool pool;
+    pool.ParallelFor(files.size(), [&](size_t i) {
+        const string& filename = files[i];
+        ostringstream report;
 
+        MeshBuilder source;
+        if (!source.LoadObj(filename.c_str()))
+        {
+            report << "Failed to load model: " << filename << endl;
+            reports[i] = report.str();
+            return;
+        }
 
-    mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
+        report << "INFO: " << filename << ": " << source.Vertices.size() << " vertices, " << source.Indices.size() / 3 << " triangles" << endl;
+        vector<SimplifiedLevel> chain = simplifyLodChain(source.Vertices, source.Indices, LOD_RATIOS);
 
-    glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.vao);
+        bool saved = true;
+        string stem = filename.substr(0, filename.size() - 4);
+        for (size_t level = 0; level < chain.size(); ++level)
+        {
+            MeshBuilder lod;
+            compactMesh(source.Vertices, chain[level].Indices, lod);
+            optimizeMesh(lod.Vertices, lod.Indices);
+            report << "  LOD " << level << ": " << lod.Indices.size() / 3 << " triangles, " << lod.Vertices.size()
+                << " vertices, error " << chain[level].Error << endl;
+
+            if (level == 0)
+                continue;
+            string output = stem + ".lod" + to_string(level) + ".obj";
+            if (!lod.SaveObj(output.c_str()))
+            {
+                report << "ERROR::LOD::WRITE_FAILED " << output << endl;
+                saved = false;
+            }
+        }
+        reports[i] = report.str();
+        succeeded[i] = saved;
+    });
 
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    bool allSucceeded = true;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        cout << reports[i];
+        allSucceeded = allSucceeded && succeeded[i];
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "INFO: built LODs for " << files.size() << " models in " << seconds << " s on " << pool.Size() << " threads" << endl;
+    return allSucceeded;
+}
 
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
+// Compresses every JPG and PNG of a directory into <name>.ktx2 next to the source, with a full mip chain: BC1 for
+// opaque RGB images, BC7 for images with alpha. <name>.layer.ktx2 gets the BC7 layer of the indirect pass's texture
+// array. Textures go one after another, each spreading its blocks over every core
+bool UCookTexturesForDirectory(const char* directory)
+{
+    vector<string> files;
+    if (!UListFiles(directory, { ".jpg", ".jpeg", ".png" }, files))
+    {
+        cout << "Failed to open directory: " << directory << endl;
+        return false;
+    }
+    if (files.empty())
+    {
+        cout << "WARNING: no JPG or PNG textures in " << directory << endl;
+        return true;
+    }
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    ThreadPool pool;
+    bool allSucceeded = true;
+    size_t uncompressedTotal = 0, compressedTotal = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        chrono::steady_clock::time_point textureStart = chrono::steady_clock::now();
+        string output = cookedTexturePath(files[i]);
+        CookedTexture cooked;
+        if (!cookTexture(files[i], output, cookedLayerPath(files[i]), IndirectRenderer::TEXTURE_ARRAY_SIZE, &pool, cooked))
+        {
+            cout << "ERROR::TEXTURE::COOK_FAILED " << files[i] << endl;
+            allSucceeded = false;
+            continue;
+        }
 
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+        double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - textureStart).count();
+        cout << "INFO: " << files[i] << ": " << cooked.Width << "x" << cooked.Height << (cooked.Channels == 4 ? " RGBA" : " RGB")
+            << " -> " << (cooked.Format == BLOCK_FORMAT_BC1 ? "BC1" : "BC7") << ", " << cooked.Levels << " levels, "
+            << cooked.UncompressedBytes / 1024 << " KB -> " << cooked.CompressedBytes / 1024 << " KB ("
+            << (double)cooked.UncompressedBytes / cooked.CompressedBytes << "x), layer " << cooked.LayerBytes / 1024 << " KB in "
+            << milliseconds << " ms" << endl;
+        uncompressedTotal += cooked.UncompressedBytes;
+        compressedTotal += cooked.CompressedBytes;
+    }
 
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "INFO: cooked " << files.size() << " textures, " << uncompressedTotal / 1024 << " KB -> " << compressedTotal / 1024
+        << " KB in " << seconds << " s on " << pool.Size() << " threads" << endl;
+    return allSucceeded;
 }
 
-
-// Generate and load texture
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Times each supported culling kernel and the scene hierarchy on random scenes of growing size and reports nanoseconds
+// per object. Objects fill a world around the camera much larger than its view, as in a streamed level; every kernel
+// must agree with scalar. The hierarchy tests boxes only, so it may keep a few objects whose sphere the kernels reject
+void UBenchmarkCulling()
 {
-    int width, height, channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-    if (image)
-    {
-        flipImageVertically(image, width, height, channels);
+    const size_t SCENE_SIZES[] = { 1000, 10000, 100000, 1000000 };
 
-        glGenTextures(1, &textureId);
-        glBindTexture(GL_TEXTURE_2D, textureId);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    Frustum frustum;
+    frustum.Extract(projection * view);
 
-        // set the texture wrapping parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        // set texture filtering parameters
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    uint32_t seed = 12345;
+    auto random = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(seed >> 8) / 16777216.0f;
+    };
 
-        if (channels == 3)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        else if (channels == 4)
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-        else
-        {
-            cout << "Not implemented to handle image with " << channels << " channels" << endl;
-            return false;
+    for (size_t sizeIndex = 0; sizeIndex < sizeof(SCENE_SIZES) / sizeof(SCENE_SIZES[0]); ++sizeIndex) {
+        size_t objectCount = SCENE_SIZES[sizeIndex];
+        BatchCuller culler;
+        vector<BoundingBox> boxes(objectCount);
+        for (size_t i = 0; i < objectCount; ++i) {
+            glm::vec3 center(random() * 400.0f - 200.0f, random() * 60.0f - 30.0f, random() * 400.0f - 200.0f);
+            glm::vec3 half(0.1f + random() * 0.9f, 0.1f + random() * 0.9f, 0.1f + random() * 0.9f);
+            BoundingBox box;
+            box.Min = center - half;
+            box.Max = center + half;
+            culler.Add(center, glm::length(half), box);
+            boxes[i] = box;
         }
 
-        glGenerateMipmap(GL_TEXTURE_2D);
+        vector<uint32_t> reference(objectCount), visible(objectCount);
+        size_t referenceCount = culler.CullWith(CULL_PATH_SCALAR, frustum, reference.data());
+
+        for (int path = CULL_PATH_SCALAR; path < CULL_PATH_COUNT; ++path) {
+            if (!cullPathSupported((CullPath)path))
+                continue;
+
+            // Best of several runs of at least 20 ms each, so timer resolution and warm-up do not dominate
+            double best = 1e30;
+            size_t visibleCount = 0;
+            for (int run = 0; run < 5; ++run) {
+                size_t repeats = 0;
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                double elapsed = 0.0;
+                do {
+                    visibleCount = culler.CullWith((CullPath)path, frustum, visible.data());
+                    ++repeats;
+                    elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+                } while (elapsed < 20e6);
+                best = min(best, elapsed / (double)(repeats * objectCount));
+            }
+
+            bool matches = visibleCount == referenceCount && equal(visible.begin(), visible.begin() + visibleCount, reference.begin());
+            cout << "INFO: " << objectCount << " objects, " << cullPathName((CullPath)path) << ": " << best << " ns/object, "
+                << visibleCount << " visible" << (matches ? "" : " (MISMATCH with scalar)") << endl;
+        }
 
+        chrono::steady_clock::time_point buildStart = chrono::steady_clock::now();
+        SceneBvh bvh;
+        bvh.Build(boxes);
+        double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - buildStart).count();
+
+        double best = 1e30;
+        size_t visibleCount = 0;
+        for (int run = 0; run < 5; ++run) {
+            size_t repeats = 0;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            double elapsed = 0.0;
+            do {
+                visibleCount = 0;
+                bvh.QueryFrustum(frustum, [&](uint32_t item) { visible[visibleCount++] = item; });
+                ++repeats;
+                elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+            } while (elapsed < 20e6);
+            best = min(best, elapsed / (double)(repeats * objectCount));
+        }
+        cout << "INFO: " << objectCount << " objects, bvh: " << best << " ns/object, " << visibleCount << " visible, built in "
+            << buildMs << " ms" << endl;
+    }
+}
+
+// Times the mip chain of every texture of a directory with each filter and supported kernel, on one thread and across
+// every core, and reports the best of several runs in milliseconds. Every kernel must match the scalar chain exactly
+bool UBenchmarkMips(const char* directory)
+{
+    vector<string> files;
+    if (!UListFiles(directory, { ".jpg", ".jpeg", ".png" }, files))
+    {
+        cout << "Failed to open directory: " << directory << endl;
+        return false;
+    }
+
+    ThreadPool pool;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        int width, height, channels;
+        unsigned char* image = stbi_load(files[i].c_str(), &width, &height, &channels, 0);
+        if (!image || (channels != 3 && channels != 4))
+        {
+            cout << "ERROR::TEXTURE::DECODE_FAILED " << files[i] << endl;
+            stbi_image_free(image);
+            continue;
+        }
+        vector<uint8_t> source(image, image + (size_t)width * height * channels);
         stbi_image_free(image);
-        glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
-        return true;
+        for (int filter = MIP_FILTER_BOX; filter < MIP_FILTER_COUNT; ++filter) {
+            vector<MipLevel> reference;
+            vector<uint8_t> level0 = source;
+            buildMipChain(level0, width, height, channels, reference, (MipFilter)filter, nullptr, MIP_PATH_SCALAR);
+
+            for (int path = MIP_PATH_SCALAR; path < MIP_PATH_COUNT; ++path) {
+                if (!mipPathSupported((MipPath)path))
+                    continue;
+
+                // Index 0 runs on the calling thread, index 1 across the pool
+                double best[2] = { 1e30, 1e30 };
+                bool matches = true;
+                for (int threaded = 0; threaded < 2; ++threaded) {
+                    for (int run = 0; run < 5; ++run) {
+                        vector<MipLevel> levels;
+                        level0 = source;
+                        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                        buildMipChain(level0, width, height, channels, levels, (MipFilter)filter, threaded ? &pool : nullptr, (MipPath)path);
+                        best[threaded] = min(best[threaded], chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+
+                        for (size_t level = 0; level < levels.size(); ++level)
+                            matches = matches && levels[level].Pixels == reference[level].Pixels;
+                    }
+                }
+                cout << "INFO: " << files[i] << ": " << width << "x" << height << (channels == 4 ? " RGBA" : " RGB") << ", "
+                    << reference.size() << " levels, " << mipFilterName((MipFilter)filter) << ", " << mipPathName((MipPath)path) << ": "
+                    << best[0] << " ms on 1 thread, " << best[1] << " ms on " << pool.Size() << " threads" << (matches ? "" : " (MISMATCH with scalar)") << endl;
+            }
+        }
     }
+    return true;
+}
 
-    // Error loading the image
-    return false;
+// Best time in milliseconds of several runs of at least 20 ms each; setup runs before every call and is not timed
+template <typename Setup, typename Operation>
+double UTimeBest(Setup setup, Operation operation)
+{
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run) {
+        size_t repeats = 0;
+        double elapsed = 0.0;
+        do {
+            setup();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            operation();
+            elapsed += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            ++repeats;
+        } while (elapsed < 20.0);
+        best = min(best, elapsed / repeats);
+    }
+    return best;
 }
 
-// Destroy mesh
-void UDestroyMesh(GLMesh& mesh)
+// Times the byte loop flipImageVertically against each supported image_ops.h kernel on one image, on one thread and
+// across every core, along with RGB to RGBA expansion, an RGBA to BGRA swizzle and alpha premultiplication. Every
+// kernel must match the scalar one exactly
+bool UBenchmarkImageOps(const char* filename)
+{
+    int width, height, channels;
+    unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
+    if (!image || (channels != 3 && channels != 4))
+    {
+        cout << "ERROR::TEXTURE::DECODE_FAILED " << filename << endl;
+        stbi_image_free(image);
+        return false;
+    }
+    vector<uint8_t> source(image, image + (size_t)width * height * channels);
+    stbi_image_free(image);
+    size_t rowBytes = (size_t)width * channels;
+    cout << "INFO: " << filename << ": " << width << "x" << height << (channels == 4 ? " RGBA" : " RGB") << endl;
+
+    vector<uint8_t> work, rgba((size_t)width * height * 4), reference;
+    double baseline = UTimeBest([&]() { work = source; }, [&]() { flipImageVertically(work.data(), width, height, channels); });
+    cout << "INFO: flipImageVertically: " << baseline << " ms" << endl;
+    reference = work;
+
+    // RGBA input for the kernels that need one, with varied alpha so premultiplication does some work
+    vector<uint8_t> texels((size_t)width * height * 4);
+    prepareForUpload(source.data(), width, height, channels, texels.data());
+    for (size_t i = 3; i < texels.size(); i += 4)
+        texels[i] = (uint8_t)(i * 7);
+    const uint8_t BGRA[4] = { 2, 1, 0, 3 };
+
+    vector<uint8_t> expanded, swizzled, premultiplied;
+    if (channels == 3) {
+        expandRgbToRgba(source.data(), width, height, rgba.data(), true, nullptr, IMAGE_OPS_PATH_SCALAR);
+        expanded = rgba;
+    }
+    swizzled = texels;
+    swizzleChannels(swizzled.data(), width, height, BGRA, nullptr, IMAGE_OPS_PATH_SCALAR);
+    premultiplied = texels;
+    premultiplyAlpha(premultiplied.data(), width, height, nullptr, IMAGE_OPS_PATH_SCALAR);
+
+    ThreadPool pool;
+    for (int path = IMAGE_OPS_PATH_SCALAR; path < IMAGE_OPS_PATH_COUNT; ++path) {
+        if (!imageOpsPathSupported((ImageOpsPath)path))
+            continue;
+        ImageOpsPath kernel = (ImageOpsPath)path;
+
+        // Index 0 runs on the calling thread, index 1 across the pool
+        for (int threaded = 0; threaded < 2; ++threaded) {
+            ThreadPool* workers = threaded ? &pool : nullptr;
+            string where = threaded ? " on " + to_string(pool.Size()) + " threads" : " on 1 thread";
+
+            double flip = UTimeBest([&]() { work = source; }, [&]() { flipRows(work.data(), rowBytes, height, workers, kernel); });
+            cout << "INFO: flipRows, " << imageOpsPathName(kernel) << where << ": " << flip << " ms (" << baseline / flip << "x)"
+                << (work == reference ? "" : " (MISMATCH with flipImageVertically)") << endl;
+
+            if (channels == 3) {
+                double expand = UTimeBest([]() {}, [&]() { expandRgbToRgba(source.data(), width, height, rgba.data(), true, workers, kernel); });
+                cout << "INFO: expandRgbToRgba with flip, " << imageOpsPathName(kernel) << where << ": " << expand << " ms"
+                    << (rgba == expanded ? "" : " (MISMATCH with scalar)") << endl;
+            }
+
+            double swizzle = UTimeBest([&]() { work = texels; }, [&]() { swizzleChannels(work.data(), width, height, BGRA, workers, kernel); });
+            cout << "INFO: swizzleChannels to BGRA, " << imageOpsPathName(kernel) << where << ": " << swizzle << " ms"
+                << (work == swizzled ? "" : " (MISMATCH with scalar)") << endl;
+
+            double premultiply = UTimeBest([&]() { work = texels; }, [&]() { premultiplyAlpha(work.data(), width, height, workers, kernel); });
+            cout << "INFO: premultiplyAlpha, " << imageOpsPathName(kernel) << where << ": " << premultiply << " ms"
+                << (work == premultiplied ? "" : " (MISMATCH with scalar)") << endl;
+        }
+    }
+    return true;
+}
+
+// Create the uniform buffer holding the per-frame camera block and attach it to its binding point
+void UCreateCameraBlock(GLuint& ubo)
+{
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW); // Filled every frame by updateCamera()
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Both shader programs declare the block with this binding, so one bind serves all of them
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, ubo);
+}
+
+// Destroy camera uniform buffer
+void UDestroyCameraBlock(GLuint ubo)
 {
-    glDeleteVertexArrays(1, &mesh.vao);
-    glDeleteBuffers(1, &mesh.vbo);
+    glDeleteBuffers(1, &ubo);
 }
 
 // Destroy Texture
 void UDestroyTexture(GLuint textureId)
 {
-    glGenTextures(1, &textureId);
+    glDeleteTextures(1, &textureId);
+}
+
+
+// Uploads the textures decoded since the last frame and marks their layers of the indirect pass's texture array stale
+void UUpdateTextures()
+{
+    if (gSyncTextures)
+        return;
+
+    const vector<GLuint>& loaded = gTextureLoader.Update(TEXTURE_STAGING_BYTES / 2);
+    if (loaded.empty())
+        return;
+    gIndirectRenderer.RefreshTextures(loaded);
+
+    if (!gTextureLoader.Busy())
+        cout << "INFO: Streamed " << gTextureLoader.Stats.Uploaded << " textures in " << ((float)glfwGetTime() - gTextureLoadStart) * 1000.0f
+            << " ms (" << gTextureLoader.Stats.Cached << " from the cache, " << gTextureLoader.Stats.Direct << " from client memory, "
+            << gTextureLoader.Stats.Failed << " failed, " << gTextureLoader.Stats.MipMilliseconds + gTextureCache.Stats.MipMicroseconds / 1000.0
+            << " ms of worker time building mip chains)" << endl;
 }
 
 // Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, ShaderProgram& program)
 {
     // Compilation and linkage error reporting
     int success = 0;
     char infoLog[512];
 
     // Create a Shader program object.
-    programId = glCreateProgram();
+    GLuint programId = glCreateProgram();
 
     // Create the vertex and fragment shader objects
     GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
@@ -1361,11 +2449,54 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
 
     glUseProgram(programId);    // Uses the shader program
 
+    // Reflect active uniforms and blocks once so draws use pre-resolved handles
+    program.Reflect(programId);
+
+    return true;
+}
+
+// Compiles and links a program made of a single compute shader
+bool UCreateComputeProgram(const char* computeShaderSource, ShaderProgram& program)
+{
+    // Compilation and linkage error reporting
+    int success = 0;
+    char infoLog[512];
+
+    GLuint programId = glCreateProgram();
+    GLuint computeShaderId = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(computeShaderId, 1, &computeShaderSource, NULL);
+
+    glCompileShader(computeShaderId);
+    glGetShaderiv(computeShaderId, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(computeShaderId, sizeof(infoLog), NULL, infoLog);
+        std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+
+        return false;
+    }
+
+    glAttachShader(programId, computeShaderId);
+    glLinkProgram(programId);
+    glGetProgramiv(programId, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+
+        return false;
+    }
+
+    // The program keeps the compiled code; the shader object is only needed until linking
+    glDeleteShader(computeShaderId);
+
+    program.Reflect(programId);
+
     return true;
 }
 
 // End shader program
-void UDestroyShaderProgram(GLuint programId)
+void UDestroyShaderProgram(ShaderProgram& program)
 {
-    glDeleteProgram(programId);
+    program.Destroy();
 }
\ No newline at end of file
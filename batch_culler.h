@@ -0,0 +1,247 @@
+#ifndef BATCH_CULLER_H
+#define BATCH_CULLER_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frustum.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BATCH_CULLER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BATCH_CULLER_AVX2_TARGET
+#else
+#define BATCH_CULLER_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+// Instruction set a culling kernel runs on
+enum CullPath
+{
+    CULL_PATH_SCALAR = 0,
+    CULL_PATH_SSE2,     // 4 objects per iteration
+    CULL_PATH_AVX2,     // 8 objects per iteration
+    CULL_PATH_COUNT
+};
+
+inline const char* cullPathName(CullPath path)
+{
+    static const char* const names[CULL_PATH_COUNT] = { "scalar", "sse2", "avx2" };
+    return names[path];
+}
+
+// whether the CPU and operating system can run a kernel
+inline bool cullPathSupported(CullPath path)
+{
+#if BATCH_CULLER_X86
+    if (path == CULL_PATH_SSE2)
+        return true; // Assumed by every x86 target GLEW and GLFW still build for
+    if (path == CULL_PATH_AVX2)
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesAvx && (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+    return path == CULL_PATH_SCALAR;
+}
+
+// fastest kernel the machine supports
+inline CullPath detectCullPath()
+{
+    for (int path = CULL_PATH_COUNT - 1; path > CULL_PATH_SCALAR; --path)
+    {
+        if (cullPathSupported((CullPath)path))
+            return (CullPath)path;
+    }
+    return CULL_PATH_SCALAR;
+}
+
+
+// World-space bounds of many objects in structure-of-arrays layout, tested against a frustum several objects at a time.
+// An object is visible when both its bounding sphere and its bounding box intersect the frustum. Boxes are stored as
+// center and half extent, so a plane test is n.c + |n|.e + d >= 0 without picking a corner per plane.
+// Arrays are padded to a multiple of 8 with entries that always fail, so the SIMD kernels need no remainder loop
+class BatchCuller
+{
+public:
+    CullPath Path = detectCullPath();
+
+    size_t Size() const { return count; }
+
+    // forgets all objects
+    void Clear()
+    {
+        for (int i = 0; i < ARRAY_COUNT; ++i)
+            arrays[i].clear();
+        count = 0;
+    }
+
+    // appends an object's world-space bounds; its index is the number of objects added before it
+    void Add(const glm::vec3& center, float radius, const BoundingBox& box)
+    {
+        if (count == arrays[0].size())
+        {
+            for (int i = 0; i < ARRAY_COUNT; ++i)
+                arrays[i].resize(count + BATCH, i == RADIUS || i >= EXTENT_X ? -1e30f : 0.0f);
+        }
+
+        glm::vec3 boxCenter = 0.5f * (box.Min + box.Max);
+        glm::vec3 boxExtent = 0.5f * (box.Max - box.Min);
+        const float values[ARRAY_COUNT] = { center.x, center.y, center.z, radius,
+            boxCenter.x, boxCenter.y, boxCenter.z, boxExtent.x, boxExtent.y, boxExtent.z };
+        for (int i = 0; i < ARRAY_COUNT; ++i)
+            arrays[i][count] = values[i];
+        ++count;
+    }
+
+    // writes the indices of visible objects in increasing order and returns how many there are.
+    // visible must have room for Size() indices
+    size_t Cull(const Frustum& frustum, uint32_t* visible) const
+    {
+        return CullWith(Path, frustum, visible);
+    }
+
+    // as Cull, on a given kernel; falls back to scalar when the kernel is not available
+    size_t CullWith(CullPath path, const Frustum& frustum, uint32_t* visible) const
+    {
+        if (count == 0)
+            return 0;
+#if BATCH_CULLER_X86
+        if (path == CULL_PATH_AVX2 && cullPathSupported(CULL_PATH_AVX2))
+            return cullAvx2(frustum, visible);
+        if (path == CULL_PATH_SSE2)
+            return cullSse2(frustum, visible);
+#endif
+        return cullScalar(frustum, visible);
+    }
+
+private:
+    enum { SPHERE_X = 0, SPHERE_Y, SPHERE_Z, RADIUS, BOX_X, BOX_Y, BOX_Z, EXTENT_X, EXTENT_Y, EXTENT_Z, ARRAY_COUNT };
+    static const size_t BATCH = 8;
+
+    std::vector<float> arrays[ARRAY_COUNT];
+    size_t count = 0;
+
+    size_t cullScalar(const Frustum& frustum, uint32_t* visible) const
+    {
+        size_t visibleCount = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            bool inside = true;
+            for (int p = 0; p < Frustum::PLANE_COUNT && inside; ++p)
+            {
+                const Plane& plane = frustum.Planes[p];
+                const glm::vec3& n = plane.Normal;
+                float sphere = n.x * arrays[SPHERE_X][i] + n.y * arrays[SPHERE_Y][i] + n.z * arrays[SPHERE_Z][i] + plane.Distance;
+                float box = n.x * arrays[BOX_X][i] + n.y * arrays[BOX_Y][i] + n.z * arrays[BOX_Z][i]
+                    + std::fabs(n.x) * arrays[EXTENT_X][i] + std::fabs(n.y) * arrays[EXTENT_Y][i] + std::fabs(n.z) * arrays[EXTENT_Z][i]
+                    + plane.Distance;
+                inside = sphere >= -arrays[RADIUS][i] && box >= 0.0f;
+            }
+            if (inside)
+                visible[visibleCount++] = (uint32_t)i;
+        }
+        return visibleCount;
+    }
+
+#if BATCH_CULLER_X86
+    // index of the lowest set bit of a non-zero mask
+    static unsigned lowestBit(unsigned mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (unsigned)index;
+#else
+        return (unsigned)__builtin_ctz(mask);
+#endif
+    }
+
+    size_t cullSse2(const Frustum& frustum, uint32_t* visible) const
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        size_t visibleCount = 0;
+        size_t padded = arrays[0].size();
+
+        for (size_t i = 0; i < padded; i += 4)
+        {
+            __m128 sx = _mm_loadu_ps(&arrays[SPHERE_X][i]), sy = _mm_loadu_ps(&arrays[SPHERE_Y][i]), sz = _mm_loadu_ps(&arrays[SPHERE_Z][i]);
+            __m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(&arrays[RADIUS][i]));
+            __m128 bx = _mm_loadu_ps(&arrays[BOX_X][i]), by = _mm_loadu_ps(&arrays[BOX_Y][i]), bz = _mm_loadu_ps(&arrays[BOX_Z][i]);
+            __m128 ex = _mm_loadu_ps(&arrays[EXTENT_X][i]), ey = _mm_loadu_ps(&arrays[EXTENT_Y][i]), ez = _mm_loadu_ps(&arrays[EXTENT_Z][i]);
+            __m128 inside = _mm_cmpeq_ps(zero, zero);
+
+            for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+            {
+                const Plane& plane = frustum.Planes[p];
+                __m128 nx = _mm_set1_ps(plane.Normal.x), ny = _mm_set1_ps(plane.Normal.y), nz = _mm_set1_ps(plane.Normal.z);
+                __m128 d = _mm_set1_ps(plane.Distance);
+
+                __m128 sphere = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, sx), _mm_mul_ps(ny, sy)), _mm_mul_ps(nz, sz)), d);
+                __m128 box = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, bx), _mm_mul_ps(ny, by)), _mm_mul_ps(nz, bz));
+                box = _mm_add_ps(box, _mm_mul_ps(_mm_andnot_ps(signMask, nx), ex));
+                box = _mm_add_ps(box, _mm_mul_ps(_mm_andnot_ps(signMask, ny), ey));
+                box = _mm_add_ps(_mm_add_ps(box, _mm_mul_ps(_mm_andnot_ps(signMask, nz), ez)), d);
+                inside = _mm_and_ps(inside, _mm_and_ps(_mm_cmpge_ps(sphere, negRadius), _mm_cmpge_ps(box, zero)));
+            }
+
+            for (unsigned mask = (unsigned)_mm_movemask_ps(inside); mask != 0; mask &= mask - 1)
+                visible[visibleCount++] = (uint32_t)(i + lowestBit(mask));
+        }
+        return visibleCount;
+    }
+
+    BATCH_CULLER_AVX2_TARGET size_t cullAvx2(const Frustum& frustum, uint32_t* visible) const
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        size_t visibleCount = 0;
+        size_t padded = arrays[0].size();
+
+        for (size_t i = 0; i < padded; i += 8)
+        {
+            __m256 sx = _mm256_loadu_ps(&arrays[SPHERE_X][i]), sy = _mm256_loadu_ps(&arrays[SPHERE_Y][i]), sz = _mm256_loadu_ps(&arrays[SPHERE_Z][i]);
+            __m256 negRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(&arrays[RADIUS][i]));
+            __m256 bx = _mm256_loadu_ps(&arrays[BOX_X][i]), by = _mm256_loadu_ps(&arrays[BOX_Y][i]), bz = _mm256_loadu_ps(&arrays[BOX_Z][i]);
+            __m256 ex = _mm256_loadu_ps(&arrays[EXTENT_X][i]), ey = _mm256_loadu_ps(&arrays[EXTENT_Y][i]), ez = _mm256_loadu_ps(&arrays[EXTENT_Z][i]);
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+            for (int p = 0; p < Frustum::PLANE_COUNT; ++p)
+            {
+                const Plane& plane = frustum.Planes[p];
+                __m256 nx = _mm256_set1_ps(plane.Normal.x), ny = _mm256_set1_ps(plane.Normal.y), nz = _mm256_set1_ps(plane.Normal.z);
+                __m256 d = _mm256_set1_ps(plane.Distance);
+
+                __m256 sphere = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, sx), _mm256_mul_ps(ny, sy)), _mm256_mul_ps(nz, sz)), d);
+                __m256 box = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, bx), _mm256_mul_ps(ny, by)), _mm256_mul_ps(nz, bz));
+                box = _mm256_add_ps(box, _mm256_mul_ps(_mm256_andnot_ps(signMask, nx), ex));
+                box = _mm256_add_ps(box, _mm256_mul_ps(_mm256_andnot_ps(signMask, ny), ey));
+                box = _mm256_add_ps(_mm256_add_ps(box, _mm256_mul_ps(_mm256_andnot_ps(signMask, nz), ez)), d);
+                inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(sphere, negRadius, _CMP_GE_OQ), _mm256_cmp_ps(box, zero, _CMP_GE_OQ)));
+            }
+
+            for (unsigned mask = (unsigned)_mm256_movemask_ps(inside); mask != 0; mask &= mask - 1)
+                visible[visibleCount++] = (uint32_t)(i + lowestBit(mask));
+        }
+        return visibleCount;
+    }
+#endif
+};
+#endif
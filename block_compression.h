@@ -0,0 +1,444 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Block formats the texture cooker encodes. Both code 4x4 texel blocks
+enum BlockFormat
+{
+    BLOCK_FORMAT_BC1 = 0,   // 8 bytes per block, RGB with two 5:6:5 endpoints and 2-bit indices
+    BLOCK_FORMAT_BC7 = 1    // 16 bytes per block, RGBA; only mode 6 (one subset, 7:7:7:7 endpoints with p-bits, 4-bit indices)
+};
+
+inline size_t blockBytes(BlockFormat format)
+{
+    return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+}
+
+// size of an image of width x height texels once compressed; partial blocks at the edges are padded
+inline size_t compressedSize(BlockFormat format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * blockBytes(format);
+}
+
+
+// principal axis of count points of dimension components each, by power iteration on their covariance.
+// Falls back to the diagonal when the points are all equal
+inline void principalAxis(const float* points, int count, int components, const float* mean, float* axis)
+{
+    float covariance[4][4] = {};
+    for (int i = 0; i < count; ++i)
+    {
+        const float* p = points + i * components;
+        for (int a = 0; a < components; ++a)
+            for (int b = a; b < components; ++b)
+                covariance[a][b] += (p[a] - mean[a]) * (p[b] - mean[b]);
+    }
+    for (int a = 0; a < components; ++a)
+        for (int b = 0; b < a; ++b)
+            covariance[a][b] = covariance[b][a];
+
+    for (int a = 0; a < components; ++a)
+        axis[a] = 1.0f;
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[4] = {};
+        float largest = 0.0f;
+        for (int a = 0; a < components; ++a)
+        {
+            for (int b = 0; b < components; ++b)
+                next[a] += covariance[a][b] * axis[b];
+            largest = std::fabs(next[a]) > largest ? std::fabs(next[a]) : largest;
+        }
+        if (largest == 0.0f)
+            return;
+        for (int a = 0; a < components; ++a)
+            axis[a] = next[a] / largest;
+    }
+}
+
+// endpoints of a block along its principal axis: the texels with the lowest and highest projection
+inline void axisEndpoints(const float* points, int components, float* low, float* high)
+{
+    float mean[4] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < components; ++c)
+            mean[c] += points[i * components + c] / 16.0f;
+
+    float axis[4];
+    principalAxis(points, 16, components, mean, axis);
+
+    int lowest = 0, highest = 0;
+    float minimum = 1e30f, maximum = -1e30f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float projection = 0.0f;
+        for (int c = 0; c < components; ++c)
+            projection += points[i * components + c] * axis[c];
+        if (projection < minimum) { minimum = projection; lowest = i; }
+        if (projection > maximum) { maximum = projection; highest = i; }
+    }
+    for (int c = 0; c < components; ++c)
+    {
+        low[c] = points[lowest * components + c];
+        high[c] = points[highest * components + c];
+    }
+}
+
+// least squares endpoints for fixed interpolation weights: minimizes the sum of |(1 - w) a + w b - x|^2.
+// Returns false if every texel has the same weight, leaving the endpoints unchanged
+inline bool fitEndpoints(const float* points, int components, const float* weights, float* a, float* b)
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        float w = weights[i], v = 1.0f - w;
+        aa += v * v;
+        ab += v * w;
+        bb += w * w;
+        for (int c = 0; c < components; ++c)
+        {
+            ax[c] += v * points[i * components + c];
+            bx[c] += w * points[i * components + c];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false;
+    for (int c = 0; c < components; ++c)
+    {
+        float va = (ax[c] * bb - bx[c] * ab) / determinant;
+        float vb = (bx[c] * aa - ax[c] * ab) / determinant;
+        a[c] = va < 0.0f ? 0.0f : (va > 255.0f ? 255.0f : va);
+        b[c] = vb < 0.0f ? 0.0f : (vb > 255.0f ? 255.0f : vb);
+    }
+    return true;
+}
+
+
+// 5:6:5 endpoint packing of BC1
+inline uint16_t packRgb565(const float* color)
+{
+    int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void unpackRgb565(uint16_t packed, int* color)
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// picks the nearest of the four colors for every texel of a BC1 block in four-color mode; returns the squared error
+inline float bc1Indices(const float* points, uint16_t color0, uint16_t color1, uint32_t& indices)
+{
+    int c0[3], c1[3];
+    unpackRgb565(color0, c0);
+    unpackRgb565(color1, c1);
+    float palette[4][3];
+    for (int c = 0; c < 3; ++c)
+    {
+        palette[0][c] = (float)c0[c];
+        palette[1][c] = (float)c1[c];
+        palette[2][c] = (float)((2 * c0[c] + c1[c]) / 3);
+        palette[3][c] = (float)((c0[c] + 2 * c1[c]) / 3);
+    }
+
+    float error = 0.0f;
+    indices = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        int best = 0;
+        float bestDistance = 1e30f;
+        for (int entry = 0; entry < 4; ++entry)
+        {
+            float distance = 0.0f;
+            for (int c = 0; c < 3; ++c)
+            {
+                float d = points[i * 3 + c] - palette[entry][c];
+                distance += d * d;
+            }
+            if (distance < bestDistance) { bestDistance = distance; best = entry; }
+        }
+        indices |= (uint32_t)best << (2 * i);
+        error += bestDistance;
+    }
+    return error;
+}
+
+// encodes a 4x4 block of RGBA texels (row major, alpha ignored) as BC1 in four-color mode.
+// Endpoints start at the extremes of the principal axis and get one least squares refinement
+inline void encodeBC1Block(const uint8_t* rgba, uint8_t* block)
+{
+    float points[16 * 3];
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c)
+            points[i * 3 + c] = rgba[i * 4 + c];
+
+    float low[3], high[3];
+    axisEndpoints(points, 3, low, high);
+
+    uint16_t bestColor0 = 0, bestColor1 = 0;
+    uint32_t bestIndices = 0;
+    float bestError = 1e30f;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        uint16_t color0 = packRgb565(high), color1 = packRgb565(low);
+        if (color0 < color1)
+        {
+            uint16_t swap = color0;
+            color0 = color1;
+            color1 = swap;
+            for (int c = 0; c < 3; ++c)
+            {
+                float swapChannel = high[c];
+                high[c] = low[c];
+                low[c] = swapChannel;
+            }
+        }
+
+        // Equal endpoints would select the three-color mode; every texel takes the single color instead
+        uint32_t indices = 0;
+        float error;
+        if (color0 == color1)
+        {
+            int single[3];
+            unpackRgb565(color0, single);
+            error = 0.0f;
+            for (int i = 0; i < 48; ++i)
+                error += (points[i] - single[i % 3]) * (points[i] - single[i % 3]);
+        }
+        else
+            error = bc1Indices(points, color0, color1, indices);
+
+        if (error < bestError)
+        {
+            bestError = error;
+            bestColor0 = color0;
+            bestColor1 = color1;
+            bestIndices = indices;
+        }
+        if (pass == 1 || color0 == color1)
+            break;
+
+        // Weights of color1 for each index: 0, 1, 1/3, 2/3. high holds color0 from here on
+        const float INDEX_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        float weights[16];
+        for (int i = 0; i < 16; ++i)
+            weights[i] = INDEX_WEIGHTS[(indices >> (2 * i)) & 3];
+        if (!fitEndpoints(points, 3, weights, high, low))
+            break;
+    }
+
+    block[0] = (uint8_t)(bestColor0 & 0xFF);
+    block[1] = (uint8_t)(bestColor0 >> 8);
+    block[2] = (uint8_t)(bestColor1 & 0xFF);
+    block[3] = (uint8_t)(bestColor1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        block[4 + i] = (uint8_t)(bestIndices >> (8 * i));
+}
+
+
+// Interpolation weights of BC7's 4-bit indices, in 64ths
+const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Mode 6 endpoints: 7 bits per channel plus a p-bit shared by the channels of each endpoint
+struct Bc7Mode6Endpoints
+{
+    int Color[2][4];    // 7-bit values
+    int PBit[2];
+};
+
+// picks the nearest palette entry for every texel; returns the squared error
+inline float bc7Indices(const float* points, const Bc7Mode6Endpoints& endpoints, uint8_t* indices)
+{
+    int e[2][4];
+    for (int side = 0; side < 2; ++side)
+        for (int c = 0; c < 4; ++c)
+            e[side][c] = (endpoints.Color[side][c] << 1) | endpoints.PBit[side];
+
+    float palette[16][4];
+    for (int entry = 0; entry < 16; ++entry)
+        for (int c = 0; c < 4; ++c)
+            palette[entry][c] = (float)(((64 - BC7_WEIGHTS4[entry]) * e[0][c] + BC7_WEIGHTS4[entry] * e[1][c] + 32) >> 6);
+
+    float error = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        int best = 0;
+        float bestDistance = 1e30f;
+        for (int entry = 0; entry < 16; ++entry)
+        {
+            float distance = 0.0f;
+            for (int c = 0; c < 4; ++c)
+            {
+                float d = points[i * 4 + c] - palette[entry][c];
+                distance += d * d;
+            }
+            if (distance < bestDistance) { bestDistance = distance; best = entry; }
+        }
+        indices[i] = (uint8_t)best;
+        error += bestDistance;
+    }
+    return error;
+}
+
+// quantizes float endpoints with every p-bit combination and keeps the one with the lowest error
+inline float bc7QuantizeEndpoints(const float* points, const float* low, const float* high, Bc7Mode6Endpoints& best, uint8_t* bestIndices)
+{
+    float bestError = 1e30f;
+    for (int combination = 0; combination < 4; ++combination)
+    {
+        Bc7Mode6Endpoints candidate;
+        candidate.PBit[0] = combination & 1;
+        candidate.PBit[1] = combination >> 1;
+        for (int c = 0; c < 4; ++c)
+        {
+            const float* source[2] = { low, high };
+            for (int side = 0; side < 2; ++side)
+            {
+                int q = (int)((source[side][c] - candidate.PBit[side]) * 0.5f + 0.5f);
+                candidate.Color[side][c] = q < 0 ? 0 : (q > 127 ? 127 : q);
+            }
+        }
+
+        uint8_t indices[16];
+        float error = bc7Indices(points, candidate, indices);
+        if (error < bestError)
+        {
+            bestError = error;
+            best = candidate;
+            std::memcpy(bestIndices, indices, 16);
+        }
+    }
+    return bestError;
+}
+
+// appends bits to a block, least significant first as BC7 stores them
+struct BlockBitWriter
+{
+    uint8_t* Block;
+    unsigned Position;
+
+    void Write(uint32_t value, unsigned bits)
+    {
+        for (unsigned i = 0; i < bits; ++i, ++Position)
+        {
+            if ((value >> i) & 1)
+                Block[Position >> 3] |= (uint8_t)(1u << (Position & 7));
+        }
+    }
+};
+
+// encodes a 4x4 block of RGBA texels (row major) as BC7 mode 6, with the same endpoint search as BC1 over four channels
+inline void encodeBC7Block(const uint8_t* rgba, uint8_t* block)
+{
+    float points[16 * 4];
+    for (int i = 0; i < 64; ++i)
+        points[i] = rgba[i];
+
+    float low[4], high[4];
+    axisEndpoints(points, 4, low, high);
+
+    Bc7Mode6Endpoints endpoints;
+    uint8_t indices[16];
+    float error = bc7QuantizeEndpoints(points, low, high, endpoints, indices);
+
+    float weights[16];
+    for (int i = 0; i < 16; ++i)
+        weights[i] = BC7_WEIGHTS4[indices[i]] / 64.0f;
+    if (fitEndpoints(points, 4, weights, low, high))
+    {
+        Bc7Mode6Endpoints refined;
+        uint8_t refinedIndices[16];
+        if (bc7QuantizeEndpoints(points, low, high, refined, refinedIndices) < error)
+        {
+            endpoints = refined;
+            std::memcpy(indices, refinedIndices, 16);
+        }
+    }
+
+    // The first texel's index is stored without its top bit, which must therefore be clear; swapping the endpoints
+    // mirrors every index
+    if (indices[0] & 8)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            int swap = endpoints.Color[0][c];
+            endpoints.Color[0][c] = endpoints.Color[1][c];
+            endpoints.Color[1][c] = swap;
+        }
+        int swap = endpoints.PBit[0];
+        endpoints.PBit[0] = endpoints.PBit[1];
+        endpoints.PBit[1] = swap;
+        for (int i = 0; i < 16; ++i)
+            indices[i] = (uint8_t)(15 - indices[i]);
+    }
+
+    std::memset(block, 0, 16);
+    BlockBitWriter writer = { block, 0 };
+    writer.Write(1u << 6, 7); // Mode 6: six zero bits, then a one
+    for (int c = 0; c < 4; ++c)
+    {
+        writer.Write((uint32_t)endpoints.Color[0][c], 7);
+        writer.Write((uint32_t)endpoints.Color[1][c], 7);
+    }
+    writer.Write((uint32_t)endpoints.PBit[0], 1);
+    writer.Write((uint32_t)endpoints.PBit[1], 1);
+    writer.Write(indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        writer.Write(indices[i], 4);
+}
+
+
+// compresses an RGBA8 image into blocks, row of blocks by row of blocks. Blocks overhanging the right or bottom edge
+// repeat the edge texels. Rows of blocks are spread across the pool when one is given
+inline void compressImage(const uint8_t* rgba, int width, int height, BlockFormat format, ThreadPool* pool, std::vector<uint8_t>& blocks)
+{
+    int blocksX = (width + 3) / 4;
+    int blocksY = (height + 3) / 4;
+    size_t bytes = blockBytes(format);
+    blocks.resize(compressedSize(format, width, height));
+
+    auto encodeRow = [&](size_t blockY) {
+        uint8_t texels[16 * 4];
+        for (int blockX = 0; blockX < blocksX; ++blockX)
+        {
+            for (int y = 0; y < 4; ++y)
+            {
+                int sourceY = (int)blockY * 4 + y < height ? (int)blockY * 4 + y : height - 1;
+                for (int x = 0; x < 4; ++x)
+                {
+                    int sourceX = blockX * 4 + x < width ? blockX * 4 + x : width - 1;
+                    std::memcpy(texels + (y * 4 + x) * 4, rgba + ((size_t)sourceY * width + sourceX) * 4, 4);
+                }
+            }
+
+            uint8_t* block = blocks.data() + (blockY * blocksX + blockX) * bytes;
+            if (format == BLOCK_FORMAT_BC1)
+                encodeBC1Block(texels, block);
+            else
+                encodeBC7Block(texels, block);
+        }
+    };
+
+    if (pool)
+        pool->ParallelFor((size_t)blocksY, encodeRow);
+    else
+    {
+        for (size_t blockY = 0; blockY < (size_t)blocksY; ++blockY)
+            encodeRow(blockY);
+    }
+}
+#endif
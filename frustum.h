@@ -0,0 +1,155 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <vector>
+
+#include "mesh_builder.h"
+
+// Axis-aligned bounding box
+struct BoundingBox
+{
+    glm::vec3 Min = glm::vec3(0.0f);
+    glm::vec3 Max = glm::vec3(0.0f);
+};
+
+// Plane n.p + d = 0, with the normal pointing into the inside half space
+struct Plane
+{
+    glm::vec3 Normal;
+    float Distance;
+};
+
+
+// computes the bounding box of some vertices
+inline BoundingBox boundingBox(const std::vector<Vertex>& vertices)
+{
+    BoundingBox box;
+    if (vertices.empty())
+        return box;
+
+    box.Min = box.Max = vertices[0].Position;
+    for (size_t i = 1; i < vertices.size(); ++i)
+    {
+        box.Min = glm::min(box.Min, vertices[i].Position);
+        box.Max = glm::max(box.Max, vertices[i].Position);
+    }
+    return box;
+}
+
+// bounding box of a transformed box: the center moves with the matrix, the half extents through its absolute value
+inline BoundingBox transformBox(const BoundingBox& box, const glm::mat4& model)
+{
+    glm::vec3 center = glm::vec3(model * glm::vec4(0.5f * (box.Min + box.Max), 1.0f));
+    glm::vec3 half = 0.5f * (box.Max - box.Min);
+    glm::vec3 extent = glm::abs(glm::vec3(model[0])) * half.x + glm::abs(glm::vec3(model[1])) * half.y
+        + glm::abs(glm::vec3(model[2])) * half.z;
+
+    BoundingBox result;
+    result.Min = center - extent;
+    result.Max = center + extent;
+    return result;
+}
+
+// largest axis scale of a model matrix, so a transformed sphere still bounds non-uniformly scaled objects
+inline float maxAxisScale(const glm::mat4& model)
+{
+    float x = glm::length(glm::vec3(model[0]));
+    float y = glm::length(glm::vec3(model[1]));
+    float z = glm::length(glm::vec3(model[2]));
+    return glm::max(x, glm::max(y, z));
+}
+
+
+// The six clip planes of a view-projection matrix, in world space.
+// Each plane is a sum or difference of matrix rows (Gribb-Hartmann), which holds for any projection that keeps
+// clip space linear, so perspective and orthographic cameras extract the same way
+class Frustum
+{
+public:
+    enum { PLANE_LEFT = 0, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR, PLANE_COUNT };
+
+    Plane Planes[PLANE_COUNT];
+
+    void Extract(const glm::mat4& viewProjection)
+    {
+        // GLM is column major: row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; ++i)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+        setPlane(PLANE_LEFT, rows[3] + rows[0]);
+        setPlane(PLANE_RIGHT, rows[3] - rows[0]);
+        setPlane(PLANE_BOTTOM, rows[3] + rows[1]);
+        setPlane(PLANE_TOP, rows[3] - rows[1]);
+        setPlane(PLANE_NEAR, rows[3] + rows[2]);
+        setPlane(PLANE_FAR, rows[3] - rows[2]);
+    }
+
+    // false when the sphere lies entirely outside one plane
+    bool IntersectsSphere(const glm::vec3& center, float radius) const
+    {
+        for (int i = 0; i < PLANE_COUNT; ++i)
+        {
+            if (glm::dot(Planes[i].Normal, center) + Planes[i].Distance < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    // false when the box lies entirely outside one plane; tests the corner furthest along each plane normal
+    bool IntersectsBox(const BoundingBox& box) const
+    {
+        for (int i = 0; i < PLANE_COUNT; ++i)
+        {
+            const glm::vec3& n = Planes[i].Normal;
+            glm::vec3 corner(n.x >= 0.0f ? box.Max.x : box.Min.x, n.y >= 0.0f ? box.Max.y : box.Min.y,
+                n.z >= 0.0f ? box.Max.z : box.Min.z);
+            if (glm::dot(n, corner) + Planes[i].Distance < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    enum Containment { OUTSIDE = 0, INTERSECTING, INSIDE };
+
+    // whether a box is outside, crosses a plane, or lies entirely inside; INSIDE lets a hierarchy skip its children's tests
+    Containment ClassifyBox(const BoundingBox& box) const
+    {
+        Containment result = INSIDE;
+        for (int i = 0; i < PLANE_COUNT; ++i)
+        {
+            const glm::vec3& n = Planes[i].Normal;
+            glm::vec3 furthest(n.x >= 0.0f ? box.Max.x : box.Min.x, n.y >= 0.0f ? box.Max.y : box.Min.y,
+                n.z >= 0.0f ? box.Max.z : box.Min.z);
+            glm::vec3 nearest(n.x >= 0.0f ? box.Min.x : box.Max.x, n.y >= 0.0f ? box.Min.y : box.Max.y,
+                n.z >= 0.0f ? box.Min.z : box.Max.z);
+            if (glm::dot(n, furthest) + Planes[i].Distance < 0.0f)
+                return OUTSIDE;
+            if (glm::dot(n, nearest) + Planes[i].Distance < 0.0f)
+                result = INTERSECTING;
+        }
+        return result;
+    }
+
+private:
+    // normalizes so plane distances are in world units, as the sphere test needs
+    void setPlane(int index, const glm::vec4& plane)
+    {
+        glm::vec3 normal(plane.x, plane.y, plane.z);
+        float length = glm::length(normal);
+        Planes[index].Normal = normal / length;
+        Planes[index].Distance = plane.w / length;
+    }
+};
+
+// Objects tested against the frustum in one frame
+struct CullStats
+{
+    unsigned Visible = 0;
+    unsigned Culled = 0;
+    unsigned Occluded = 0;  // Inside the frustum but hidden by occluders; not counted as visible
+};
+#endif
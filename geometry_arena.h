@@ -0,0 +1,282 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "mesh_builder.h"
+#include "vertex_compression.h"
+
+// Where a mesh lives in shared geometry buffers; everything a draw call needs to address it
+struct MeshRange
+{
+    GLuint Id;          // Dense mesh id, used in render queue sort keys
+    GLuint Vao;
+    GLenum IndexType;   // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    GLuint FirstIndex;  // In units of IndexType
+    GLsizei IndexCount;
+    GLint BaseVertex;
+    GLuint VertexCount;
+    bool QuantizedPositions;    // Compact vertices; positions and texture coordinates decode with the offsets and scales below
+    glm::vec3 PositionOffset;
+    glm::vec3 PositionScale;
+    glm::vec2 TexCoordOffset;
+    glm::vec2 TexCoordScale;
+};
+
+// Vertex layouts an arena can hold
+enum VertexFormat
+{
+    VERTEX_FORMAT_FLOAT = 0,    // Vertex, 32 bytes
+    VERTEX_FORMAT_COMPACT = 1   // CompactVertex, 16 bytes
+};
+
+// hands out mesh ids that are unique across every arena, so sort keys and lookups never confuse two meshes
+inline GLuint nextMeshId()
+{
+    static GLuint next = 0;
+    return next++;
+}
+
+
+// First-fit free-list allocator over a range of units, coalescing neighbouring free blocks on release
+class RangeAllocator
+{
+public:
+    static const GLuint INVALID = ~0u;
+
+    // starts with a single free block covering the whole capacity
+    void Reset(GLuint capacity)
+    {
+        freeBlocks.clear();
+        if (capacity > 0)
+            freeBlocks[0] = capacity;
+        Capacity = capacity;
+        Used = 0;
+    }
+
+    // returns the offset of a block of size units aligned to alignment, or INVALID if nothing fits
+    GLuint Allocate(GLuint size, GLuint alignment = 1)
+    {
+        for (std::map<GLuint, GLuint>::iterator it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+        {
+            GLuint blockStart = it->first;
+            GLuint blockSize = it->second;
+            GLuint alignedStart = (blockStart + alignment - 1) / alignment * alignment;
+            GLuint padding = alignedStart - blockStart;
+            if (padding + size > blockSize)
+                continue;
+
+            // Split the block into [padding][allocation][tail]; padding and tail stay free
+            freeBlocks.erase(it);
+            if (padding > 0)
+                freeBlocks[blockStart] = padding;
+            GLuint tail = blockSize - padding - size;
+            if (tail > 0)
+                freeBlocks[alignedStart + size] = tail;
+
+            Used += size;
+            return alignedStart;
+        }
+        return INVALID;
+    }
+
+    // returns a block to the free list, merging it with free neighbours
+    void Free(GLuint offset, GLuint size)
+    {
+        if (size == 0)
+            return;
+        Used -= size;
+
+        std::map<GLuint, GLuint>::iterator next = freeBlocks.lower_bound(offset);
+        if (next != freeBlocks.begin())
+        {
+            std::map<GLuint, GLuint>::iterator previous = next;
+            --previous;
+            if (previous->first + previous->second == offset)
+            {
+                offset = previous->first;
+                size += previous->second;
+                freeBlocks.erase(previous);
+            }
+        }
+        if (next != freeBlocks.end() && offset + size == next->first)
+        {
+            size += next->second;
+            freeBlocks.erase(next);
+        }
+        freeBlocks[offset] = size;
+    }
+
+    GLuint Capacity = 0;
+    GLuint Used = 0;
+
+private:
+    std::map<GLuint, GLuint> freeBlocks; // Offset -> size, ordered so neighbours are adjacent
+};
+
+
+// One immutable vertex buffer, one immutable index buffer and a single VAO shared by every mesh.
+// Meshes are suballocated and drawn with a base vertex, so switching meshes never rebinds a VAO
+class GeometryArena
+{
+public:
+    GLuint Vao = 0;
+    GLuint Vbo = 0;
+    GLuint Ebo = 0;
+    VertexFormat Format = VERTEX_FORMAT_FLOAT;
+    GLsizei Stride = sizeof(Vertex);
+    RangeAllocator Vertices;    // In vertices
+    RangeAllocator IndexBytes;  // In bytes; 16- and 32-bit index ranges share the buffer
+
+    // allocates the buffers with fixed capacity and records the vertex layout in the VAO
+    void Create(GLuint vertexCapacity, GLuint indexByteCapacity, VertexFormat format = VERTEX_FORMAT_FLOAT)
+    {
+        Format = format;
+        Stride = format == VERTEX_FORMAT_FLOAT ? sizeof(Vertex) : sizeof(CompactVertex);
+        Vertices.Reset(vertexCapacity);
+        IndexBytes.Reset(indexByteCapacity);
+
+        // Immutable storage; data still arrives through glBufferSubData
+        glGenBuffers(1, &Vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, Vbo);
+        glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)vertexCapacity * Stride, NULL, GL_DYNAMIC_STORAGE_BIT);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glGenVertexArrays(1, &Vao);
+        glBindVertexArray(Vao);
+
+        glGenBuffers(1, &Ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Ebo); // Recorded in the VAO
+        glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indexByteCapacity, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+        // Position, normal and texture coordinate read from binding 0
+        GLuint normalLocation = 1;
+        if (format == VERTEX_FORMAT_FLOAT)
+        {
+            glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position));
+            glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal));
+            glVertexAttribFormat(2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoord));
+        }
+        else
+        {
+            // Location 1 stays disabled and reads the generic value 0, which tells the shader to decode the packed normal
+            normalLocation = COMPACT_NORMAL_LOCATION;
+            glVertexAttrib3f(1, 0.0f, 0.0f, 0.0f);
+            glVertexAttribFormat(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(CompactVertex, Position));
+            glVertexAttribFormat(COMPACT_NORMAL_LOCATION, 2, GL_SHORT, GL_TRUE, offsetof(CompactVertex, Normal));
+            glVertexAttribFormat(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(CompactVertex, TexCoord));
+        }
+        const GLuint attributes[3] = { 0, normalLocation, 2 };
+        for (GLuint i = 0; i < 3; ++i)
+        {
+            glVertexAttribBinding(attributes[i], 0);
+            glEnableVertexAttribArray(attributes[i]);
+        }
+        glBindVertexBuffer(0, Vbo, 0, Stride);
+
+        glBindVertexArray(0);
+    }
+
+    // releases the buffers and the VAO
+    void Destroy()
+    {
+        glDeleteVertexArrays(1, &Vao);
+        glDeleteBuffers(1, &Vbo);
+        glDeleteBuffers(1, &Ebo);
+        Vao = Vbo = Ebo = 0;
+    }
+
+    // copies a built mesh into a float arena. Indices stay relative to the mesh; BaseVertex offsets them at draw time
+    bool Allocate(const MeshBuilder& builder, MeshRange& range)
+    {
+        if (Format != VERTEX_FORMAT_FLOAT)
+        {
+            std::cout << "ERROR::GEOMETRY_ARENA::VERTEX_FORMAT_MISMATCH" << std::endl;
+            return false;
+        }
+        if (!allocate(builder, builder.Vertices.data(), range))
+            return false;
+
+        range.QuantizedPositions = false;
+        range.PositionOffset = glm::vec3(0.0f);
+        range.PositionScale = glm::vec3(1.0f);
+        range.TexCoordOffset = glm::vec2(0.0f);
+        range.TexCoordScale = glm::vec2(1.0f);
+        return true;
+    }
+
+    // copies a mesh compressed with compressVertices into a compact arena, indices taken from the builder
+    bool Allocate(const MeshBuilder& builder, const std::vector<CompactVertex>& vertices, const VertexCompressionResult& encoding, MeshRange& range)
+    {
+        if (Format != VERTEX_FORMAT_COMPACT || vertices.size() != builder.Vertices.size())
+        {
+            std::cout << "ERROR::GEOMETRY_ARENA::VERTEX_FORMAT_MISMATCH" << std::endl;
+            return false;
+        }
+        if (!allocate(builder, vertices.data(), range))
+            return false;
+
+        range.QuantizedPositions = true;
+        range.PositionOffset = encoding.PositionOffset;
+        range.PositionScale = encoding.PositionScale;
+        range.TexCoordOffset = encoding.TexCoordOffset;
+        range.TexCoordScale = encoding.TexCoordScale;
+        return true;
+    }
+
+    // returns a mesh's vertex and index space to the arena
+    void Free(const MeshRange& range)
+    {
+        GLuint indexSize = range.IndexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+        Vertices.Free((GLuint)range.BaseVertex, range.VertexCount);
+        IndexBytes.Free(range.FirstIndex * indexSize, (GLuint)range.IndexCount * indexSize);
+    }
+
+private:
+    // suballocates and uploads vertices already in the arena's format plus the builder's indices
+    bool allocate(const MeshBuilder& builder, const void* vertexData, MeshRange& range)
+    {
+        std::vector<unsigned char> indices = builder.PackIndices();
+        GLuint indexSize = builder.IndexSize();
+
+        GLuint baseVertex = Vertices.Allocate((GLuint)builder.Vertices.size());
+        if (baseVertex == RangeAllocator::INVALID)
+        {
+            std::cout << "ERROR::GEOMETRY_ARENA::OUT_OF_VERTEX_SPACE" << std::endl;
+            return false;
+        }
+
+        // 4-byte alignment keeps the offset a whole number of indices for both index types
+        GLuint indexOffset = IndexBytes.Allocate((GLuint)indices.size(), sizeof(GLuint));
+        if (indexOffset == RangeAllocator::INVALID)
+        {
+            Vertices.Free(baseVertex, (GLuint)builder.Vertices.size());
+            std::cout << "ERROR::GEOMETRY_ARENA::OUT_OF_INDEX_SPACE" << std::endl;
+            return false;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, Vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)baseVertex * Stride, builder.Vertices.size() * Stride, vertexData);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, Ebo); // Avoids touching the element binding of whatever VAO is bound
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indices.size(), indices.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        range.Id = nextMeshId();
+        range.Vao = Vao;
+        range.IndexType = builder.IndexType();
+        range.FirstIndex = indexOffset / indexSize;
+        range.IndexCount = (GLsizei)builder.Indices.size();
+        range.BaseVertex = (GLint)baseVertex;
+        range.VertexCount = (GLuint)builder.Vertices.size();
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,159 @@
+#ifndef HIZ_CULLER_H
+#define HIZ_CULLER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <iostream>
+
+#include "shader.h"
+
+// Shader storage bindings read and written by the occlusion cull pass; the buffers belong to the indirect renderer
+const GLuint CULL_BOUNDS_BINDING = 3;   // World bounds and command index of every object
+const GLuint CULL_COMMAND_BINDING = 4;  // Indirect draw commands, whose instance counts the pass fills
+const GLuint CULL_VISIBLE_BINDING = 5;  // Object index of every surviving instance, fed to the object index attribute
+
+// Work group sizes declared by the compute shaders
+const GLuint HIZ_GROUP_SIZE = 8;        // Downsample groups are 8x8 texels
+const GLuint CULL_GROUP_SIZE = 64;      // Cull groups are 64 objects
+
+
+// Hierarchical depth buffer occlusion culling on the GPU.
+// Large occluders are drawn depth-only into a private depth target, then a compute shader reduces that depth into a
+// mip pyramid where every texel holds the farthest depth of the region it covers. A second compute pass projects each
+// object's world box, picks the pyramid level where the box spans at most 2x2 texels and drops the object when its
+// nearest depth lies behind all of them. Survivors are appended to their indirect command, so the draw never reads
+// results back on the CPU. Needs compute shaders and image load/store (GL 4.3), which a 4.4 core context has
+class HiZCuller
+{
+public:
+    // creates the occluder depth target and the pyramid. The programs are the downsample and cull compute programs
+    bool Create(GLsizei width, GLsizei height, const ShaderProgram* downsampleProgram, const ShaderProgram* cullProgram)
+    {
+        downsample = downsampleProgram;
+        cull = cullProgram;
+        sourceLevel = downsample->GetUniform<GLint>("sourceLevel");
+        objectCount = cull->GetUniform<GLuint>("objectCount");
+        depthWidth = width;
+        depthHeight = height;
+
+        glGenTextures(1, &depthTexture);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        // Level 0 of the pyramid is already half the depth resolution; levels halve down to a single texel
+        pyramidWidth = width > 1 ? width / 2 : 1;
+        pyramidHeight = height > 1 ? height / 2 : 1;
+        levels = 1;
+        while ((pyramidWidth >> levels) > 0 || (pyramidHeight >> levels) > 0)
+            ++levels;
+
+        glGenTextures(1, &pyramid);
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, pyramidWidth, pyramidHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE); // Depth only; whatever the occluder program writes to color is discarded
+        glReadBuffer(GL_NONE);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        if (!complete)
+            std::cout << "ERROR::HIZ::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        return complete;
+    }
+
+    // releases every GL object owned by the culler
+    void Destroy()
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &depthTexture);
+        glDeleteTextures(1, &pyramid);
+        framebuffer = depthTexture = pyramid = 0;
+    }
+
+    GLsizei Levels() const { return levels; }
+
+    // redirects rendering into the occluder depth target and clears it. Draw the occluders, then call EndOccluders
+    void BeginOccluders()
+    {
+        glGetIntegerv(GL_VIEWPORT, savedViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, depthWidth, depthHeight);
+        glEnable(GL_DEPTH_TEST);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // returns to the default framebuffer and viewport
+    void EndOccluders()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+    }
+
+    // reduces the occluder depth into the pyramid, one dispatch per level. Each level samples the one before it
+    // and writes its own level through an image, so levels are separated by texture fetch barriers
+    void BuildPyramid()
+    {
+        downsample->Use();
+        glActiveTexture(GL_TEXTURE0);
+
+        for (GLsizei level = 0; level < levels; ++level)
+        {
+            glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramid);
+            sourceLevel.Set(level == 0 ? 0 : level - 1);
+            glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+            GLuint width = glm::max(pyramidWidth >> level, 1);
+            GLuint height = glm::max(pyramidHeight >> level, 1);
+            glDispatchCompute((width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // tests count objects against the pyramid. Commands must arrive with zero instance counts; each visible object
+    // increments its command's count and writes its index into that command's range of the visible buffer
+    void Cull(GLuint boundsBuffer, GLuint commandBuffer, GLuint visibleBuffer, GLuint count)
+    {
+        cull->Use();
+        objectCount.Set(count);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_BOUNDS_BINDING, boundsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMAND_BINDING, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_VISIBLE_BINDING, visibleBuffer);
+
+        glDispatchCompute((count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+        // The draw consumes the counts as indirect commands and the indices as a vertex attribute
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+private:
+    const ShaderProgram* downsample = nullptr;
+    const ShaderProgram* cull = nullptr;
+    Uniform<GLint> sourceLevel;
+    Uniform<GLuint> objectCount;
+
+    GLuint framebuffer = 0;
+    GLuint depthTexture = 0;
+    GLuint pyramid = 0;
+    GLsizei depthWidth = 0;
+    GLsizei depthHeight = 0;
+    GLsizei pyramidWidth = 0;
+    GLsizei pyramidHeight = 0;
+    GLsizei levels = 0;
+    GLint savedViewport[4] = {};
+};
+#endif
@@ -0,0 +1,405 @@
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "thread_pool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMAGE_OPS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IMAGE_OPS_SSSE3_TARGET
+#define IMAGE_OPS_AVX2_TARGET
+#else
+#define IMAGE_OPS_SSSE3_TARGET __attribute__((target("ssse3")))
+#define IMAGE_OPS_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+// Instruction set the image kernels run on. Expansion and swizzles shuffle bytes, which SSE2 alone cannot do
+enum ImageOpsPath
+{
+    IMAGE_OPS_PATH_SCALAR = 0,
+    IMAGE_OPS_PATH_SSSE3,   // 16 bytes per iteration
+    IMAGE_OPS_PATH_AVX2,    // 32 bytes per iteration
+    IMAGE_OPS_PATH_COUNT
+};
+
+// Rows per parallel task
+const int IMAGE_BAND_ROWS = 32;
+
+inline const char* imageOpsPathName(ImageOpsPath path)
+{
+    static const char* const names[IMAGE_OPS_PATH_COUNT] = { "scalar", "ssse3", "avx2" };
+    return names[path];
+}
+
+// whether the CPU and operating system can run a kernel
+inline bool imageOpsPathSupported(ImageOpsPath path)
+{
+#if IMAGE_OPS_X86
+    if (path == IMAGE_OPS_PATH_SSSE3 || path == IMAGE_OPS_PATH_AVX2)
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        int highest = info[0];
+        __cpuid(info, 1);
+        if (path == IMAGE_OPS_PATH_SSSE3)
+            return (info[2] & (1 << 9)) != 0;
+        if (highest < 7)
+            return false;
+        bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesAvx && (info[1] & (1 << 5)) != 0;
+#else
+        if (path == IMAGE_OPS_PATH_SSSE3)
+            return __builtin_cpu_supports("ssse3") != 0;
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+    return path == IMAGE_OPS_PATH_SCALAR;
+}
+
+// fastest kernel the machine supports
+inline ImageOpsPath detectImageOpsPath()
+{
+    for (int path = IMAGE_OPS_PATH_COUNT - 1; path > IMAGE_OPS_PATH_SCALAR; --path)
+    {
+        if (imageOpsPathSupported((ImageOpsPath)path))
+            return (ImageOpsPath)path;
+    }
+    return IMAGE_OPS_PATH_SCALAR;
+}
+
+// calls fn(first, end) for bands of IMAGE_BAND_ROWS rows of [0, rows), across the workers when there are several
+template <typename Function>
+inline void forEachImageBand(ThreadPool* workers, int rows, Function fn)
+{
+    size_t bands = (size_t)(rows + IMAGE_BAND_ROWS - 1) / IMAGE_BAND_ROWS;
+    auto band = [rows, &fn](size_t index) {
+        int first = (int)index * IMAGE_BAND_ROWS;
+        fn(first, first + IMAGE_BAND_ROWS < rows ? first + IMAGE_BAND_ROWS : rows);
+    };
+    if (workers && bands > 1)
+        workers->ParallelFor(bands, band);
+    else
+    {
+        for (size_t index = 0; index < bands; ++index)
+            band(index);
+    }
+}
+
+
+// Row kernels. swapRow exchanges two rows of bytes; expandRow writes RGB texels as RGBA with an opaque alpha;
+// swizzleRow reorders the channels of RGBA texels, channel c taking source channel order[c]; premultiplyRow scales
+// the color of RGBA texels by their alpha, rounding to nearest
+inline void swapRowScalar(uint8_t* a, uint8_t* b, size_t bytes)
+{
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        uint64_t left, right;
+        std::memcpy(&left, a + i, 8);
+        std::memcpy(&right, b + i, 8);
+        std::memcpy(a + i, &right, 8);
+        std::memcpy(b + i, &left, 8);
+    }
+    for (; i < bytes; ++i)
+    {
+        uint8_t swap = a[i];
+        a[i] = b[i];
+        b[i] = swap;
+    }
+}
+
+inline void expandRowScalar(const uint8_t* rgb, int width, uint8_t* rgba)
+{
+    for (int x = 0; x < width; ++x, rgb += 3, rgba += 4)
+    {
+        rgba[0] = rgb[0];
+        rgba[1] = rgb[1];
+        rgba[2] = rgb[2];
+        rgba[3] = 255;
+    }
+}
+
+inline void swizzleRowScalar(uint8_t* rgba, int width, const uint8_t order[4])
+{
+    for (int x = 0; x < width; ++x, rgba += 4)
+    {
+        uint8_t texel[4] = { rgba[0], rgba[1], rgba[2], rgba[3] };
+        for (int c = 0; c < 4; ++c)
+            rgba[c] = texel[order[c]];
+    }
+}
+
+// x * a / 255 rounded to nearest, exact for all 8-bit x and a
+inline uint8_t multiplyUnorm8(unsigned x, unsigned a)
+{
+    unsigned t = x * a + 128;
+    return (uint8_t)((t + (t >> 8)) >> 8);
+}
+
+inline void premultiplyRowScalar(uint8_t* rgba, int width)
+{
+    for (int x = 0; x < width; ++x, rgba += 4)
+    {
+        rgba[0] = multiplyUnorm8(rgba[0], rgba[3]);
+        rgba[1] = multiplyUnorm8(rgba[1], rgba[3]);
+        rgba[2] = multiplyUnorm8(rgba[2], rgba[3]);
+    }
+}
+
+#if IMAGE_OPS_X86
+IMAGE_OPS_SSSE3_TARGET inline void swapRowSsse3(uint8_t* a, uint8_t* b, size_t bytes)
+{
+    size_t i = 0;
+    for (; i + 16 <= bytes; i += 16)
+    {
+        __m128i left = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i right = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(a + i), right);
+        _mm_storeu_si128((__m128i*)(b + i), left);
+    }
+    swapRowScalar(a + i, b + i, bytes - i);
+}
+
+// Each 16-byte load holds 4 texels in its first 12 bytes; loads stop where they would read past the row
+IMAGE_OPS_SSSE3_TARGET inline void expandRowSsse3(const uint8_t* rgb, int width, uint8_t* rgba)
+{
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+    int x = 0;
+    for (; x + 6 <= width; x += 4)
+    {
+        __m128i texels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(rgb + x * 3)), spread);
+        _mm_storeu_si128((__m128i*)(rgba + x * 4), _mm_or_si128(texels, opaque));
+    }
+    expandRowScalar(rgb + x * 3, width - x, rgba + x * 4);
+}
+
+IMAGE_OPS_SSSE3_TARGET inline void swizzleRowSsse3(uint8_t* rgba, int width, const uint8_t order[4])
+{
+    const __m128i shuffle = _mm_setr_epi8(order[0], order[1], order[2], order[3], 4 + order[0], 4 + order[1], 4 + order[2], 4 + order[3],
+        8 + order[0], 8 + order[1], 8 + order[2], 8 + order[3], 12 + order[0], 12 + order[1], 12 + order[2], 12 + order[3]);
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i texels = _mm_loadu_si128((const __m128i*)(rgba + x * 4));
+        _mm_storeu_si128((__m128i*)(rgba + x * 4), _mm_shuffle_epi8(texels, shuffle));
+    }
+    swizzleRowScalar(rgba + x * 4, width - x, order);
+}
+
+// Channels widen to 16 bits, so each half of a load is two texels; alpha is broadcast over its texel's words and
+// replaced by 255 in the alpha word, which leaves alpha unchanged
+IMAGE_OPS_SSSE3_TARGET inline __m128i premultiplyTexelsSsse3(__m128i words, __m128i alphaWord, __m128i keepAlpha)
+{
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(words, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm_or_si128(_mm_andnot_si128(alphaWord, alpha), keepAlpha);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(words, alpha), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+IMAGE_OPS_SSSE3_TARGET inline void premultiplyRowSsse3(uint8_t* rgba, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaWord = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+    const __m128i keepAlpha = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i texels = _mm_loadu_si128((const __m128i*)(rgba + x * 4));
+        __m128i low = premultiplyTexelsSsse3(_mm_unpacklo_epi8(texels, zero), alphaWord, keepAlpha);
+        __m128i high = premultiplyTexelsSsse3(_mm_unpackhi_epi8(texels, zero), alphaWord, keepAlpha);
+        _mm_storeu_si128((__m128i*)(rgba + x * 4), _mm_packus_epi16(low, high));
+    }
+    premultiplyRowScalar(rgba + x * 4, width - x);
+}
+
+IMAGE_OPS_AVX2_TARGET inline void swapRowAvx2(uint8_t* a, uint8_t* b, size_t bytes)
+{
+    size_t i = 0;
+    for (; i + 32 <= bytes; i += 32)
+    {
+        __m256i left = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i right = _mm256_loadu_si256((const __m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(a + i), right);
+        _mm256_storeu_si256((__m256i*)(b + i), left);
+    }
+    swapRowScalar(a + i, b + i, bytes - i);
+}
+
+// Byte shuffles stay within 128-bit lanes, so each lane is loaded with its own 4 texels
+IMAGE_OPS_AVX2_TARGET inline void expandRowAvx2(const uint8_t* rgb, int width, uint8_t* rgba)
+{
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+    int x = 0;
+    for (; x + 10 <= width; x += 8)
+    {
+        __m128i low = _mm_loadu_si128((const __m128i*)(rgb + x * 3));
+        __m128i high = _mm_loadu_si128((const __m128i*)(rgb + x * 3 + 12));
+        __m256i texels = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1), spread);
+        _mm256_storeu_si256((__m256i*)(rgba + x * 4), _mm256_or_si256(texels, opaque));
+    }
+    expandRowScalar(rgb + x * 3, width - x, rgba + x * 4);
+}
+
+IMAGE_OPS_AVX2_TARGET inline void swizzleRowAvx2(uint8_t* rgba, int width, const uint8_t order[4])
+{
+    const __m256i shuffle = _mm256_setr_epi8(order[0], order[1], order[2], order[3], 4 + order[0], 4 + order[1], 4 + order[2], 4 + order[3],
+        8 + order[0], 8 + order[1], 8 + order[2], 8 + order[3], 12 + order[0], 12 + order[1], 12 + order[2], 12 + order[3],
+        order[0], order[1], order[2], order[3], 4 + order[0], 4 + order[1], 4 + order[2], 4 + order[3],
+        8 + order[0], 8 + order[1], 8 + order[2], 8 + order[3], 12 + order[0], 12 + order[1], 12 + order[2], 12 + order[3]);
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i texels = _mm256_loadu_si256((const __m256i*)(rgba + x * 4));
+        _mm256_storeu_si256((__m256i*)(rgba + x * 4), _mm256_shuffle_epi8(texels, shuffle));
+    }
+    swizzleRowScalar(rgba + x * 4, width - x, order);
+}
+
+IMAGE_OPS_AVX2_TARGET inline __m256i premultiplyTexelsAvx2(__m256i words, __m256i alphaWord, __m256i keepAlpha)
+{
+    __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(words, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    alpha = _mm256_or_si256(_mm256_andnot_si256(alphaWord, alpha), keepAlpha);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(words, alpha), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// Unpacking and packing both work within lanes, so texels come back in their original order
+IMAGE_OPS_AVX2_TARGET inline void premultiplyRowAvx2(uint8_t* rgba, int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaWord = _mm256_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+    const __m256i keepAlpha = _mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255);
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m256i texels = _mm256_loadu_si256((const __m256i*)(rgba + x * 4));
+        __m256i low = premultiplyTexelsAvx2(_mm256_unpacklo_epi8(texels, zero), alphaWord, keepAlpha);
+        __m256i high = premultiplyTexelsAvx2(_mm256_unpackhi_epi8(texels, zero), alphaWord, keepAlpha);
+        _mm256_storeu_si256((__m256i*)(rgba + x * 4), _mm256_packus_epi16(low, high));
+    }
+    premultiplyRowScalar(rgba + x * 4, width - x);
+}
+#endif
+
+inline void swapRow(ImageOpsPath path, uint8_t* a, uint8_t* b, size_t bytes)
+{
+#if IMAGE_OPS_X86
+    if (path == IMAGE_OPS_PATH_AVX2)
+        return swapRowAvx2(a, b, bytes);
+    if (path == IMAGE_OPS_PATH_SSSE3)
+        return swapRowSsse3(a, b, bytes);
+#endif
+    swapRowScalar(a, b, bytes);
+}
+
+inline void expandRow(ImageOpsPath path, const uint8_t* rgb, int width, uint8_t* rgba)
+{
+#if IMAGE_OPS_X86
+    if (path == IMAGE_OPS_PATH_AVX2)
+        return expandRowAvx2(rgb, width, rgba);
+    if (path == IMAGE_OPS_PATH_SSSE3)
+        return expandRowSsse3(rgb, width, rgba);
+#endif
+    expandRowScalar(rgb, width, rgba);
+}
+
+inline void swizzleRow(ImageOpsPath path, uint8_t* rgba, int width, const uint8_t order[4])
+{
+#if IMAGE_OPS_X86
+    if (path == IMAGE_OPS_PATH_AVX2)
+        return swizzleRowAvx2(rgba, width, order);
+    if (path == IMAGE_OPS_PATH_SSSE3)
+        return swizzleRowSsse3(rgba, width, order);
+#endif
+    swizzleRowScalar(rgba, width, order);
+}
+
+inline void premultiplyRow(ImageOpsPath path, uint8_t* rgba, int width)
+{
+#if IMAGE_OPS_X86
+    if (path == IMAGE_OPS_PATH_AVX2)
+        return premultiplyRowAvx2(rgba, width);
+    if (path == IMAGE_OPS_PATH_SSSE3)
+        return premultiplyRowSsse3(rgba, width);
+#endif
+    premultiplyRowScalar(rgba, width);
+}
+
+
+// Whole-image operations on tightly packed rows, run on bands of rows across the workers when given.
+// Decoders hand images over top row first, while OpenGL expects the bottom row first
+
+// flips an image upside down in place
+inline void flipRows(uint8_t* image, size_t rowBytes, int height, ThreadPool* workers = nullptr, ImageOpsPath path = detectImageOpsPath())
+{
+    forEachImageBand(workers, height / 2, [&](int first, int end) {
+        for (int row = first; row < end; ++row)
+            swapRow(path, image + row * rowBytes, image + (size_t)(height - 1 - row) * rowBytes, rowBytes);
+    });
+}
+
+// copies an image upside down into a separate buffer
+inline void copyRowsFlipped(const uint8_t* source, size_t rowBytes, int height, uint8_t* dest, ThreadPool* workers = nullptr)
+{
+    forEachImageBand(workers, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row)
+            std::memcpy(dest + row * rowBytes, source + (size_t)(height - 1 - row) * rowBytes, rowBytes);
+    });
+}
+
+// writes an RGB image as RGBA with opaque alpha into a separate buffer, optionally upside down in the same pass
+inline void expandRgbToRgba(const uint8_t* rgb, int width, int height, uint8_t* rgba, bool flip, ThreadPool* workers = nullptr,
+    ImageOpsPath path = detectImageOpsPath())
+{
+    forEachImageBand(workers, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row)
+            expandRow(path, rgb + (size_t)(flip ? height - 1 - row : row) * width * 3, width, rgba + (size_t)row * width * 4);
+    });
+}
+
+// reorders the channels of an RGBA image in place: channel c takes what was channel order[c], so { 2, 1, 0, 3 } turns
+// RGBA into BGRA and back
+inline void swizzleChannels(uint8_t* rgba, int width, int height, const uint8_t order[4], ThreadPool* workers = nullptr,
+    ImageOpsPath path = detectImageOpsPath())
+{
+    forEachImageBand(workers, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row)
+            swizzleRow(path, rgba + (size_t)row * width * 4, width, order);
+    });
+}
+
+// multiplies the color of an RGBA image by its alpha in place, rounding to nearest
+inline void premultiplyAlpha(uint8_t* rgba, int width, int height, ThreadPool* workers = nullptr, ImageOpsPath path = detectImageOpsPath())
+{
+    forEachImageBand(workers, height, [&](int first, int end) {
+        for (int row = first; row < end; ++row)
+            premultiplyRow(path, rgba + (size_t)row * width * 4, width);
+    });
+}
+
+// decoded image as the loaders upload it: RGBA, bottom row first. RGB sources are expanded in the same pass as the
+// flip, so no driver has to expand 3-byte texels on upload. Returns false for channel counts other than 3 or 4
+inline bool prepareForUpload(const uint8_t* image, int width, int height, int channels, uint8_t* rgba, ThreadPool* workers = nullptr)
+{
+    if (channels == 3)
+        expandRgbToRgba(image, width, height, rgba, true, workers);
+    else if (channels == 4)
+        copyRowsFlipped(image, (size_t)width * 4, height, rgba, workers);
+    else
+        return false;
+    return true;
+}
+#endif
@@ -0,0 +1,501 @@
+#ifndef INDIRECT_RENDERER_H
+#define INDIRECT_RENDERER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hiz_culler.h"
+#include "image_ops.h"
+#include "ktx2.h"
+#include "mip_generator.h"
+#include "render_queue.h"
+#include "thread_pool.h"
+
+// Vertex attribute carrying the object index; fed from an identity buffer so baseInstance selects the object
+const GLuint OBJECT_INDEX_LOCATION = 8;
+const GLuint OBJECT_INDEX_BINDING = 2;      // Vertex buffer binding of the identity buffer in the arena VAO
+const GLuint OBJECT_BLOCK_BINDING = 1;      // Shader storage binding of the per-object data
+
+// Layout of glMultiDrawElementsIndirect commands
+struct DrawElementsIndirectCommand
+{
+    GLuint Count;
+    GLuint InstanceCount;
+    GLuint FirstIndex;
+    GLint BaseVertex;
+    GLuint BaseInstance;
+};
+
+// Per-object data read by the indirect vertex shader (std430)
+struct ObjectData
+{
+    glm::mat4 Model;
+    glm::vec4 UVTransform;  // Texture coordinate = uv * xy + zw
+    glm::vec4 Layer;        // x texture array layer, yzw pad the struct to a multiple of 16 bytes
+};
+
+// World bounds of one object and the command drawing it, read by the occlusion cull pass (std430)
+struct ObjectBounds
+{
+    glm::vec3 Min;
+    GLuint Command;
+    glm::vec3 Max;
+    GLuint Padding;
+};
+
+// Consecutive commands drawn by one glMultiDrawElementsIndirect: same VAO and index type
+struct IndirectGroup
+{
+    GLuint Vao;
+    GLenum IndexType;
+    GLuint FirstCommand;
+    GLsizei CommandCount;
+};
+
+// One layer of the texture array: the 2D texture, the image file it was made from, and its cooked layer file (empty
+// where there is none)
+struct ArrayTexture
+{
+    GLuint Texture;
+    std::string Source;
+    std::string LayerFile;
+};
+
+// Counters for the last indirect frame
+struct IndirectStats
+{
+    unsigned Objects;
+    unsigned Commands;
+    unsigned MultiDraws;
+};
+
+
+// Draws a whole render pass with one glMultiDrawElementsIndirect per geometry arena and index type.
+// Every object of the pass becomes an entry in a storage buffer; each mesh becomes one command whose
+// instances are that mesh's objects, located through baseInstance. Textures come from one array texture
+class IndirectRenderer
+{
+public:
+    static const GLsizei TEXTURE_ARRAY_SIZE = 1024; // Every texture is resampled to this square size, and cooked layers are cooked at it
+    static const GLsizei TEXTURE_ARRAY_LEVELS = 11; // Full chain of TEXTURE_ARRAY_SIZE
+
+    GLuint TextureArray = 0;           // Built by BuildTextureArray, the first time indirect drawing is used
+    bool CookedLayers = false;          // The array holds cooked BC7 layers rather than copies of the 2D textures
+    ThreadPool* Workers = nullptr;      // Decodes and resamples layers filled from their sources; the caller does when null
+    IndirectStats Stats = {};
+
+    // creates the buffers
+    void Create()
+    {
+        glGenBuffers(1, &objectSsbo);
+        glGenBuffers(1, &commandBuffer);
+        glGenBuffers(1, &identityBuffer);
+        glGenBuffers(1, &boundsSsbo);
+        glGenBuffers(1, &visibleBuffer);
+        growIdentityBuffer(1024);
+    }
+
+    // wires the object index attribute into an arena VAO. Every arena drawn indirectly must be attached
+    void AttachVao(GLuint vao)
+    {
+        glBindVertexArray(vao);
+        glVertexAttribIFormat(OBJECT_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0);
+        glVertexAttribBinding(OBJECT_INDEX_LOCATION, OBJECT_INDEX_BINDING);
+        glVertexBindingDivisor(OBJECT_INDEX_BINDING, 1);
+        glEnableVertexAttribArray(OBJECT_INDEX_LOCATION);
+        glBindVertexBuffer(OBJECT_INDEX_BINDING, identityBuffer, 0, sizeof(GLuint));
+        glBindVertexArray(0);
+    }
+
+    // releases every GL object owned by the renderer
+    void Destroy()
+    {
+        glDeleteBuffers(1, &objectSsbo);
+        glDeleteBuffers(1, &commandBuffer);
+        glDeleteBuffers(1, &identityBuffer);
+        glDeleteBuffers(1, &boundsSsbo);
+        glDeleteBuffers(1, &visibleBuffer);
+        glDeleteTextures(1, &TextureArray);
+        objectSsbo = commandBuffer = identityBuffer = boundsSsbo = visibleBuffer = TextureArray = 0;
+        CookedLayers = false;
+    }
+
+    // builds the array texture the indirect pass samples, one layer per texture. When every texture has a usable
+    // cooked layer file, the array is uploaded block compressed from those files with their cooked chains. Otherwise
+    // every level of the 2D textures' CPU built chains is copied into an RGBA8 array with a linear blit. Cooked 2D
+    // textures cannot be blitted, so their sources are decoded, resampled and mipmapped on the CPU instead
+    void BuildTextureArray(const std::vector<ArrayTexture>& textures)
+    {
+        if (TextureArray != 0)
+            glDeleteTextures(1, &TextureArray);
+        glGenTextures(1, &TextureArray);
+        entries = textures;
+        layers.clear();
+        staleTextures.clear();
+        decodedLayers.assign(textures.size(), false);
+        for (size_t layer = 0; layer < textures.size(); ++layer)
+            layers[textures[layer].Texture] = (GLuint)layer;
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, TextureArray);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        CookedLayers = uploadCookedLayers();
+        if (!CookedLayers)
+        {
+            glTexStorage3D(GL_TEXTURE_2D_ARRAY, TEXTURE_ARRAY_LEVELS, GL_RGBA8, TEXTURE_ARRAY_SIZE, TEXTURE_ARRAY_SIZE, (GLsizei)textures.size());
+
+            // The loaders' placeholder grey, so a layer whose source cannot be read is never left undefined
+            const GLubyte placeholder[4] = { 128, 128, 128, 255 };
+            for (GLint level = 0; level < TEXTURE_ARRAY_LEVELS; ++level)
+                glClearTexImage(TextureArray, level, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+            for (size_t layer = 0; layer < textures.size(); ++layer)
+                staleTextures.push_back(textures[layer].Texture);
+            updateStaleLayers();
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    // marks layers of the array stale after their textures changed (such as a streamed texture replacing its
+    // placeholder). They are copied again by the next Draw, so nothing runs while indirect drawing is off.
+    // Textures not in the array are ignored
+    void RefreshTextures(const std::vector<GLuint>& textures)
+    {
+        // Cooked layers come from their own files, and decoded layers from their sources, so streaming the 2D
+        // textures changes nothing for them
+        if (CookedLayers)
+            return;
+        for (size_t i = 0; i < textures.size(); ++i)
+        {
+            std::unordered_map<GLuint, GLuint>::const_iterator it = layers.find(textures[i]);
+            if (it != layers.end() && !decodedLayers[it->second]
+                && std::find(staleTextures.begin(), staleTextures.end(), it->first) == staleTextures.end())
+                staleTextures.push_back(it->first);
+        }
+    }
+
+    // returns the array layer a 2D texture was copied to (0 if it was never added)
+    GLuint Layer(GLuint texture) const
+    {
+        std::unordered_map<GLuint, GLuint>::const_iterator it = layers.find(texture);
+        return it != layers.end() ? it->second : 0;
+    }
+
+    // draws every item of one pass of a sorted queue with the given program. With an occlusion culler, whose pyramid
+    // must be built for this frame, the GPU decides which objects each command draws
+    void Draw(const RenderQueue& queue, RenderPass pass, const ShaderProgram& program, HiZCuller* occlusion = nullptr)
+    {
+        Stats = IndirectStats();
+        if (!staleTextures.empty())
+            updateStaleLayers();
+        buildCommands(queue, pass, occlusion != nullptr);
+        if (objects.empty())
+            return;
+
+        if (objects.size() > identityCapacity)
+            growIdentityBuffer(objects.size() * 2);
+
+        // The cull pass counts the instances it keeps, so commands start empty
+        if (occlusion)
+        {
+            for (size_t i = 0; i < commands.size(); ++i)
+                commands[i].InstanceCount = 0;
+        }
+
+        // Orphan and refill; both buffers are rewritten every frame
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectSsbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, objects.size() * sizeof(ObjectData), objects.data(), GL_STREAM_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_BLOCK_BINDING, objectSsbo);
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_STREAM_DRAW);
+
+        if (occlusion)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsSsbo);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(ObjectBounds), bounds.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            occlusion->Cull(boundsSsbo, commandBuffer, visibleBuffer, (GLuint)objects.size());
+        }
+
+        program.Use();
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, TextureArray);
+
+        // A multi-draw shares one VAO and one index type
+        GLuint currentVao = ~0u;
+        for (size_t i = 0; i < groups.size(); ++i)
+        {
+            const IndirectGroup& group = groups[i];
+            if (group.Vao != currentVao)
+            {
+                currentVao = group.Vao;
+                glBindVertexArray(currentVao);
+
+                // Culled draws read object indices compacted by the GPU instead of the identity
+                glBindVertexBuffer(OBJECT_INDEX_BINDING, occlusion ? visibleBuffer : identityBuffer, 0, sizeof(GLuint));
+            }
+            glMultiDrawElementsIndirect(GL_TRIANGLES, group.IndexType, (void*)(group.FirstCommand * sizeof(DrawElementsIndirectCommand)),
+                group.CommandCount, 0);
+            ++Stats.MultiDraws;
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        Stats.Objects = (unsigned)objects.size();
+        Stats.Commands = (unsigned)commands.size();
+    }
+
+    // copies one 2D texture into an existing array layer, every array level from the source level closest above it
+    // in size, so the array's mips come from the texture's own chain. Expects the read and draw framebuffers to be
+    // bound. Compressed formats cannot be attached for a blit; rather than read them back, the layer is decoded
+    // from the texture's source once
+    void UpdateLayer(GLuint texture, GLuint layer)
+    {
+        GLint compressed = GL_FALSE, maxLevel = 0;
+        GLint widths[TEXTURE_ARRAY_LEVELS * 2] = {}, heights[TEXTURE_ARRAY_LEVELS * 2] = {};
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+        GLint levelCount = 0;
+        while (levelCount < TEXTURE_ARRAY_LEVELS * 2 && levelCount <= maxLevel)
+        {
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, levelCount, GL_TEXTURE_WIDTH, &widths[levelCount]);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, levelCount, GL_TEXTURE_HEIGHT, &heights[levelCount]);
+            if (widths[levelCount] == 0)
+                break;
+            ++levelCount;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (compressed)
+        {
+            if (!warnedDecodedLayers)
+                std::cout << "WARNING: cooked textures without a usable layer file are decoded from their sources for the texture array; run --cook-textures again" << std::endl;
+            warnedDecodedLayers = true;
+            decodedLayers[layer] = true;
+            if (!decodeLayer(layer))
+                std::cout << "ERROR::INDIRECT_RENDERER::LAYER_DECODE_FAILED " << entries[layer].Source << std::endl;
+            return;
+        }
+
+        for (GLint level = 0; level < TEXTURE_ARRAY_LEVELS; ++level)
+        {
+            // The deepest source level still at least as large as the target on its longer side, so the blit
+            // never shrinks by 2x or more and skips texels
+            GLint size = TEXTURE_ARRAY_SIZE >> level, source = 0;
+            while (source + 1 < levelCount && std::max(widths[source + 1], heights[source + 1]) >= size)
+                ++source;
+
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, source);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, TextureArray, level, layer);
+            glBlitFramebuffer(0, 0, widths[source], heights[source], 0, 0, size, size, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        }
+    }
+
+private:
+    GLuint objectSsbo = 0;
+    GLuint commandBuffer = 0;
+    GLuint identityBuffer = 0;
+    GLuint boundsSsbo = 0;
+    GLuint visibleBuffer = 0;           // Same size as the identity buffer, filled by the occlusion cull pass
+    size_t identityCapacity = 0;
+    std::vector<ArrayTexture> entries;  // Layer -> texture of the array
+    std::unordered_map<GLuint, GLuint> layers;
+    std::vector<GLuint> staleTextures;  // Textures whose layers the next Draw copies again
+    std::vector<bool> decodedLayers;    // Layers filled from their sources instead of their 2D textures
+    bool warnedDecodedLayers = false;
+    std::vector<ObjectData> objects;
+    std::vector<ObjectBounds> bounds;   // Parallel to objects, only filled for occlusion culled draws
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<IndirectGroup> groups;
+    std::vector<MeshRange> meshes;      // Meshes of the pass, in command order
+    std::vector<GLuint> meshCounts;     // Mesh id -> objects using it
+    std::vector<GLuint> meshCommand;    // Mesh id -> command index
+    std::vector<GLuint> commandFill;    // Objects written so far per command
+
+    // uploads the cooked layer files into immutable BC7 storage, every level from the files' own chains. Fails, leaving
+    // the array unallocated, unless every texture has a layer file that is a BC7 image of the array size, all with
+    // the same level count
+    bool uploadCookedLayers()
+    {
+        std::vector<std::vector<uint8_t>> contents(entries.size());
+        std::vector<Ktx2Image> images(entries.size());
+        for (size_t layer = 0; layer < entries.size(); ++layer)
+        {
+            if (entries[layer].LayerFile.empty())
+                return false;
+            if (!readFileBytes(entries[layer].LayerFile, contents[layer]) || !parseKtx2(contents[layer].data(), contents[layer].size(), images[layer])
+                || images[layer].VkFormat != KTX2_FORMAT_BC7_UNORM || images[layer].Width != (uint32_t)TEXTURE_ARRAY_SIZE
+                || images[layer].Height != (uint32_t)TEXTURE_ARRAY_SIZE || images[layer].Levels.size() != images[0].Levels.size())
+            {
+                std::cout << "WARNING: unusable texture array layer " << entries[layer].LayerFile << ", copying the textures instead" << std::endl;
+                return false;
+            }
+        }
+
+        GLenum format = ktx2GlFormat(KTX2_FORMAT_BC7_UNORM);
+        GLsizei levelCount = (GLsizei)images[0].Levels.size();
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, format, TEXTURE_ARRAY_SIZE, TEXTURE_ARRAY_SIZE, (GLsizei)entries.size());
+        for (size_t layer = 0; layer < entries.size(); ++layer)
+        {
+            for (GLsizei level = 0; level < levelCount; ++level)
+            {
+                const Ktx2Level& entry = images[layer].Levels[level];
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)layer, entry.Width, entry.Height, 1, format,
+                    (GLsizei)entry.Size, contents[layer].data() + entry.Offset);
+            }
+        }
+        return true;
+    }
+
+    // decodes a layer's source image, flips it for OpenGL, resamples it to the array size and uploads it with a mip
+    // chain built like the 2D textures'. Leaves the placeholder when the source cannot be decoded
+    bool decodeLayer(GLuint layer)
+    {
+        int width, height, channels;
+        unsigned char* image = stbi_load(entries[layer].Source.c_str(), &width, &height, &channels, 4);
+        if (!image)
+            return false;
+        std::vector<uint8_t> pixels((size_t)width * height * 4);
+        prepareForUpload(image, width, height, 4, pixels.data(), Workers);
+        stbi_image_free(image);
+
+        MipLevel resampled = { 0, 0, std::vector<uint8_t>() };
+        resampleImage(pixels.data(), width, height, 4, TEXTURE_ARRAY_SIZE, TEXTURE_ARRAY_SIZE, resampled, MIP_FILTER_BOX, Workers);
+        std::vector<MipLevel> levels;
+        buildMipChain(resampled.Pixels, TEXTURE_ARRAY_SIZE, TEXTURE_ARRAY_SIZE, 4, levels, MIP_FILTER_BOX, Workers);
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, TextureArray);
+        for (size_t level = 0; level < levels.size() && level < (size_t)TEXTURE_ARRAY_LEVELS; ++level)
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, (GLint)layer, levels[level].Width, levels[level].Height, 1, GL_RGBA,
+                GL_UNSIGNED_BYTE, levels[level].Pixels.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return true;
+    }
+
+    // copies the stale textures into their layers again, with their mips
+    void updateStaleLayers()
+    {
+        GLuint framebuffers[2];
+        glGenFramebuffers(2, framebuffers);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+        for (size_t i = 0; i < staleTextures.size(); ++i)
+            UpdateLayer(staleTextures[i], layers[staleTextures[i]]);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(2, framebuffers);
+        staleTextures.clear();
+    }
+
+    // orders meshes so every (VAO, index type) group is contiguous
+    static bool groupOrder(const MeshRange& a, const MeshRange& b)
+    {
+        if (a.Vao != b.Vao)
+            return a.Vao < b.Vao;
+        if (a.IndexType != b.IndexType)
+            return a.IndexType < b.IndexType;
+        return a.Id < b.Id;
+    }
+
+    // the identity buffer holds 0..n-1 so the object index attribute equals gl_InstanceID + baseInstance
+    void growIdentityBuffer(size_t capacity)
+    {
+        std::vector<GLuint> identity(capacity);
+        for (size_t i = 0; i < capacity; ++i)
+            identity[i] = (GLuint)i;
+
+        glBindBuffer(GL_ARRAY_BUFFER, identityBuffer);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GLuint), identity.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        identityCapacity = capacity; // Attached VAOs reference the buffer by name, so they see the new store
+    }
+
+    // one command per mesh, grouped by VAO and index type, then each object placed in its mesh's instance range
+    void buildCommands(const RenderQueue& queue, RenderPass pass, bool withBounds)
+    {
+        objects.clear();
+        bounds.clear();
+        commands.clear();
+        groups.clear();
+        meshes.clear();
+        commandFill.clear();
+
+        const std::vector<DrawItem>& items = queue.Items();
+
+        // Count objects per mesh and collect the meshes in use
+        std::fill(meshCounts.begin(), meshCounts.end(), 0);
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if (RenderQueue::KeyPass(items[i].Key) != pass)
+                continue;
+            const MeshRange& mesh = queue.Command(items[i].Index).Mesh;
+            if (mesh.Id >= meshCounts.size())
+                meshCounts.resize(mesh.Id + 1, 0);
+            if (meshCounts[mesh.Id]++ == 0)
+                meshes.push_back(mesh);
+        }
+        std::sort(meshes.begin(), meshes.end(), groupOrder);
+
+        // Emit one command per mesh; each group is a run of commands sharing VAO and index type
+        meshCommand.resize(meshCounts.size());
+        GLuint baseInstance = 0;
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            const MeshRange& mesh = meshes[i];
+            if (groups.empty() || groups.back().Vao != mesh.Vao || groups.back().IndexType != mesh.IndexType)
+            {
+                IndirectGroup group = { mesh.Vao, mesh.IndexType, (GLuint)commands.size(), 0 };
+                groups.push_back(group);
+            }
+            ++groups.back().CommandCount;
+
+            DrawElementsIndirectCommand command = { (GLuint)mesh.IndexCount, meshCounts[mesh.Id], mesh.FirstIndex, mesh.BaseVertex, baseInstance };
+            meshCommand[mesh.Id] = (GLuint)commands.size();
+            commands.push_back(command);
+            commandFill.push_back(0);
+            baseInstance += meshCounts[mesh.Id];
+        }
+
+        // Scatter object data into each command's instance range
+        objects.resize(baseInstance);
+        if (withBounds)
+            bounds.resize(baseInstance);
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if (RenderQueue::KeyPass(items[i].Key) != pass)
+                continue;
+            const DrawCommand& draw = queue.Command(items[i].Index);
+            GLuint command = meshCommand[draw.Mesh.Id];
+
+            GLuint index = commands[command].BaseInstance + commandFill[command]++;
+            ObjectData& object = objects[index];
+            object.Model = draw.Model;
+            object.UVTransform = draw.UVTransform;
+            object.Layer = glm::vec4((float)Layer(draw.Texture), 0.0f, 0.0f, 0.0f);
+            if (withBounds)
+            {
+                ObjectBounds box = { draw.Bounds.Min, command, draw.Bounds.Max, 0 };
+                bounds[index] = box;
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,231 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "block_compression.h"
+
+// Vulkan format numbers KTX2 identifies block compressed data by
+const uint32_t KTX2_FORMAT_BC1_RGB_UNORM = 131;
+const uint32_t KTX2_FORMAT_BC1_RGB_SRGB = 132;
+const uint32_t KTX2_FORMAT_BC1_RGBA_UNORM = 133;
+const uint32_t KTX2_FORMAT_BC1_RGBA_SRGB = 134;
+const uint32_t KTX2_FORMAT_BC7_UNORM = 145;
+const uint32_t KTX2_FORMAT_BC7_SRGB = 146;
+
+// Sizes of the fixed parts of a file: identifier plus header, then the index of the data sections
+const size_t KTX2_HEADER_SIZE = 80;
+const size_t KTX2_LEVEL_ENTRY_SIZE = 24;
+
+const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// One mip level of a KTX2 image; Offset is from the start of the file
+struct Ktx2Level
+{
+    uint32_t Width, Height;
+    size_t Offset;
+    size_t Size;
+};
+
+// Layout of a single 2D, non-supercompressed KTX2 image. Level 0 is the largest
+struct Ktx2Image
+{
+    uint32_t VkFormat;
+    uint32_t Width, Height;
+    std::vector<Ktx2Level> Levels;
+};
+
+
+// GL internal format of a KTX2 block format, or 0 if the runtime does not upload it
+inline GLenum ktx2GlFormat(uint32_t vkFormat)
+{
+    switch (vkFormat)
+    {
+    case KTX2_FORMAT_BC1_RGB_UNORM: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case KTX2_FORMAT_BC1_RGB_SRGB: return GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+    case KTX2_FORMAT_BC1_RGBA_UNORM: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    case KTX2_FORMAT_BC7_UNORM: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    case KTX2_FORMAT_BC7_SRGB: return GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    default: return 0;
+    }
+}
+
+// true if a path names a KTX2 file
+inline bool isKtx2Path(const std::string& path)
+{
+    return path.size() > 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0;
+}
+
+inline uint32_t readLittle32(const uint8_t* data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+inline uint64_t readLittle64(const uint8_t* data)
+{
+    return (uint64_t)readLittle32(data) | ((uint64_t)readLittle32(data + 4) << 32);
+}
+
+inline void appendLittle32(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back((uint8_t)(value >> (8 * i)));
+}
+
+inline void appendLittle64(std::vector<uint8_t>& out, uint64_t value)
+{
+    appendLittle32(out, (uint32_t)value);
+    appendLittle32(out, (uint32_t)(value >> 32));
+}
+
+inline void writeLittle64(uint8_t* out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        out[i] = (uint8_t)(value >> (8 * i));
+}
+
+
+// reads the header and level index of an in-memory KTX2 file and checks every level lies inside it.
+// Only single 2D images without supercompression are accepted; the caller checks the format
+inline bool parseKtx2(const uint8_t* data, size_t size, Ktx2Image& image)
+{
+    if (size < KTX2_HEADER_SIZE || std::memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+        return false;
+
+    image.VkFormat = readLittle32(data + 12);
+    image.Width = readLittle32(data + 20);
+    image.Height = readLittle32(data + 24);
+    uint32_t depth = readLittle32(data + 28);
+    uint32_t layers = readLittle32(data + 32);
+    uint32_t faces = readLittle32(data + 36);
+    uint32_t levelCount = readLittle32(data + 40);
+    uint32_t supercompression = readLittle32(data + 44);
+    if (image.Width == 0 || image.Height == 0 || depth > 1 || layers > 1 || faces != 1 || supercompression != 0)
+        return false;
+
+    // A level count of 0 asks the loader to generate mipmaps; cooked files always carry their chain
+    if (levelCount == 0 || size < KTX2_HEADER_SIZE + levelCount * KTX2_LEVEL_ENTRY_SIZE)
+        return false;
+
+    image.Levels.resize(levelCount);
+    for (uint32_t level = 0; level < levelCount; ++level)
+    {
+        const uint8_t* entry = data + KTX2_HEADER_SIZE + level * KTX2_LEVEL_ENTRY_SIZE;
+        uint64_t offset = readLittle64(entry);
+        uint64_t length = readLittle64(entry + 8);
+        if (offset > size || length > size - offset)
+            return false;
+
+        Ktx2Level& info = image.Levels[level];
+        info.Width = image.Width >> level ? image.Width >> level : 1;
+        info.Height = image.Height >> level ? image.Height >> level : 1;
+        info.Offset = (size_t)offset;
+        info.Size = (size_t)length;
+    }
+    return true;
+}
+
+// reads a whole file into memory
+inline bool readFileBytes(const std::string& path, std::vector<uint8_t>& bytes)
+{
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    bytes.resize(size > 0 ? (size_t)size : 0);
+    bool read = size >= 0 && std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    std::fclose(file);
+    return read;
+}
+
+
+// writes block compressed mip levels, largest first, as a KTX2 file. The data format descriptor describes the
+// block format; the key/value data records that rows run bottom-up, as OpenGL uploads them
+inline bool writeKtx2(const std::string& path, BlockFormat format, uint32_t width, uint32_t height,
+    const std::vector<std::vector<uint8_t>>& levels)
+{
+    uint32_t levelCount = (uint32_t)levels.size();
+    bool bc1 = format == BLOCK_FORMAT_BC1;
+    uint32_t blockSize = (uint32_t)blockBytes(format);
+
+    // Basic data format descriptor with one sample covering the whole block
+    std::vector<uint8_t> dfd;
+    appendLittle32(dfd, 0);                             // Total size, patched below
+    appendLittle32(dfd, 0);                             // Khronos vendor, basic descriptor type
+    appendLittle32(dfd, 2 | (40u << 16));               // Version 2, block size 24 + 16 per sample
+    appendLittle32(dfd, (bc1 ? 128u : 134u) | (1u << 8) | (1u << 16)); // BC1A or BC7 model, BT.709 primaries, linear transfer
+    appendLittle32(dfd, 3 | (3u << 8));                 // 4x4 texel blocks, stored as dimension - 1
+    appendLittle32(dfd, blockSize);                     // Bytes in plane 0
+    appendLittle32(dfd, 0);
+    appendLittle32(dfd, ((blockSize * 8 - 1) << 16));   // Bit offset 0, bit length - 1, channel 0 (color)
+    appendLittle32(dfd, 0);                             // Sample position
+    appendLittle32(dfd, 0);                             // Sample lower
+    appendLittle32(dfd, 0xFFFFFFFFu);                   // Sample upper
+    uint32_t dfdSize = (uint32_t)dfd.size();
+    std::memcpy(dfd.data(), &dfdSize, 4);
+
+    // Key/value pairs sorted by key, each padded to 4 bytes
+    std::vector<uint8_t> kvd;
+    const char* pairs[2][2] = { { "KTXorientation", "ru" }, { "KTXwriter", "texture cooker" } };
+    for (int pair = 0; pair < 2; ++pair)
+    {
+        std::string entry = std::string(pairs[pair][0]) + '\0' + pairs[pair][1] + '\0';
+        appendLittle32(kvd, (uint32_t)entry.size());
+        kvd.insert(kvd.end(), entry.begin(), entry.end());
+        while (kvd.size() % 4)
+            kvd.push_back(0);
+    }
+
+    std::vector<uint8_t> file(KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+    appendLittle32(file, bc1 ? KTX2_FORMAT_BC1_RGB_UNORM : KTX2_FORMAT_BC7_UNORM);
+    appendLittle32(file, 1);                            // Type size of block compressed formats
+    appendLittle32(file, width);
+    appendLittle32(file, height);
+    appendLittle32(file, 0);                            // Depth
+    appendLittle32(file, 0);                            // Array layers
+    appendLittle32(file, 1);                            // Faces
+    appendLittle32(file, levelCount);
+    appendLittle32(file, 0);                            // No supercompression
+
+    uint32_t dfdOffset = (uint32_t)(KTX2_HEADER_SIZE + levelCount * KTX2_LEVEL_ENTRY_SIZE);
+    uint32_t kvdOffset = dfdOffset + dfdSize;
+    appendLittle32(file, dfdOffset);
+    appendLittle32(file, dfdSize);
+    appendLittle32(file, kvdOffset);
+    appendLittle32(file, (uint32_t)kvd.size());
+    appendLittle64(file, 0);                            // No supercompression global data
+    appendLittle64(file, 0);
+
+    size_t indexPosition = file.size();
+    file.resize(file.size() + levelCount * KTX2_LEVEL_ENTRY_SIZE, 0);
+    file.insert(file.end(), dfd.begin(), dfd.end());
+    file.insert(file.end(), kvd.begin(), kvd.end());
+
+    // Levels are stored smallest first, each aligned to the block size
+    for (uint32_t level = levelCount; level-- > 0;)
+    {
+        while (file.size() % blockSize)
+            file.push_back(0);
+        uint8_t* entry = file.data() + indexPosition + level * KTX2_LEVEL_ENTRY_SIZE;
+        writeLittle64(entry, file.size());
+        writeLittle64(entry + 8, levels[level].size());
+        writeLittle64(entry + 16, levels[level].size());
+        file.insert(file.end(), levels[level].begin(), levels[level].end());
+    }
+
+    FILE* out = std::fopen(path.c_str(), "wb");
+    if (!out)
+        return false;
+    bool written = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+    return std::fclose(out) == 0 && written;
+}
+#endif
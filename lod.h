@@ -0,0 +1,111 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <vector>
+
+#include "frustum.h"
+#include "geometry_arena.h"
+#include "mesh_builder.h"
+
+class PickMesh;
+
+// One detail level: a mesh and how far, in object units, its surface may deviate from the finest level
+struct LodLevel
+{
+    MeshRange Mesh;
+    float Error;
+    const PickMesh* Pick;   // CPU triangles of the same mesh for ray picking, null if the mesh is not pickable
+};
+
+// Detail levels of one renderable, finest first, plus the object-space bounds used to project and cull them
+struct LodChain
+{
+    std::vector<LodLevel> Levels;
+    glm::vec3 Center = glm::vec3(0.0f);
+    float Radius = 0.0f;
+    BoundingBox Bounds;
+};
+
+// Computes a bounding sphere around the bounding box center of some vertices
+inline void boundingSphere(const std::vector<Vertex>& vertices, glm::vec3& center, float& radius)
+{
+    BoundingBox box = boundingBox(vertices);
+    center = 0.5f * (box.Min + box.Max);
+    radius = 0.0f;
+    for (size_t i = 0; i < vertices.size(); ++i)
+        radius = glm::max(radius, glm::length(vertices[i].Position - center));
+}
+
+
+// Picks detail levels from the projected size of each object's bounding sphere.
+// A level is acceptable when its error, projected to the screen, stays under PixelError. Coarsening
+// additionally requires the error to be below PixelError * (1 - Hysteresis), so an object sitting on a
+// threshold does not flip between two levels every frame
+class LodSelector
+{
+public:
+    float PixelError = 1.0f;
+    float Hysteresis = 0.25f;
+
+    // perspective projection: pixels per world unit at distance 1 come from the vertical field of view
+    void SetPerspective(const glm::vec3& cameraPosition, float fovYRadians, float viewportHeight)
+    {
+        camera = cameraPosition;
+        perspective = true;
+        pixelsPerUnit = 0.5f * viewportHeight / std::tan(0.5f * fovYRadians);
+    }
+
+    // orthographic projection: pixels per world unit are the same at every distance
+    void SetOrthographic(const glm::vec3& cameraPosition, float viewHeight, float viewportHeight)
+    {
+        camera = cameraPosition;
+        perspective = false;
+        pixelsPerUnit = viewportHeight / viewHeight;
+    }
+
+    // radius in pixels of a chain's bounding sphere placed with model
+    float ProjectedRadius(const LodChain& chain, const glm::mat4& model) const
+    {
+        glm::vec3 center = glm::vec3(model * glm::vec4(chain.Center, 1.0f));
+        float radius = chain.Radius * maxAxisScale(model);
+        if (!perspective)
+            return radius * pixelsPerUnit;
+
+        // Inside the sphere the object can cover the whole screen; treat it as arbitrarily large
+        float distance = glm::length(center - camera) - radius;
+        if (distance <= 0.0f)
+            return 1e30f;
+        return radius * pixelsPerUnit / distance;
+    }
+
+    // returns the coarsest acceptable level, starting from the level used last frame
+    unsigned Select(const LodChain& chain, const glm::mat4& model, unsigned current) const
+    {
+        unsigned count = (unsigned)chain.Levels.size();
+        if (count <= 1 || chain.Radius <= 0.0f)
+            return 0;
+        if (current >= count)
+            current = count - 1;
+
+        // Errors are relative to the sphere, so projected error = error / radius * projected radius
+        float pixelsPerError = ProjectedRadius(chain, model) / chain.Radius;
+
+        for (unsigned level = count - 1; level > 0; --level)
+        {
+            float limit = level > current ? PixelError * (1.0f - Hysteresis) : PixelError;
+            if (chain.Levels[level].Error * pixelsPerError <= limit)
+                return level;
+        }
+        return 0;
+    }
+
+private:
+    glm::vec3 camera = glm::vec3(0.0f);
+    bool perspective = true;
+    float pixelsPerUnit = 1.0f;
+};
+#endif
@@ -0,0 +1,263 @@
+#ifndef MESH_BUILDER_H
+#define MESH_BUILDER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Interleaved vertex layout shared by every mesh: position, normal, texture coordinate (8 floats)
+struct Vertex
+{
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoord;
+};
+
+const GLuint FLOATS_PER_VERTEX = 8;
+
+
+// Builds an indexed triangle list, welding vertices whose position, normal and texture coordinate are identical
+class MeshBuilder
+{
+public:
+    std::vector<Vertex> Vertices;
+    std::vector<GLuint> Indices;
+
+    // returns the index of an identical existing vertex, or appends the vertex and returns its new index
+    GLuint AddVertex(const Vertex& vertex)
+    {
+        VertexKey key = makeKey(vertex);
+        std::pair<std::unordered_map<VertexKey, GLuint, VertexKeyHash>::iterator, bool> result =
+            lookup.insert(std::make_pair(key, (GLuint)Vertices.size()));
+        if (result.second)
+            Vertices.push_back(vertex);
+        return result.first->second;
+    }
+
+    // appends one triangle
+    void AddTriangle(const Vertex& a, const Vertex& b, const Vertex& c)
+    {
+        Indices.push_back(AddVertex(a));
+        Indices.push_back(AddVertex(b));
+        Indices.push_back(AddVertex(c));
+    }
+
+    // appends the triangles of a Wavefront OBJ file. Polygons are fan-triangulated; groups and materials are ignored
+    bool LoadObj(const char* filename)
+    {
+        std::ifstream file(filename);
+        if (!file)
+            return false;
+
+        std::vector<glm::vec3> positions;
+        std::vector<glm::vec3> normals;
+        std::vector<glm::vec2> texCoords;
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            std::istringstream stream(line);
+            std::string type;
+            stream >> type;
+
+            if (type == "v")
+            {
+                glm::vec3 p;
+                stream >> p.x >> p.y >> p.z;
+                positions.push_back(p);
+            }
+            else if (type == "vn")
+            {
+                glm::vec3 n;
+                stream >> n.x >> n.y >> n.z;
+                normals.push_back(n);
+            }
+            else if (type == "vt")
+            {
+                glm::vec2 t;
+                stream >> t.x >> t.y;
+                texCoords.push_back(t);
+            }
+            else if (type == "f")
+            {
+                std::vector<Vertex> face;
+                std::vector<bool> hasNormal;
+                std::string corner;
+                while (stream >> corner)
+                {
+                    // Corners are v, v/vt, v//vn or v/vt/vn; negative indices count back from the end
+                    int index[3] = { 0, 0, 0 };
+                    const char* cursor = corner.c_str();
+                    for (int k = 0; k < 3 && *cursor; ++k)
+                    {
+                        if (*cursor != '/')
+                            index[k] = std::atoi(cursor);
+                        while (*cursor && *cursor != '/')
+                            ++cursor;
+                        if (*cursor == '/')
+                            ++cursor;
+                    }
+
+                    Vertex vertex = {};
+                    int p = resolveObjIndex(index[0], positions.size());
+                    int t = resolveObjIndex(index[1], texCoords.size());
+                    int n = resolveObjIndex(index[2], normals.size());
+                    if (p < 0)
+                        return false;
+                    vertex.Position = positions[p];
+                    if (t >= 0)
+                        vertex.TexCoord = texCoords[t];
+                    if (n >= 0)
+                        vertex.Normal = normals[n];
+                    face.push_back(vertex);
+                    hasNormal.push_back(n >= 0);
+                }
+
+                for (size_t i = 1; i + 1 < face.size(); ++i)
+                {
+                    Vertex a = face[0], b = face[i], c = face[i + 1];
+
+                    // Corners without a normal use the flat normal of their triangle
+                    glm::vec3 flat = glm::cross(b.Position - a.Position, c.Position - a.Position);
+                    float flatLength = glm::length(flat);
+                    if (flatLength > 0.0f)
+                        flat /= flatLength;
+                    if (!hasNormal[0]) a.Normal = flat;
+                    if (!hasNormal[i]) b.Normal = flat;
+                    if (!hasNormal[i + 1]) c.Normal = flat;
+
+                    AddTriangle(a, b, c);
+                }
+            }
+        }
+        return true;
+    }
+
+    // writes the mesh as a Wavefront OBJ file with one v/vt/vn per vertex
+    bool SaveObj(const char* filename) const
+    {
+        std::ofstream file(filename);
+        if (!file)
+            return false;
+
+        file.precision(9);
+        for (size_t i = 0; i < Vertices.size(); ++i)
+            file << "v " << Vertices[i].Position.x << ' ' << Vertices[i].Position.y << ' ' << Vertices[i].Position.z << '\n';
+        for (size_t i = 0; i < Vertices.size(); ++i)
+            file << "vt " << Vertices[i].TexCoord.x << ' ' << Vertices[i].TexCoord.y << '\n';
+        for (size_t i = 0; i < Vertices.size(); ++i)
+            file << "vn " << Vertices[i].Normal.x << ' ' << Vertices[i].Normal.y << ' ' << Vertices[i].Normal.z << '\n';
+
+        for (size_t i = 0; i + 2 < Indices.size(); i += 3)
+        {
+            file << 'f';
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint index = Indices[i + k] + 1;
+                file << ' ' << index << '/' << index << '/' << index;
+            }
+            file << '\n';
+        }
+        return (bool)file;
+    }
+
+    // smallest index type able to address every vertex
+    GLenum IndexType() const
+    {
+        return Vertices.size() <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    // size in bytes of one index of IndexType()
+    GLsizei IndexSize() const
+    {
+        return IndexType() == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    }
+
+    // copies the indices into a byte buffer using IndexType()
+    std::vector<unsigned char> PackIndices() const
+    {
+        std::vector<unsigned char> packed(Indices.size() * IndexSize());
+        if (IndexType() == GL_UNSIGNED_SHORT)
+        {
+            GLushort* out = (GLushort*)packed.data();
+            for (size_t i = 0; i < Indices.size(); ++i)
+                out[i] = (GLushort)Indices[i];
+        }
+        else if (!Indices.empty())
+        {
+            std::memcpy(packed.data(), Indices.data(), packed.size());
+        }
+        return packed;
+    }
+
+    // forgets all geometry so the builder can be reused
+    void Clear()
+    {
+        Vertices.clear();
+        Indices.clear();
+        lookup.clear();
+    }
+
+private:
+    // Bit pattern of the 8 vertex floats, so welding is exact and never merges distinct attributes
+    struct VertexKey
+    {
+        uint32_t Bits[FLOATS_PER_VERTEX];
+
+        bool operator==(const VertexKey& other) const
+        {
+            return std::memcmp(Bits, other.Bits, sizeof(Bits)) == 0;
+        }
+    };
+
+    // FNV-1a over the key bits
+    struct VertexKeyHash
+    {
+        size_t operator()(const VertexKey& key) const
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for (GLuint i = 0; i < FLOATS_PER_VERTEX; ++i)
+            {
+                hash ^= key.Bits[i];
+                hash *= 1099511628211ull;
+            }
+            return (size_t)hash;
+        }
+    };
+
+    std::unordered_map<VertexKey, GLuint, VertexKeyHash> lookup;
+
+    // converts a 1-based (or negative, relative) OBJ index to a 0-based one, -1 if absent or out of range
+    static int resolveObjIndex(int index, size_t count)
+    {
+        int resolved = index > 0 ? index - 1 : (index < 0 ? (int)count + index : -1);
+        return resolved >= 0 && resolved < (int)count ? resolved : -1;
+    }
+
+    static VertexKey makeKey(const Vertex& vertex)
+    {
+        const GLfloat values[FLOATS_PER_VERTEX] = {
+            vertex.Position.x, vertex.Position.y, vertex.Position.z,
+            vertex.Normal.x, vertex.Normal.y, vertex.Normal.z,
+            vertex.TexCoord.x, vertex.TexCoord.y
+        };
+
+        VertexKey key;
+        for (GLuint i = 0; i < FLOATS_PER_VERTEX; ++i)
+        {
+            // -0.0 and 0.0 compare equal but differ in bits; the hand-typed arrays use both
+            GLfloat value = values[i] == 0.0f ? 0.0f : values[i];
+            std::memcpy(&key.Bits[i], &value, sizeof(GLfloat));
+        }
+        return key;
+    }
+};
+#endif
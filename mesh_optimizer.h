@@ -0,0 +1,401 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "mesh_builder.h"
+
+// Post-transform cache size assumed when measuring; matches the FIFO depth of most desktop GPUs
+const GLuint VERTEX_CACHE_SIZE = 16;
+
+// Vertex cache efficiency of an index buffer
+struct VertexCacheStats
+{
+    float Acmr; // Average cache miss ratio: transformed vertices per triangle (0.5 is ideal, 3 is worst)
+    float Atvr; // Average transformed vertex ratio: transformed vertices per unique vertex (1 is ideal)
+};
+
+// Cache efficiency before and after optimizeMesh
+struct MeshOptimizationStats
+{
+    VertexCacheStats Before;
+    VertexCacheStats After;
+};
+
+
+// simulates a FIFO post-transform cache over the index buffer
+inline VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount, GLuint cacheSize = VERTEX_CACHE_SIZE)
+{
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    // A vertex is cached while fewer than cacheSize misses happened since it was last transformed
+    std::vector<size_t> timestamps(vertexCount, 0);
+    size_t time = cacheSize + 1;
+    size_t misses = 0;
+
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        GLuint v = indices[i];
+        if (time - timestamps[v] > cacheSize)
+        {
+            timestamps[v] = time++;
+            ++misses;
+        }
+    }
+
+    stats.Acmr = (float)misses / (float)(indices.size() / 3);
+    stats.Atvr = (float)misses / (float)vertexCount;
+    return stats;
+}
+
+
+// Cache depth modelled by the Forsyth scoring function
+const int FORSYTH_CACHE_SIZE = 32;
+
+// Forsyth score of a vertex from its cache position (-1 if not cached) and its number of unemitted triangles
+inline float forsythVertexScore(int cachePosition, int remaining)
+{
+    const float CACHE_DECAY_POWER = 1.5f;
+    const float LAST_TRIANGLE_SCORE = 0.75f;
+    const float VALENCE_BOOST_SCALE = 2.0f;
+    const float VALENCE_BOOST_POWER = 0.5f;
+
+    if (remaining == 0)
+        return -1.0f;
+
+    float result = 0.0f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+            result = LAST_TRIANGLE_SCORE; // Vertices of the last triangle get a fixed score so it is not reused directly
+        else
+        {
+            float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            result = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+        }
+    }
+
+    // Boost vertices with few triangles left so they are finished and leave the working set
+    result += VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER);
+    return result;
+}
+
+
+// Reorders triangles for the post-transform cache using Tom Forsyth's linear-speed greedy scoring
+inline void optimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount)
+{
+    const int MAX_CACHE = FORSYTH_CACHE_SIZE;
+
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Vertex -> triangle adjacency in CSR form
+    std::vector<GLuint> offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < indices.size(); ++i)
+        ++offsets[indices[i] + 1];
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<GLuint> adjacency(indices.size());
+    std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; ++t)
+        for (int k = 0; k < 3; ++k)
+            adjacency[fill[indices[t * 3 + k]]++] = (GLuint)t;
+
+    std::vector<int> remaining(vertexCount);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+    {
+        remaining[v] = (int)(offsets[v + 1] - offsets[v]);
+        vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+    }
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<char> emitted(triangleCount, 0);
+    for (size_t t = 0; t < triangleCount; ++t)
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+
+    std::vector<GLuint> cache;
+    cache.reserve(MAX_CACHE + 3);
+    size_t scanStart = 0;
+    long bestTriangle = -1;
+
+    for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+    {
+        // No candidate from the cache neighbourhood; fall back to a scan over unemitted triangles
+        if (bestTriangle < 0)
+        {
+            float bestScore = -1.0f;
+            while (scanStart < triangleCount && emitted[scanStart])
+                ++scanStart;
+            for (size_t t = scanStart; t < triangleCount; ++t)
+            {
+                if (!emitted[t] && triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    bestTriangle = (long)t;
+                }
+            }
+        }
+
+        size_t t = (size_t)bestTriangle;
+        emitted[t] = 1;
+
+        // Emit the triangle and move its vertices to the front of the cache
+        std::vector<GLuint> newCache;
+        newCache.reserve(MAX_CACHE + 3);
+        for (int k = 0; k < 3; ++k)
+        {
+            GLuint v = indices[t * 3 + k];
+            result.push_back(v);
+            newCache.push_back(v);
+
+            // Drop the triangle from the vertex's adjacency list
+            GLuint* begin = &adjacency[offsets[v]];
+            GLuint* end = begin + remaining[v];
+            GLuint* found = std::find(begin, end, (GLuint)t);
+            std::swap(*found, *(end - 1));
+            --remaining[v];
+        }
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            GLuint v = cache[i];
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+                newCache.push_back(v);
+        }
+        cache.swap(newCache);
+
+        // Vertices pushed out of the cache lose their position bonus
+        for (size_t i = MAX_CACHE; i < cache.size(); ++i)
+        {
+            GLuint v = cache[i];
+            vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+        }
+        if (cache.size() > (size_t)MAX_CACHE)
+            cache.resize(MAX_CACHE);
+
+        // Rescore cached vertices and their triangles, tracking the best candidate for the next step
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            GLuint v = cache[i];
+            vertexScore[v] = forsythVertexScore((int)i, remaining[v]);
+        }
+
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cache.size(); ++i)
+        {
+            GLuint v = cache[i];
+            for (int a = 0; a < remaining[v]; ++a)
+            {
+                GLuint neighbour = adjacency[offsets[v] + a];
+                float score = vertexScore[indices[neighbour * 3]] + vertexScore[indices[neighbour * 3 + 1]] + vertexScore[indices[neighbour * 3 + 2]];
+                triangleScore[neighbour] = score;
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = (long)neighbour;
+                }
+            }
+        }
+    }
+
+    indices.swap(result);
+}
+
+
+// Reorders clusters of a cache-optimized index buffer so outward-facing clusters are drawn first,
+// reducing overdraw while keeping ACMR within threshold times the cache-optimized value (Tipsify style)
+inline void optimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    // Hard boundaries: triangles whose three vertices all miss the cache start a new cluster for free
+    std::vector<size_t> clusterStarts;
+    {
+        std::vector<size_t> timestamps(vertices.size(), 0);
+        size_t time = VERTEX_CACHE_SIZE + 1;
+        for (size_t t = 0; t < triangleCount; ++t)
+        {
+            int misses = 0;
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint v = indices[t * 3 + k];
+                if (time - timestamps[v] > VERTEX_CACHE_SIZE)
+                {
+                    timestamps[v] = time++;
+                    ++misses;
+                }
+            }
+            if (t == 0 || misses == 3)
+                clusterStarts.push_back(t);
+        }
+        clusterStarts.push_back(triangleCount);
+    }
+
+    // Soft boundaries: split a hard cluster wherever the running ACMR of the piece stays within the threshold.
+    // One FIFO simulation serves every cluster: advancing time past the cache size empties it, like a fresh cache
+    std::vector<size_t> splits;
+    std::vector<size_t> timestamps(vertices.size(), 0);
+    size_t time = VERTEX_CACHE_SIZE + 1;
+    for (size_t c = 0; c + 1 < clusterStarts.size(); ++c)
+    {
+        size_t begin = clusterStarts[c];
+        size_t end = clusterStarts[c + 1];
+
+        size_t clusterMisses = 0;
+        for (size_t i = begin * 3; i < end * 3; ++i)
+        {
+            GLuint v = indices[i];
+            if (time - timestamps[v] > VERTEX_CACHE_SIZE)
+            {
+                timestamps[v] = time++;
+                ++clusterMisses;
+            }
+        }
+        float clusterAcmr = (float)clusterMisses / (end - begin);
+        time += VERTEX_CACHE_SIZE + 1;
+
+        size_t misses = 0;
+        size_t pieceStart = begin;
+        splits.push_back(begin);
+
+        for (size_t t = begin; t < end; ++t)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint v = indices[t * 3 + k];
+                if (time - timestamps[v] > VERTEX_CACHE_SIZE)
+                {
+                    timestamps[v] = time++;
+                    ++misses;
+                }
+            }
+
+            size_t pieceTriangles = t + 1 - pieceStart;
+            if (t + 1 < end && pieceTriangles >= 8 && (float)misses / pieceTriangles <= threshold * clusterAcmr)
+            {
+                // Restart the simulated cache as the GPU would after an unrelated cluster
+                splits.push_back(t + 1);
+                pieceStart = t + 1;
+                misses = 0;
+                time += VERTEX_CACHE_SIZE + 1;
+            }
+        }
+        time += VERTEX_CACHE_SIZE + 1;
+    }
+    splits.push_back(triangleCount);
+
+    // Mesh centroid weighted by triangle area
+    glm::vec3 meshCentroid(0.0f);
+    float meshArea = 0.0f;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        const glm::vec3& a = vertices[indices[t * 3]].Position;
+        const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+        const glm::vec3& c = vertices[indices[t * 3 + 2]].Position;
+        float area = glm::length(glm::cross(b - a, c - a));
+        meshCentroid += (a + b + c) * (area / 3.0f);
+        meshArea += area;
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // Clusters facing away from the centroid occlude the rest, so they sort first
+    struct Cluster
+    {
+        size_t Begin;
+        size_t End;
+        float Sort;
+    };
+    std::vector<Cluster> clusters;
+    for (size_t c = 0; c + 1 < splits.size(); ++c)
+    {
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = splits[c]; t < splits[c + 1]; ++t)
+        {
+            const glm::vec3& a = vertices[indices[t * 3]].Position;
+            const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3& cc = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 n = glm::cross(b - a, cc - a); // Length is twice the area
+            float triangleArea = glm::length(n);
+            centroid += (a + b + cc) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        float normalLength = glm::length(normal);
+        if (normalLength > 0.0f)
+            normal /= normalLength;
+
+        Cluster cluster = { splits[c], splits[c + 1], glm::dot(centroid - meshCentroid, normal) };
+        clusters.push_back(cluster);
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.Sort > b.Sort; });
+
+    std::vector<GLuint> result;
+    result.reserve(indices.size());
+    for (size_t c = 0; c < clusters.size(); ++c)
+        result.insert(result.end(), indices.begin() + clusters[c].Begin * 3, indices.begin() + clusters[c].End * 3);
+
+    // Cluster seams cost extra misses; keep the cache order if the new order breaks the threshold overall
+    float inputAcmr = analyzeVertexCache(indices, vertices.size()).Acmr;
+    if (analyzeVertexCache(result, vertices.size()).Acmr <= threshold * inputAcmr)
+        indices.swap(result);
+}
+
+
+// Renumbers vertices in order of first use so vertex fetch walks memory linearly. Unused vertices are dropped
+inline void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+{
+    const GLuint UNUSED = ~0u;
+    std::vector<GLuint> remap(vertices.size(), UNUSED);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        GLuint& v = indices[i];
+        if (remap[v] == UNUSED)
+        {
+            remap[v] = (GLuint)result.size();
+            result.push_back(vertices[v]);
+        }
+        v = remap[v];
+    }
+
+    vertices.swap(result);
+}
+
+
+// Runs the full optimization pipeline on a built mesh: cache order, overdraw order, then fetch order
+inline MeshOptimizationStats optimizeMesh(std::vector<Vertex>& vertices, std::vector<GLuint>& indices)
+{
+    MeshOptimizationStats stats;
+    stats.Before = analyzeVertexCache(indices, vertices.size());
+
+    optimizeVertexCache(indices, vertices.size());
+    optimizeOverdraw(indices, vertices);
+    optimizeVertexFetch(vertices, indices);
+
+    stats.After = analyzeVertexCache(indices, vertices.size());
+    return stats;
+}
+#endif
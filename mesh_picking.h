@@ -0,0 +1,107 @@
+#ifndef MESH_PICKING_H
+#define MESH_PICKING_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_builder.h"
+#include "scene_bvh.h"
+
+// Closest triangle a ray hit, with barycentric coordinates of the hit point (weights of the second and third corner)
+struct PickHit
+{
+    uint32_t Triangle;
+    float Distance;
+    float U, V;
+};
+
+
+// Möller-Trumbore ray/triangle intersection, double sided. Returns the ray parameter of the hit,
+// or a negative value on a miss. Distances are in units of the direction's length
+inline float rayTriangleDistance(const glm::vec3& origin, const glm::vec3& direction,
+    const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float& u, float& v)
+{
+    glm::vec3 edge1 = b - a;
+    glm::vec3 edge2 = c - a;
+    glm::vec3 p = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, p);
+
+    // Parallel to the triangle's plane, relative to the edge and direction lengths
+    float scale = glm::length(edge1) * glm::length(p);
+    if (std::fabs(determinant) <= 1e-7f * scale || scale == 0.0f)
+        return -1.0f;
+
+    float inverse = 1.0f / determinant;
+    glm::vec3 toOrigin = origin - a;
+    u = glm::dot(toOrigin, p) * inverse;
+    if (u < 0.0f || u > 1.0f)
+        return -1.0f;
+
+    glm::vec3 q = glm::cross(toOrigin, edge1);
+    v = glm::dot(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+
+    return glm::dot(edge2, q) * inverse;
+}
+
+
+// CPU copy of a mesh's positions and triangles with a hierarchy over the triangles, for exact ray queries.
+// GPU buffers only hold the (possibly quantized) draw data, so picking keeps its own float positions
+class PickMesh
+{
+public:
+    void Build(const std::vector<Vertex>& vertices, const std::vector<GLuint>& meshIndices)
+    {
+        positions.resize(vertices.size());
+        for (size_t i = 0; i < vertices.size(); ++i)
+            positions[i] = vertices[i].Position;
+        indices = meshIndices;
+
+        std::vector<BoundingBox> boxes(indices.size() / 3);
+        for (size_t t = 0; t < boxes.size(); ++t)
+        {
+            const glm::vec3& a = positions[indices[t * 3]];
+            const glm::vec3& b = positions[indices[t * 3 + 1]];
+            const glm::vec3& c = positions[indices[t * 3 + 2]];
+            boxes[t].Min = glm::min(a, glm::min(b, c));
+            boxes[t].Max = glm::max(a, glm::max(b, c));
+        }
+        triangles.Build(boxes);
+    }
+
+    size_t TriangleCount() const { return indices.size() / 3; }
+    const std::vector<glm::vec3>& Positions() const { return positions; }
+    const std::vector<GLuint>& Indices() const { return indices; }
+
+    // closest triangle along a ray in object space. The direction need not be normalized; distances are
+    // ray parameters, so a world ray transformed by the inverse model matrix keeps its world distances
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, PickHit& hit) const
+    {
+        RayHit closest;
+        bool found = triangles.Raycast(origin, direction, maxDistance, [&](uint32_t triangle, float) {
+            float u, v;
+            return rayTriangleDistance(origin, direction, positions[indices[triangle * 3]],
+                positions[indices[triangle * 3 + 1]], positions[indices[triangle * 3 + 2]], u, v);
+        }, closest);
+        if (!found)
+            return false;
+
+        // Barycentrics of the winning triangle only
+        rayTriangleDistance(origin, direction, positions[indices[closest.Item * 3]], positions[indices[closest.Item * 3 + 1]],
+            positions[indices[closest.Item * 3 + 2]], hit.U, hit.V);
+        hit.Triangle = closest.Item;
+        hit.Distance = closest.Distance;
+        return true;
+    }
+
+private:
+    std::vector<glm::vec3> positions;
+    std::vector<GLuint> indices;
+    SceneBvh triangles;
+};
+#endif
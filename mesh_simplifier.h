@@ -0,0 +1,442 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "mesh_builder.h"
+
+// Tuning of simplifyMesh. Attribute weights scale the squared normal and texture coordinate change of a
+// collapse against the squared position error relative to the mesh size
+struct SimplifyOptions
+{
+    float NormalWeight = 0.25f;
+    float TexCoordWeight = 1.0f;
+    float BorderWeight = 10.0f;     // Strength of the planes that keep open borders in place
+    float MaxError = 1e30f;         // Stop early once a collapse would move the surface further than this (object units)
+    float MinFlipCosine = 0.2f;     // Reject collapses that turn a triangle's normal further than this
+};
+
+// One level of a simplified chain: triangle indices into the source vertices and the error reached
+struct SimplifiedLevel
+{
+    std::vector<GLuint> Indices;
+    float Error;    // Largest RMS distance from the original surface introduced so far, in object units
+};
+
+
+// Symmetric 4x4 error quadric, sum of weighted squared distances to planes, stored in double for stability
+struct Quadric
+{
+    double A00, A01, A02, A11, A12, A22; // n n^T
+    double B0, B1, B2;                  // n d
+    double C;                           // d^2
+    double Weight;
+
+    static Quadric FromPlane(const glm::dvec3& n, double d, double weight)
+    {
+        Quadric q;
+        q.A00 = weight * n.x * n.x; q.A01 = weight * n.x * n.y; q.A02 = weight * n.x * n.z;
+        q.A11 = weight * n.y * n.y; q.A12 = weight * n.y * n.z; q.A22 = weight * n.z * n.z;
+        q.B0 = weight * n.x * d; q.B1 = weight * n.y * d; q.B2 = weight * n.z * d;
+        q.C = weight * d * d;
+        q.Weight = weight;
+        return q;
+    }
+
+    void Add(const Quadric& q)
+    {
+        A00 += q.A00; A01 += q.A01; A02 += q.A02; A11 += q.A11; A12 += q.A12; A22 += q.A22;
+        B0 += q.B0; B1 += q.B1; B2 += q.B2;
+        C += q.C;
+        Weight += q.Weight;
+    }
+
+    // weighted sum of squared plane distances of p
+    double Evaluate(const glm::dvec3& p) const
+    {
+        double result = A00 * p.x * p.x + A11 * p.y * p.y + A22 * p.z * p.z
+            + 2.0 * (A01 * p.x * p.y + A02 * p.x * p.z + A12 * p.y * p.z)
+            + 2.0 * (B0 * p.x + B1 * p.y + B2 * p.z) + C;
+        return result > 0.0 ? result : 0.0;
+    }
+};
+
+
+// Reduces a triangle list by half-edge collapses ordered by quadric error, until at most targetIndexCount indices
+// remain or the next collapse would exceed options.MaxError. Vertices only ever collapse onto existing vertices,
+// so the result indexes the same vertex array.
+// Topology works on positions: vertices sharing a position are wedges of one point, differing in normal or texture
+// coordinate. A collapse must map every wedge of the removed point onto a wedge of the kept one along the collapsed
+// edge, which keeps attribute seams intact; border points only slide along their border. Returns the error reached
+inline float simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, size_t targetIndexCount,
+    std::vector<GLuint>& result, const SimplifyOptions& options = SimplifyOptions())
+{
+    result = indices;
+    const size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0 || indices.size() <= targetIndexCount)
+        return 0.0f;
+
+    // Points: vertices welded by exact position bits
+    std::vector<GLuint> pointOf(vertices.size());
+    std::vector<GLuint> pointVertex;    // Representative vertex of each point
+    {
+        struct PositionHash
+        {
+            size_t operator()(const glm::vec3& p) const
+            {
+                uint32_t bits[3];
+                std::memcpy(bits, &p, sizeof(bits));
+                return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+            }
+        };
+        std::unordered_map<glm::vec3, GLuint, PositionHash> lookup;
+        for (size_t i = 0; i < vertices.size(); ++i)
+        {
+            std::pair<std::unordered_map<glm::vec3, GLuint, PositionHash>::iterator, bool> inserted =
+                lookup.insert(std::make_pair(vertices[i].Position, (GLuint)pointVertex.size()));
+            if (inserted.second)
+                pointVertex.push_back((GLuint)i);
+            pointOf[i] = inserted.first->second;
+        }
+    }
+    const size_t pointCount = pointVertex.size();
+
+    glm::vec3 boundsMin = vertices[pointVertex[0]].Position, boundsMax = boundsMin;
+    for (size_t p = 1; p < pointCount; ++p)
+    {
+        boundsMin = glm::min(boundsMin, vertices[pointVertex[p]].Position);
+        boundsMax = glm::max(boundsMax, vertices[pointVertex[p]].Position);
+    }
+    float extent = glm::length(boundsMax - boundsMin);
+    double positionScale = extent > 0.0f ? 1.0 / ((double)extent * extent) : 1.0;
+
+    // Triangles per point
+    std::vector<std::vector<uint32_t>> pointTriangles(pointCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+        for (int k = 0; k < 3; ++k)
+            pointTriangles[pointOf[indices[t * 3 + k]]].push_back((uint32_t)t);
+
+    std::vector<bool> alive(triangleCount, true);
+    size_t aliveCount = triangleCount;
+    std::vector<GLuint>& tri = result; // Vertex (wedge) indices, rewritten as collapses happen
+
+    auto position = [&](GLuint point) { return glm::dvec3(vertices[pointVertex[point]].Position); };
+
+    // Number of live triangles containing both points
+    auto sharedTriangles = [&](GLuint a, GLuint b) {
+        int count = 0;
+        for (size_t i = 0; i < pointTriangles[a].size(); ++i)
+        {
+            uint32_t t = pointTriangles[a][i];
+            if (!alive[t])
+                continue;
+            for (int k = 0; k < 3; ++k)
+                if (pointOf[tri[t * 3 + k]] == b) { ++count; break; }
+        }
+        return count;
+    };
+
+    // Face quadrics, area weighted; border edges add a perpendicular plane so open borders keep their shape
+    std::vector<Quadric> quadrics(pointCount, Quadric());
+    std::vector<bool> border(pointCount, false);
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        GLuint p[3] = { pointOf[indices[t * 3]], pointOf[indices[t * 3 + 1]], pointOf[indices[t * 3 + 2]] };
+        glm::dvec3 a = position(p[0]), b = position(p[1]), c = position(p[2]);
+        glm::dvec3 n = glm::cross(b - a, c - a);
+        double area2 = glm::length(n);
+        if (area2 <= 0.0)
+            continue;
+        n /= area2;
+
+        Quadric face = Quadric::FromPlane(n, -glm::dot(n, a), area2 * 0.5);
+        for (int k = 0; k < 3; ++k)
+            quadrics[p[k]].Add(face);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            GLuint e0 = p[k], e1 = p[(k + 1) % 3];
+            if (sharedTriangles(e0, e1) != 1)
+                continue;
+            glm::dvec3 edge = position(e1) - position(e0);
+            glm::dvec3 m = glm::cross(edge, n);
+            double length = glm::length(m);
+            if (length <= 0.0)
+                continue;
+            m /= length;
+            Quadric plane = Quadric::FromPlane(m, -glm::dot(m, position(e0)), options.BorderWeight * glm::dot(edge, edge));
+            quadrics[e0].Add(plane);
+            quadrics[e1].Add(plane);
+            border[e0] = border[e1] = true;
+        }
+    }
+
+    // Wedge substitution produced by a collapse candidate
+    std::vector<std::pair<GLuint, GLuint>> wedgeMap;
+    auto mappedWedge = [&](GLuint wedge) -> GLuint {
+        for (size_t i = 0; i < wedgeMap.size(); ++i)
+            if (wedgeMap[i].first == wedge)
+                return wedgeMap[i].second;
+        return ~0u;
+    };
+
+    // Cost of collapsing point u onto point v, or a negative value if the collapse is not allowed. Fills wedgeMap
+    auto evaluate = [&](GLuint u, GLuint v, double& positionError) -> double {
+        if (border[u] && sharedTriangles(u, v) != 1)
+            return -1.0;
+
+        // Wedge mapping from the triangles on the collapsed edge; it must be a function
+        wedgeMap.clear();
+        for (size_t i = 0; i < pointTriangles[u].size(); ++i)
+        {
+            uint32_t t = pointTriangles[u][i];
+            if (!alive[t])
+                continue;
+            GLuint wu = ~0u, wv = ~0u;
+            for (int k = 0; k < 3; ++k)
+            {
+                if (pointOf[tri[t * 3 + k]] == u) wu = tri[t * 3 + k];
+                if (pointOf[tri[t * 3 + k]] == v) wv = tri[t * 3 + k];
+            }
+            if (wv == ~0u)
+                continue;
+            GLuint existing = mappedWedge(wu);
+            if (existing == ~0u)
+                wedgeMap.push_back(std::make_pair(wu, wv));
+            else if (existing != wv)
+                return -1.0;
+        }
+        if (wedgeMap.empty())
+            return -1.0;
+
+        // Every wedge of u must survive, and no remaining triangle may fold over
+        glm::dvec3 target = position(v);
+        for (size_t i = 0; i < pointTriangles[u].size(); ++i)
+        {
+            uint32_t t = pointTriangles[u][i];
+            if (!alive[t])
+                continue;
+
+            glm::dvec3 before[3], after[3];
+            bool hasV = false;
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint point = pointOf[tri[t * 3 + k]];
+                before[k] = after[k] = position(point);
+                if (point == u)
+                {
+                    if (mappedWedge(tri[t * 3 + k]) == ~0u)
+                        return -1.0;
+                    after[k] = target;
+                }
+                hasV = hasV || point == v;
+            }
+            if (hasV)
+                continue;
+
+            glm::dvec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::dvec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+            double l0 = glm::length(n0), l1 = glm::length(n1);
+            if (l1 <= 0.0 || (l0 > 0.0 && glm::dot(n0, n1) < options.MinFlipCosine * l0 * l1))
+                return -1.0;
+        }
+
+        Quadric q = quadrics[u];
+        q.Add(quadrics[v]);
+        double error = q.Evaluate(target) / (q.Weight > 0.0 ? q.Weight : 1.0);
+        positionError = std::sqrt(error);
+
+        double attributeError = 0.0;
+        for (size_t i = 0; i < wedgeMap.size(); ++i)
+        {
+            const Vertex& a = vertices[wedgeMap[i].first];
+            const Vertex& b = vertices[wedgeMap[i].second];
+            glm::vec3 dn = a.Normal - b.Normal;
+            glm::vec2 dt = a.TexCoord - b.TexCoord;
+            attributeError += options.NormalWeight * glm::dot(dn, dn) + options.TexCoordWeight * glm::dot(dt, dt);
+        }
+        return error * positionScale + attributeError;
+    };
+
+    struct Candidate
+    {
+        double Cost;
+        float PositionError;
+        GLuint From, To;
+        uint32_t FromVersion, ToVersion;
+        bool operator<(const Candidate& other) const { return Cost > other.Cost; } // Min-heap
+    };
+    std::priority_queue<Candidate> heap;
+    std::vector<uint32_t> version(pointCount, 0);
+    std::vector<bool> removed(pointCount, false);
+
+    // Pushes the cheaper legal direction of an edge
+    auto pushEdge = [&](GLuint a, GLuint b) {
+        double errorAB = 0.0, errorBA = 0.0;
+        double ab = evaluate(a, b, errorAB);
+        double ba = evaluate(b, a, errorBA);
+        if (ab < 0.0 && ba < 0.0)
+            return;
+        Candidate candidate;
+        if (ba < 0.0 || (ab >= 0.0 && ab <= ba))
+            candidate = { ab, (float)errorAB, a, b, version[a], version[b] };
+        else
+            candidate = { ba, (float)errorBA, b, a, version[b], version[a] };
+        heap.push(candidate);
+    };
+
+    // Neighbouring points of a point through live triangles
+    std::vector<GLuint> neighbours;
+    auto gatherNeighbours = [&](GLuint point) {
+        neighbours.clear();
+        for (size_t i = 0; i < pointTriangles[point].size(); ++i)
+        {
+            uint32_t t = pointTriangles[point][i];
+            if (!alive[t])
+                continue;
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint other = pointOf[tri[t * 3 + k]];
+                if (other != point && std::find(neighbours.begin(), neighbours.end(), other) == neighbours.end())
+                    neighbours.push_back(other);
+            }
+        }
+    };
+
+    for (GLuint p = 0; p < pointCount; ++p)
+    {
+        gatherNeighbours(p);
+        for (size_t i = 0; i < neighbours.size(); ++i)
+            if (p < neighbours[i])
+                pushEdge(p, neighbours[i]);
+    }
+
+    float reachedError = 0.0f;
+    while (aliveCount * 3 > targetIndexCount && !heap.empty())
+    {
+        Candidate candidate = heap.top();
+        heap.pop();
+        GLuint u = candidate.From, v = candidate.To;
+        if (removed[u] || removed[v] || version[u] != candidate.FromVersion || version[v] != candidate.ToVersion)
+            continue;
+        if (candidate.PositionError > options.MaxError)
+            break;
+
+        // Re-derive the wedge map for this exact state; the cached cost is current because both versions match
+        double positionError = 0.0;
+        if (evaluate(u, v, positionError) < 0.0)
+            continue;
+        std::vector<std::pair<GLuint, GLuint>> collapseMap = wedgeMap;
+
+        // Rewrite u's triangles onto v, dropping the ones that lose an edge
+        for (size_t i = 0; i < pointTriangles[u].size(); ++i)
+        {
+            uint32_t t = pointTriangles[u][i];
+            if (!alive[t])
+                continue;
+            bool hasV = false;
+            for (int k = 0; k < 3; ++k)
+                hasV = hasV || pointOf[tri[t * 3 + k]] == v;
+            if (hasV)
+            {
+                alive[t] = false;
+                --aliveCount;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k)
+            {
+                GLuint wedge = tri[t * 3 + k];
+                if (pointOf[wedge] != u)
+                    continue;
+                for (size_t m = 0; m < collapseMap.size(); ++m)
+                    if (collapseMap[m].first == wedge)
+                        tri[t * 3 + k] = collapseMap[m].second;
+            }
+            pointTriangles[v].push_back(t);
+        }
+
+        quadrics[v].Add(quadrics[u]);
+        removed[u] = true;
+        reachedError = std::max(reachedError, (float)positionError);
+
+        // Costs around v changed; bump versions so stale candidates are skipped, then re-queue its edges
+        gatherNeighbours(v);
+        std::vector<GLuint> ring = neighbours;
+        ++version[v];
+        for (size_t i = 0; i < ring.size(); ++i)
+            ++version[ring[i]];
+        for (size_t i = 0; i < ring.size(); ++i)
+        {
+            pushEdge(v, ring[i]);
+
+            // Edges between ring points share triangles with v, and their costs depend on v's quadric too
+            gatherNeighbours(ring[i]);
+            std::vector<GLuint> outer = neighbours;
+            for (size_t j = 0; j < outer.size(); ++j)
+                if (outer[j] != v && std::find(ring.begin(), ring.end(), outer[j]) == ring.end())
+                    pushEdge(ring[i], outer[j]);
+        }
+    }
+
+    // Pack the surviving triangles
+    size_t write = 0;
+    for (size_t t = 0; t < triangleCount; ++t)
+    {
+        if (!alive[t])
+            continue;
+        for (int k = 0; k < 3; ++k)
+            tri[write * 3 + k] = tri[t * 3 + k];
+        ++write;
+    }
+    tri.resize(write * 3);
+    return reachedError;
+}
+
+// Builds a chain of progressively simpler index lists, each at ratios[i] of the source triangle count.
+// Every level continues from the previous one, so the error only grows along the chain
+inline std::vector<SimplifiedLevel> simplifyLodChain(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+    const std::vector<float>& ratios, const SimplifyOptions& options = SimplifyOptions())
+{
+    std::vector<SimplifiedLevel> chain;
+    std::vector<GLuint> current = indices;
+    float error = 0.0f;
+
+    for (size_t i = 0; i < ratios.size(); ++i)
+    {
+        size_t target = (size_t)(indices.size() / 3 * ratios[i]) * 3;
+        std::vector<GLuint> simplified;
+        error = std::max(error, simplifyMesh(vertices, current, target, simplified, options));
+
+        SimplifiedLevel level = { simplified, error };
+        chain.push_back(level);
+        current.swap(simplified);
+    }
+    return chain;
+}
+
+// copies the vertices used by an index list into a builder, renumbering indices to the compacted vertices
+inline void compactMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, MeshBuilder& builder)
+{
+    builder.Clear();
+    std::vector<GLuint> remap(vertices.size(), ~0u);
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        GLuint& target = remap[indices[i]];
+        if (target == ~0u)
+        {
+            target = (GLuint)builder.Vertices.size();
+            builder.Vertices.push_back(vertices[indices[i]]);
+        }
+        builder.Indices.push_back(target);
+    }
+}
+#endif
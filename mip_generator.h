@@ -0,0 +1,502 @@
+#ifndef MIP_GENERATOR_H
+#define MIP_GENERATOR_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "thread_pool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MIP_GENERATOR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MIP_GENERATOR_AVX2_TARGET
+#else
+#define MIP_GENERATOR_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+// One level of a mip chain, tightly packed rows of 8-bit channels
+struct MipLevel
+{
+    int Width, Height;
+    std::vector<uint8_t> Pixels;
+};
+
+// Filter each level is resampled from the level above with
+enum MipFilter
+{
+    MIP_FILTER_BOX = 0,     // Area average; cheap and slightly soft
+    MIP_FILTER_KAISER,      // Kaiser-windowed sinc; sharper, at about four times the taps
+    MIP_FILTER_COUNT
+};
+
+// Instruction set the resampling kernels run on
+enum MipPath
+{
+    MIP_PATH_SCALAR = 0,
+    MIP_PATH_SSE2,      // One texel per iteration
+    MIP_PATH_AVX2,      // Two texels per iteration
+    MIP_PATH_COUNT
+};
+
+// Half width of the Kaiser filter in texels of the level being built, and the sharpness of its window
+const double MIP_KAISER_RADIUS = 3.0;
+const double MIP_KAISER_ALPHA = 4.0;
+
+// Output rows per parallel task
+const int MIP_BAND_ROWS = 16;
+
+// Steps of the table that finds a first guess when encoding linear values back to sRGB
+const int SRGB_ENCODE_STEPS = 4096;
+
+inline const char* mipFilterName(MipFilter filter)
+{
+    static const char* const names[MIP_FILTER_COUNT] = { "box", "kaiser" };
+    return names[filter];
+}
+
+inline const char* mipPathName(MipPath path)
+{
+    static const char* const names[MIP_PATH_COUNT] = { "scalar", "sse2", "avx2" };
+    return names[path];
+}
+
+// whether the CPU and operating system can run a kernel
+inline bool mipPathSupported(MipPath path)
+{
+#if MIP_GENERATOR_X86
+    if (path == MIP_PATH_SSE2)
+        return true; // Assumed by every x86 target GLEW and GLFW still build for
+    if (path == MIP_PATH_AVX2)
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool osSavesAvx = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+        __cpuidex(info, 7, 0);
+        return osSavesAvx && (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+    return path == MIP_PATH_SCALAR;
+}
+
+// fastest kernel the machine supports
+inline MipPath detectMipPath()
+{
+    for (int path = MIP_PATH_COUNT - 1; path > MIP_PATH_SCALAR; --path)
+    {
+        if (mipPathSupported((MipPath)path))
+            return (MipPath)path;
+    }
+    return MIP_PATH_SCALAR;
+}
+
+
+// Conversions between 8-bit sRGB codes and linear light. Decoding is a lookup; encoding looks up the code of a
+// coarse linear step and moves up at most one code, since no step spans more than one code boundary, so it rounds
+// exactly like encoding in doubles would
+struct SrgbTables
+{
+    float ToLinear[256];
+    float Midpoints[256];                   // Linear value of the sRGB halfway point between code i and i + 1; none past 255
+    uint8_t Codes[SRGB_ENCODE_STEPS + 1];   // Code for linear value i / SRGB_ENCODE_STEPS, at most one below the right one
+
+    SrgbTables()
+    {
+        for (int code = 0; code < 256; ++code)
+            ToLinear[code] = (float)decode(code / 255.0);
+        for (int code = 0; code < 255; ++code)
+            Midpoints[code] = (float)decode((code + 0.5) / 255.0);
+        Midpoints[255] = 2.0f;
+
+        int code = 0;
+        for (int step = 0; step <= SRGB_ENCODE_STEPS; ++step)
+        {
+            while (Midpoints[code] <= (float)step / SRGB_ENCODE_STEPS)
+                ++code;
+            Codes[step] = (uint8_t)code;
+        }
+    }
+
+    // nearest code of a linear value; out of range values and NaN clamp
+    uint8_t Encode(float value) const
+    {
+        value = value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+        unsigned code = Codes[(int)(value * SRGB_ENCODE_STEPS)];
+        return (uint8_t)(code + (value >= Midpoints[code] ? 1 : 0));
+    }
+
+    static double decode(double value)
+    {
+        return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+    }
+};
+
+inline const SrgbTables& srgbTables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+
+// Resampling weights along one axis: output texel i blends Taps source texels from First[i] on. Taps past the
+// border repeat the edge texel and are folded into it, so First[i] + Taps never leaves the source. Weights of each
+// output texel sum to 1
+struct MipAxis
+{
+    int Taps;
+    std::vector<int> First;
+    std::vector<float> Weights;     // Taps per output texel
+};
+
+// modified Bessel function of the first kind and order 0, the Kaiser window's shape
+inline double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32 && term > sum * 1e-12; ++k)
+    {
+        double factor = x / (2.0 * k);
+        term *= factor * factor;
+        sum += term;
+    }
+    return sum;
+}
+
+// weights taking an axis of sourceSize texels to size texels. Sizes need not be powers of two: each output texel
+// covers sourceSize / size source texels, so an odd level's last row still contributes instead of being dropped.
+// Enlarging keeps the filter one source texel wide, so the box filter becomes linear interpolation
+inline void buildMipAxis(int sourceSize, int size, MipFilter filter, MipAxis& axis)
+{
+    axis.First.assign(size, 0);
+    if (sourceSize == size)
+    {
+        axis.Taps = 1;
+        axis.Weights.assign(size, 1.0f);
+        for (int i = 0; i < size; ++i)
+            axis.First[i] = i;
+        return;
+    }
+
+    double scale = (double)sourceSize / size;
+    double width = scale > 1.0 ? scale : 1.0;
+    double support = filter == MIP_FILTER_BOX ? width * 0.5 : MIP_KAISER_RADIUS * width;
+
+    // Source texels whose centers, or for the box any part, fall within the support of output texel i
+    std::vector<int> low(size), high(size);
+    axis.Taps = 1;
+    for (int i = 0; i < size; ++i)
+    {
+        double center = (i + 0.5) * scale;
+        if (filter == MIP_FILTER_BOX)
+        {
+            low[i] = (int)std::floor(center - support);
+            high[i] = (int)std::ceil(center + support) - 1;
+        }
+        else
+        {
+            low[i] = (int)std::ceil(center - support - 0.5);
+            high[i] = (int)std::floor(center + support - 0.5);
+        }
+        axis.Taps = high[i] - low[i] + 1 > axis.Taps ? high[i] - low[i] + 1 : axis.Taps;
+    }
+    axis.Taps = axis.Taps < sourceSize ? axis.Taps : sourceSize;
+    axis.Weights.assign((size_t)size * axis.Taps, 0.0f);
+
+    double windowScale = 1.0 / besselI0(MIP_KAISER_ALPHA);
+    for (int i = 0; i < size; ++i)
+    {
+        double center = (i + 0.5) * scale;
+        int first = low[i] < 0 ? 0 : low[i];
+        first = first < sourceSize - axis.Taps ? first : sourceSize - axis.Taps;
+        axis.First[i] = first;
+
+        float* weights = &axis.Weights[(size_t)i * axis.Taps];
+        double total = 0.0;
+        for (int j = low[i]; j <= high[i]; ++j)
+        {
+            double weight;
+            if (filter == MIP_FILTER_BOX)
+            {
+                double right = center + support < j + 1 ? center + support : j + 1;
+                double left = center - support > j ? center - support : j;
+                weight = right - left;
+            }
+            else
+            {
+                double x = (j + 0.5 - center) / width;
+                double sinc = x == 0.0 ? 1.0 : std::sin(3.14159265358979323846 * x) / (3.14159265358979323846 * x);
+                double ratio = x / MIP_KAISER_RADIUS;
+                weight = sinc * besselI0(MIP_KAISER_ALPHA * std::sqrt(ratio < 1.0 ? 1.0 - ratio * ratio : 0.0)) * windowScale;
+            }
+            int clamped = j < 0 ? 0 : (j < sourceSize ? j : sourceSize - 1);
+            weights[clamped - first] += (float)weight;
+            total += weight;
+        }
+        for (int t = 0; t < axis.Taps; ++t)
+            weights[t] = (float)(weights[t] / total);
+    }
+}
+
+
+// Kernels over the working format: 4 floats per texel, linear light with color premultiplied by alpha.
+// blendRows: dest[i] = sum of weights[t] * rows[t * stride + i] over the taps, for count floats, a multiple of 4.
+// filterRow: dest texel x = sum of axis weights of x times the source texels from axis.First[x] on
+inline void blendRowsScalar(const float* rows, size_t stride, const float* weights, int taps, size_t count, float* dest)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        float sum = 0.0f;
+        for (int t = 0; t < taps; ++t)
+            sum += weights[t] * rows[t * stride + i];
+        dest[i] = sum;
+    }
+}
+
+inline void filterRowScalar(const float* row, const MipAxis& axis, float* dest)
+{
+    for (size_t x = 0; x < axis.First.size(); ++x)
+    {
+        const float* texels = row + (size_t)axis.First[x] * 4;
+        const float* weights = &axis.Weights[x * axis.Taps];
+        float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int t = 0; t < axis.Taps; ++t)
+        {
+            for (int c = 0; c < 4; ++c)
+                sum[c] += weights[t] * texels[t * 4 + c];
+        }
+        for (int c = 0; c < 4; ++c)
+            dest[x * 4 + c] = sum[c];
+    }
+}
+
+#if MIP_GENERATOR_X86
+inline void blendRowsSse2(const float* rows, size_t stride, const float* weights, int taps, size_t count, float* dest)
+{
+    for (size_t i = 0; i < count; i += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < taps; ++t)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(rows + t * stride + i)));
+        _mm_storeu_ps(dest + i, sum);
+    }
+}
+
+inline void filterRowSse2(const float* row, const MipAxis& axis, float* dest)
+{
+    for (size_t x = 0; x < axis.First.size(); ++x)
+    {
+        const float* texels = row + (size_t)axis.First[x] * 4;
+        const float* weights = &axis.Weights[x * axis.Taps];
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < axis.Taps; ++t)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(texels + t * 4)));
+        _mm_storeu_ps(dest + x * 4, sum);
+    }
+}
+
+MIP_GENERATOR_AVX2_TARGET inline void blendRowsAvx2(const float* rows, size_t stride, const float* weights, int taps, size_t count, float* dest)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        for (int t = 0; t < taps; ++t)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), _mm256_loadu_ps(rows + t * stride + i)));
+        _mm256_storeu_ps(dest + i, sum);
+    }
+    if (i < count)
+    {
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < taps; ++t)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(rows + t * stride + i)));
+        _mm_storeu_ps(dest + i, sum);
+    }
+}
+
+// Two output texels share each iteration, one per 128-bit lane, each with its own source texels and weights
+MIP_GENERATOR_AVX2_TARGET inline void filterRowAvx2(const float* row, const MipAxis& axis, float* dest)
+{
+    size_t size = axis.First.size();
+    size_t x = 0;
+    for (; x + 2 <= size; x += 2)
+    {
+        const float* left = row + (size_t)axis.First[x] * 4;
+        const float* right = row + (size_t)axis.First[x + 1] * 4;
+        const float* leftWeights = &axis.Weights[x * axis.Taps];
+        const float* rightWeights = leftWeights + axis.Taps;
+        __m256 sum = _mm256_setzero_ps();
+        for (int t = 0; t < axis.Taps; ++t)
+        {
+            __m256 texels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(left + t * 4)), _mm_loadu_ps(right + t * 4), 1);
+            __m256 weights = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(leftWeights[t])), _mm_set1_ps(rightWeights[t]), 1);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(weights, texels));
+        }
+        _mm256_storeu_ps(dest + x * 4, sum);
+    }
+    if (x < size)
+    {
+        const float* texels = row + (size_t)axis.First[x] * 4;
+        const float* weights = &axis.Weights[x * axis.Taps];
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < axis.Taps; ++t)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(texels + t * 4)));
+        _mm_storeu_ps(dest + x * 4, sum);
+    }
+}
+#endif
+
+inline void blendRows(MipPath path, const float* rows, size_t stride, const float* weights, int taps, size_t count, float* dest)
+{
+#if MIP_GENERATOR_X86
+    if (path == MIP_PATH_AVX2)
+        return blendRowsAvx2(rows, stride, weights, taps, count, dest);
+    if (path == MIP_PATH_SSE2)
+        return blendRowsSse2(rows, stride, weights, taps, count, dest);
+#endif
+    blendRowsScalar(rows, stride, weights, taps, count, dest);
+}
+
+inline void filterRow(MipPath path, const float* row, const MipAxis& axis, float* dest)
+{
+#if MIP_GENERATOR_X86
+    if (path == MIP_PATH_AVX2)
+        return filterRowAvx2(row, axis, dest);
+    if (path == MIP_PATH_SSE2)
+        return filterRowSse2(row, axis, dest);
+#endif
+    filterRowScalar(row, axis, dest);
+}
+
+
+// converts a row of 8-bit sRGB texels, RGB or RGBA, to the working format. RGB texels get an alpha of 1
+inline void decodeMipRow(const uint8_t* source, int width, int channels, float* dest)
+{
+    const SrgbTables& srgb = srgbTables();
+    for (int x = 0; x < width; ++x, source += channels, dest += 4)
+    {
+        float alpha = channels == 4 ? source[3] * (1.0f / 255.0f) : 1.0f;
+        dest[0] = srgb.ToLinear[source[0]] * alpha;
+        dest[1] = srgb.ToLinear[source[1]] * alpha;
+        dest[2] = srgb.ToLinear[source[2]] * alpha;
+        dest[3] = alpha;
+    }
+}
+
+// converts a row of the working format back to 8-bit sRGB, dividing out alpha. Fully transparent texels turn black
+inline void encodeMipRow(const float* source, int width, int channels, uint8_t* dest)
+{
+    const SrgbTables& srgb = srgbTables();
+    for (int x = 0; x < width; ++x, source += 4, dest += channels)
+    {
+        float alpha = source[3] > 0.0f ? (source[3] < 1.0f ? source[3] : 1.0f) : 0.0f;
+        float unpremultiply = channels == 3 ? 1.0f : (alpha > 0.0f ? 1.0f / alpha : 0.0f);
+        dest[0] = srgb.Encode(source[0] * unpremultiply);
+        dest[1] = srgb.Encode(source[1] * unpremultiply);
+        dest[2] = srgb.Encode(source[2] * unpremultiply);
+        if (channels == 4)
+            dest[3] = (uint8_t)(alpha * 255.0f + 0.5f);
+    }
+}
+
+// calls fn(band) for every band of MIP_BAND_ROWS rows, across the workers when there are several bands
+template <typename Function>
+inline void forEachMipBand(ThreadPool* workers, int rows, Function fn)
+{
+    size_t bands = (size_t)(rows + MIP_BAND_ROWS - 1) / MIP_BAND_ROWS;
+    if (workers && bands > 1)
+        workers->ParallelFor(bands, fn);
+    else
+    {
+        for (size_t band = 0; band < bands; ++band)
+            fn(band);
+    }
+}
+
+
+// converts 8-bit sRGB texels, RGB or RGBA, to the working format, across the workers when given
+inline void decodeMipImage(const uint8_t* pixels, int width, int height, int channels, ThreadPool* workers, std::vector<float>& image)
+{
+    size_t rowBytes = (size_t)width * channels;
+    image.resize((size_t)width * height * 4);
+    forEachMipBand(workers, height, [&](size_t band) {
+        int end = (int)band * MIP_BAND_ROWS + MIP_BAND_ROWS < height ? (int)band * MIP_BAND_ROWS + MIP_BAND_ROWS : height;
+        for (int y = (int)band * MIP_BAND_ROWS; y < end; ++y)
+            decodeMipRow(pixels + y * rowBytes, width, channels, &image[(size_t)y * width * 4]);
+    });
+}
+
+// resamples an image in the working format to the size of level, leaving the result in the working format in next
+// and encoded in level.Pixels. Filtering runs vertically then horizontally on bands of rows, spread over the workers
+inline void resampleMipLevel(const std::vector<float>& source, int sourceWidth, int sourceHeight, int channels, MipFilter filter,
+    ThreadPool* workers, MipPath path, MipLevel& level, std::vector<float>& next)
+{
+    level.Pixels.resize((size_t)level.Width * level.Height * channels);
+    next.resize((size_t)level.Width * level.Height * 4);
+    MipAxis columns, rows;
+    buildMipAxis(sourceWidth, level.Width, filter, columns);
+    buildMipAxis(sourceHeight, level.Height, filter, rows);
+
+    // Each band blends its source rows into one full width row, filters that along x, and encodes the result
+    size_t sourceStride = (size_t)sourceWidth * 4, stride = (size_t)level.Width * 4;
+    forEachMipBand(workers, level.Height, [&](size_t band) {
+        std::vector<float> blended(sourceStride);
+        int end = (int)band * MIP_BAND_ROWS + MIP_BAND_ROWS < level.Height ? (int)band * MIP_BAND_ROWS + MIP_BAND_ROWS : level.Height;
+        for (int y = (int)band * MIP_BAND_ROWS; y < end; ++y)
+        {
+            blendRows(path, &source[(size_t)rows.First[y] * sourceStride], sourceStride, &rows.Weights[(size_t)y * rows.Taps],
+                rows.Taps, sourceStride, blended.data());
+            float* output = &next[(size_t)y * stride];
+            filterRow(path, blended.data(), columns, output);
+            encodeMipRow(output, level.Width, channels, &level.Pixels[(size_t)y * level.Width * channels]);
+        }
+    });
+}
+
+// builds the full chain down to 1x1 from a level 0 of 8-bit sRGB texels, RGB or RGBA, that is moved into levels[0].
+// Each level is resampled from the one above in linear light with premultiplied alpha, so it neither darkens nor
+// bleeds the color of transparent texels. Level sizes halve and round down as OpenGL expects. Levels depend on the
+// one above, so only the rows of a level run in parallel
+inline void buildMipChain(std::vector<uint8_t>& level0, int width, int height, int channels, std::vector<MipLevel>& levels,
+    MipFilter filter = MIP_FILTER_BOX, ThreadPool* workers = nullptr, MipPath path = detectMipPath())
+{
+    levels.clear();
+    MipLevel first = { width, height, std::vector<uint8_t>() };
+    first.Pixels.swap(level0);
+    levels.push_back(std::move(first));
+    if (width <= 1 && height <= 1)
+        return;
+
+    std::vector<float> current, next;
+    decodeMipImage(levels[0].Pixels.data(), width, height, channels, workers, current);
+    while (levels.back().Width > 1 || levels.back().Height > 1)
+    {
+        int sourceWidth = levels.back().Width, sourceHeight = levels.back().Height;
+        MipLevel level = { sourceWidth > 1 ? sourceWidth / 2 : 1, sourceHeight > 1 ? sourceHeight / 2 : 1, std::vector<uint8_t>() };
+        resampleMipLevel(current, sourceWidth, sourceHeight, channels, filter, workers, path, level, next);
+        current.swap(next);
+        levels.push_back(std::move(level));
+    }
+}
+
+// resamples 8-bit sRGB texels, RGB or RGBA, to any size the same way the chain's levels are built, such as to
+// enlarge or shrink a texture to a fixed size before building its chain
+inline void resampleImage(const uint8_t* pixels, int width, int height, int channels, int newWidth, int newHeight, MipLevel& result,
+    MipFilter filter = MIP_FILTER_BOX, ThreadPool* workers = nullptr, MipPath path = detectMipPath())
+{
+    std::vector<float> source, resampled;
+    decodeMipImage(pixels, width, height, channels, workers, source);
+    result.Width = newWidth;
+    result.Height = newHeight;
+    resampleMipLevel(source, width, height, channels, filter, workers, path, result, resampled);
+}
+#endif
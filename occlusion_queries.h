@@ -0,0 +1,252 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "frustum.h"
+#include "render_queue.h"
+#include "shader.h"
+
+// Counters of the current frame
+struct OcclusionQueryStats
+{
+    unsigned Queries;   // Bounding boxes queried this frame
+    unsigned Gated;     // Draws submitted under a condition this frame
+    unsigned Skipped;   // Gated draws the GPU dropped, from the results that completed this frame
+    unsigned Pooled;    // Query objects created so far
+};
+
+
+// Query objects recycled across frames, so frames never create or delete queries once the pool has grown
+class QueryPool
+{
+public:
+    GLuint Acquire()
+    {
+        if (free.empty())
+        {
+            GLuint query = 0;
+            glGenQueries(1, &query);
+            all.push_back(query);
+            return query;
+        }
+        GLuint query = free.back();
+        free.pop_back();
+        return query;
+    }
+
+    // returns a query whose result is no longer needed
+    void Release(GLuint query)
+    {
+        free.push_back(query);
+    }
+
+    size_t Size() const { return all.size(); }
+
+    void Destroy()
+    {
+        if (!all.empty())
+            glDeleteQueries((GLsizei)all.size(), all.data());
+        all.clear();
+        free.clear();
+    }
+
+private:
+    std::vector<GLuint> all;
+    std::vector<GLuint> free;
+};
+
+
+// Occlusion queries on bounding boxes with temporal coherence.
+// After a frame is drawn, each expensive object's world box is rasterized invisibly inside a
+// GL_ANY_SAMPLES_PASSED_CONSERVATIVE query. The next frame draws the object under glBeginConditionalRender with that
+// query in GL_QUERY_NO_WAIT mode: the GPU skips the draw if the box was hidden, and simply draws it if the result is
+// not ready yet, so the CPU never waits. An object becoming visible appears one frame late.
+// Results are also polled without blocking once they complete, to count the draws that were skipped
+class OcclusionQueries
+{
+public:
+    float BoxMargin = 0.01f;    // Relative growth of the proxy boxes, so faces coinciding with the object still pass
+    float CameraMargin = 0.2f;  // Boxes closer than this to the camera may be cut by the near plane and are not queried
+
+    OcclusionQueryStats Stats = {};
+
+    // creates the proxy box geometry
+    void Create()
+    {
+        // Unit cube corners; the proxy's model matrix places it on a box's center and half extents
+        const GLfloat corners[8 * 3] = {
+            -1, -1, -1,   1, -1, -1,   1,  1, -1,  -1,  1, -1,
+            -1, -1,  1,   1, -1,  1,   1,  1,  1,  -1,  1,  1
+        };
+        const GLubyte indices[36] = {
+            0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,   0, 1, 5, 0, 5, 4,
+            3, 6, 2, 3, 7, 6,   0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5
+        };
+
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(2, buffers);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // releases the proxy geometry and every query
+    void Destroy()
+    {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(2, buffers);
+        vao = buffers[0] = buffers[1] = 0;
+        pool.Destroy();
+        objects.clear();
+        retired.clear();
+    }
+
+    // forgets every object's visibility, for a scene of objectCount objects
+    void Reset(size_t objectCount)
+    {
+        for (size_t i = 0; i < objects.size(); ++i)
+        {
+            if (objects[i].Query != 0)
+                retire(objects[i].Query, false);
+        }
+        objects.assign(objectCount, ObjectQuery());
+    }
+
+    // starts a frame: collects the results that completed since the last one
+    void BeginFrame()
+    {
+        ++frame;
+        unsigned pooled = (unsigned)pool.Size();
+        Stats = OcclusionQueryStats();
+        Stats.Pooled = pooled;
+        collect();
+    }
+
+    // query an object's draw is conditioned on this frame, or 0 to draw it unconditionally.
+    // Only a query issued in the previous frame counts; an older one no longer describes the view
+    GLuint Condition(uint32_t object)
+    {
+        const ObjectQuery& state = objects[object];
+        if (state.Query == 0 || state.Frame + 1 != frame)
+            return 0;
+        ++Stats.Gated;
+        return state.Query;
+    }
+
+    // queries the world boxes of the listed objects against the current depth buffer, drawn by a program that takes
+    // positions at location 0 and the model matrix at INSTANCE_MODEL_LOCATION. Boxes around the camera are not queried,
+    // as the near plane clips their front faces away; those objects draw unconditionally next frame
+    template <typename BoxOf>
+    void Issue(const uint32_t* items, size_t count, BoxOf boxOf, const ShaderProgram& program, const glm::vec3& cameraPosition)
+    {
+        program.Use();
+        glBindVertexArray(vao);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            ObjectQuery& state = objects[items[i]];
+            bool gated = state.Query != 0 && state.Frame + 1 == frame;
+            if (state.Query != 0)
+                retire(state.Query, gated); // Its result now only tells whether this frame's draw was skipped
+            state.Query = 0;
+
+            const BoundingBox& box = boxOf(items[i]);
+            glm::vec3 center = 0.5f * (box.Min + box.Max);
+            glm::vec3 extent = 0.5f * (box.Max - box.Min) * (1.0f + BoxMargin) + glm::vec3(1e-3f);
+            glm::vec3 offset = glm::abs(cameraPosition - center) - extent;
+            if (offset.x <= CameraMargin && offset.y <= CameraMargin && offset.z <= CameraMargin)
+                continue;
+
+            // The proxy VAO has no per-instance arrays, so the model matrix comes from the generic attribute values
+            glm::mat4 model(1.0f);
+            model[0][0] = extent.x;
+            model[1][1] = extent.y;
+            model[2][2] = extent.z;
+            model[3] = glm::vec4(center, 1.0f);
+            for (GLuint column = 0; column < 4; ++column)
+                glVertexAttrib4fv(INSTANCE_MODEL_LOCATION + column, glm::value_ptr(model[column]));
+
+            state.Query = pool.Acquire();
+            state.Frame = frame;
+            glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, state.Query);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+            ++Stats.Queries;
+        }
+
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glBindVertexArray(0);
+    }
+
+private:
+    // Latest query of an object and the frame it was issued in
+    struct ObjectQuery
+    {
+        GLuint Query = 0;
+        unsigned Frame = 0;
+    };
+
+    // A query replaced by a newer one, kept until its result can be read without waiting
+    struct RetiredQuery
+    {
+        GLuint Query;
+        bool Gated; // A draw was conditioned on it, so a zero result is a skipped draw
+    };
+
+    GLuint vao = 0;
+    GLuint buffers[2] = {};
+    QueryPool pool;
+    std::vector<ObjectQuery> objects;
+    std::deque<RetiredQuery> retired;
+    unsigned frame = 1;
+
+    void retire(GLuint query, bool gated)
+    {
+        RetiredQuery entry = { query, gated };
+        retired.push_back(entry);
+    }
+
+    // reads retired results in issue order, stopping at the first one still in flight. Queries complete in order,
+    // so nothing behind it could be ready either
+    void collect()
+    {
+        while (!retired.empty())
+        {
+            GLuint query = retired.front().Query;
+            GLuint available = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            if (retired.front().Gated)
+            {
+                GLuint anySamples = 0;
+                glGetQueryObjectuiv(query, GL_QUERY_RESULT, &anySamples);
+                if (!anySamples)
+                    ++Stats.Skipped;
+            }
+            pool.Release(query);
+            retired.pop_front();
+        }
+    }
+};
+#endif
@@ -0,0 +1,321 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <map>
+#include <utility>
+
+#include "mesh_builder.h"
+
+// Procedural primitives. Frames match the meshes they replaced, so existing model matrices still apply:
+//   box       x, z in [-0.5, 0.5], y in [0, 1]; segments subdivide every face edge
+//   pyramid   square base in [-0.5, 0.5] at z = 0, apex at (0, 0, 1); segments subdivide every face edge
+//   plane     x, z in [-0.5, 0.5] at y = 0, facing +y; segments subdivide both edges
+//   cylinder  radius 1, y in [0, 1], capped; segments around the axis
+//   cone      base of radius 1 at y = 0, apex at (0, 1, 0); segments around the axis
+//   sphere    radius 1 around the origin; segments around the axis, half as many from pole to pole
+//   torus     ring of radius 1 around y, tube radius 0.25; segments around the ring, half as many around the tube
+// Triangles wind counter-clockwise seen from outside
+enum PrimitiveType
+{
+    PRIMITIVE_BOX = 0,
+    PRIMITIVE_PYRAMID,
+    PRIMITIVE_PLANE,
+    PRIMITIVE_CYLINDER,
+    PRIMITIVE_CONE,
+    PRIMITIVE_SPHERE,
+    PRIMITIVE_TORUS,
+    PRIMITIVE_COUNT
+};
+
+const float TORUS_TUBE_RADIUS = 0.25f;
+
+
+// builds a vertex from its attributes
+inline Vertex makeVertex(const glm::vec3& position, const glm::vec3& normal, const glm::vec2& texCoord)
+{
+    Vertex vertex;
+    vertex.Position = position;
+    vertex.Normal = normal;
+    vertex.TexCoord = texCoord;
+    return vertex;
+}
+
+// adds a (columns + 1) x (rows + 1) vertex grid produced by vertexAt(column, row) as two triangles per cell.
+// The grid's column direction crossed with its row direction must point outside. Triangles collapsed to a
+// point or an edge (sphere poles) are skipped
+template <typename VertexAt>
+void addSurface(MeshBuilder& builder, int columns, int rows, VertexAt vertexAt)
+{
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int column = 0; column < columns; ++column)
+        {
+            Vertex a = vertexAt(column, row);
+            Vertex b = vertexAt(column + 1, row);
+            Vertex c = vertexAt(column + 1, row + 1);
+            Vertex d = vertexAt(column, row + 1);
+
+            if (a.Position != b.Position && b.Position != c.Position && c.Position != a.Position)
+                builder.AddTriangle(a, b, c);
+            if (a.Position != c.Position && c.Position != d.Position && d.Position != a.Position)
+                builder.AddTriangle(a, c, d);
+        }
+    }
+}
+
+// adds a flat rectangle origin + s * uAxis + t * vAxis for s, t in [0, 1], textured with (s, t)
+inline void addGrid(MeshBuilder& builder, const glm::vec3& origin, const glm::vec3& uAxis, const glm::vec3& vAxis, int segments)
+{
+    glm::vec3 normal = glm::normalize(glm::cross(uAxis, vAxis));
+    float step = 1.0f / segments;
+    addSurface(builder, segments, segments, [&](int column, int row) {
+        float s = column * step, t = row * step;
+        return makeVertex(origin + s * uAxis + t * vAxis, normal, glm::vec2(s, t));
+    });
+}
+
+// adds a flat triangle split into segments^2 smaller ones, corners given counter-clockwise
+inline void addSubdividedTriangle(MeshBuilder& builder, const glm::vec3 p[3], const glm::vec2 uv[3], int segments)
+{
+    glm::vec3 normal = glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+    float step = 1.0f / segments;
+
+    // Point i along edge 0-1 on row r towards corner 2
+    auto at = [&](int i, int r) {
+        float s = i * step, t = r * step;
+        return makeVertex(p[0] + s * (p[1] - p[0]) + t * (p[2] - p[0]), normal, uv[0] + s * (uv[1] - uv[0]) + t * (uv[2] - uv[0]));
+    };
+
+    for (int r = 0; r < segments; ++r)
+    {
+        for (int i = 0; i < segments - r; ++i)
+        {
+            builder.AddTriangle(at(i, r), at(i + 1, r), at(i, r + 1));
+            if (i + 1 < segments - r)
+                builder.AddTriangle(at(i + 1, r), at(i + 1, r + 1), at(i, r + 1));
+        }
+    }
+}
+
+// point on the unit circle around y at fraction s of a turn; s = 0 is +z and s = 0.25 is +x
+inline glm::vec3 ringDirection(float s)
+{
+    // Wrap so the closing column of a ring lands on exactly the same position as the first
+    float angle = 2.0f * 3.14159265358979f * (s - std::floor(s));
+    return glm::vec3(std::sin(angle), 0.0f, std::cos(angle));
+}
+
+// adds a disc of radius 1 at height y, facing up or down, textured with the plane mapping
+inline void addDisc(MeshBuilder& builder, float y, bool facingUp, int segments)
+{
+    glm::vec3 normal(0.0f, facingUp ? 1.0f : -1.0f, 0.0f);
+    Vertex center = makeVertex(glm::vec3(0.0f, y, 0.0f), normal, glm::vec2(0.5f, 0.5f));
+    for (int i = 0; i < segments; ++i)
+    {
+        glm::vec3 d0 = ringDirection((float)i / segments);
+        glm::vec3 d1 = ringDirection((float)(i + 1) / segments);
+        Vertex v0 = makeVertex(glm::vec3(d0.x, y, d0.z), normal, glm::vec2(0.5f + 0.5f * d0.x, 0.5f - 0.5f * d0.z));
+        Vertex v1 = makeVertex(glm::vec3(d1.x, y, d1.z), normal, glm::vec2(0.5f + 0.5f * d1.x, 0.5f - 0.5f * d1.z));
+        if (facingUp)
+            builder.AddTriangle(center, v0, v1);
+        else
+            builder.AddTriangle(center, v1, v0);
+    }
+}
+
+// smallest segment count that gives a closed, non-degenerate primitive
+inline int minimumSegments(PrimitiveType type)
+{
+    switch (type)
+    {
+    case PRIMITIVE_BOX:
+    case PRIMITIVE_PYRAMID:
+    case PRIMITIVE_PLANE:
+        return 1;
+    default:
+        return 3;
+    }
+}
+
+// appends a primitive at the given detail to the builder (see PrimitiveType for frames and segment meaning)
+inline void generatePrimitive(PrimitiveType type, int segments, MeshBuilder& builder)
+{
+    if (segments < minimumSegments(type))
+        segments = minimumSegments(type);
+    const float turn = 1.0f / segments;
+
+    switch (type)
+    {
+    case PRIMITIVE_BOX:
+    {
+        // Each face: normal, then a u and v axis whose cross product is the normal
+        static const glm::vec3 faces[6][3] = {
+            { glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0) },
+            { glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0) },
+            { glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1) },
+            { glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1) },
+            { glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0) },
+            { glm::vec3(0, 0, -1), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0) }
+        };
+        glm::vec3 center(0.0f, 0.5f, 0.0f);
+        for (int face = 0; face < 6; ++face)
+        {
+            glm::vec3 origin = center + 0.5f * (faces[face][0] - faces[face][1] - faces[face][2]);
+            addGrid(builder, origin, faces[face][1], faces[face][2], segments);
+        }
+        break;
+    }
+
+    case PRIMITIVE_PYRAMID:
+    {
+        // Base faces -z, away from the apex
+        addGrid(builder, glm::vec3(0.5f, -0.5f, 0.0f), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), segments);
+
+        const glm::vec3 corners[4] = { glm::vec3(-0.5f, -0.5f, 0.0f), glm::vec3(0.5f, -0.5f, 0.0f), glm::vec3(0.5f, 0.5f, 0.0f), glm::vec3(-0.5f, 0.5f, 0.0f) };
+        const glm::vec2 uv[3] = { glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 0.0f), glm::vec2(0.5f, 1.0f) };
+        for (int side = 0; side < 4; ++side)
+        {
+            glm::vec3 p[3] = { corners[side], corners[(side + 1) % 4], glm::vec3(0.0f, 0.0f, 1.0f) };
+            addSubdividedTriangle(builder, p, uv, segments);
+        }
+        break;
+    }
+
+    case PRIMITIVE_PLANE:
+        // Texture coordinates (x + 0.5, 0.5 - z) as in the original desk
+        addGrid(builder, glm::vec3(-0.5f, 0.0f, 0.5f), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), segments);
+        break;
+
+    case PRIMITIVE_CYLINDER:
+        addSurface(builder, segments, 1, [&](int column, int row) {
+            glm::vec3 d = ringDirection(column * turn);
+            return makeVertex(glm::vec3(d.x, (float)row, d.z), d, glm::vec2(column * turn, (float)row));
+        });
+        addDisc(builder, 0.0f, false, segments);
+        addDisc(builder, 1.0f, true, segments);
+        break;
+
+    case PRIMITIVE_CONE:
+    {
+        // Slant normals; the apex is split per segment so every side keeps its own normal
+        for (int i = 0; i < segments; ++i)
+        {
+            glm::vec3 d0 = ringDirection(i * turn);
+            glm::vec3 d1 = ringDirection((i + 1) * turn);
+            glm::vec3 dm = ringDirection((i + 0.5f) * turn);
+            Vertex v0 = makeVertex(d0, glm::normalize(d0 + glm::vec3(0, 1, 0)), glm::vec2(i * turn, 0.0f));
+            Vertex v1 = makeVertex(d1, glm::normalize(d1 + glm::vec3(0, 1, 0)), glm::vec2((i + 1) * turn, 0.0f));
+            Vertex apex = makeVertex(glm::vec3(0, 1, 0), glm::normalize(dm + glm::vec3(0, 1, 0)), glm::vec2((i + 0.5f) * turn, 1.0f));
+            builder.AddTriangle(v0, v1, apex);
+        }
+        addDisc(builder, 0.0f, false, segments);
+        break;
+    }
+
+    case PRIMITIVE_SPHERE:
+    {
+        // Rows run from the south pole up, so columns x rows points outward; poles are exact
+        int rings = segments / 2 > 2 ? segments / 2 : 2;
+        addSurface(builder, segments, rings, [&](int column, int row) {
+            float polar = 3.14159265358979f * (1.0f - (float)row / rings);
+            float radius = (row == 0 || row == rings) ? 0.0f : std::sin(polar);
+            glm::vec3 d = ringDirection(column * turn);
+            glm::vec3 n(radius * d.x, std::cos(polar), radius * d.z);
+            return makeVertex(n, n, glm::vec2(column * turn, (float)row / rings));
+        });
+        break;
+    }
+
+    case PRIMITIVE_TORUS:
+    {
+        int tubeSegments = segments / 2 > 3 ? segments / 2 : 3;
+        addSurface(builder, segments, tubeSegments, [&](int column, int row) {
+            glm::vec3 d = ringDirection(column * turn);
+            float angle = 2.0f * 3.14159265358979f * row / tubeSegments;
+            glm::vec3 n = std::cos(angle) * d + glm::vec3(0.0f, std::sin(angle), 0.0f);
+            return makeVertex(d + TORUS_TUBE_RADIUS * n, n, glm::vec2(column * turn, (float)row / tubeSegments));
+        });
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// largest distance between a tessellated primitive and the exact surface it approximates (0 for flat ones),
+// used as the geometric error of a detail level. A chord over 1/n of a circle of radius r sags by r(1 - cos(pi/n))
+inline float primitiveError(PrimitiveType type, int segments)
+{
+    if (segments < minimumSegments(type))
+        segments = minimumSegments(type);
+    const float pi = 3.14159265358979f;
+
+    switch (type)
+    {
+    case PRIMITIVE_CYLINDER:
+    case PRIMITIVE_CONE:
+        return 1.0f - std::cos(pi / segments);
+    case PRIMITIVE_SPHERE:
+    {
+        int rings = segments / 2 > 2 ? segments / 2 : 2;
+        return 1.0f - std::cos(pi / (segments < 2 * rings ? segments : 2 * rings));
+    }
+    case PRIMITIVE_TORUS:
+    {
+        int tubeSegments = segments / 2 > 3 ? segments / 2 : 3;
+        return (1.0f + TORUS_TUBE_RADIUS) * (1.0f - std::cos(pi / segments)) + TORUS_TUBE_RADIUS * (1.0f - std::cos(pi / tubeSegments));
+    }
+    default:
+        return 0.0f;
+    }
+}
+
+// flips every normal, for meshes lit from the inside
+inline void invertNormals(std::vector<Vertex>& vertices)
+{
+    for (size_t i = 0; i < vertices.size(); ++i)
+        vertices[i].Normal = -vertices[i].Normal;
+}
+
+
+// Meshes generated from primitives, one per (type, segments), so each detail level is built and uploaded once
+template <typename Mesh>
+class PrimitiveCache
+{
+public:
+    // returns the cached mesh or nullptr
+    Mesh* Find(PrimitiveType type, int segments)
+    {
+        typename std::map<std::pair<int, int>, Mesh>::iterator it = meshes.find(std::make_pair((int)type, segments));
+        return it != meshes.end() ? &it->second : nullptr;
+    }
+
+    // stores a mesh; references stay valid until Clear
+    Mesh& Insert(PrimitiveType type, int segments, const Mesh& mesh)
+    {
+        return meshes[std::make_pair((int)type, segments)] = mesh;
+    }
+
+    // calls function on every cached mesh, e.g. to release it
+    template <typename Function>
+    void ForEach(Function function)
+    {
+        for (typename std::map<std::pair<int, int>, Mesh>::iterator it = meshes.begin(); it != meshes.end(); ++it)
+            function(it->second);
+    }
+
+    // forgets every mesh
+    void Clear()
+    {
+        meshes.clear();
+    }
+
+private:
+    std::map<std::pair<int, int>, Mesh> meshes;
+};
+#endif
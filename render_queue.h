@@ -0,0 +1,339 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "frustum.h"
+#include "geometry_arena.h"
+#include "shader.h"
+
+// Passes are the most significant part of the sort key, so everything in one pass is drawn before the next
+enum RenderPass
+{
+    RENDER_PASS_OPAQUE = 0,  // Lit, textured objects
+    RENDER_PASS_EMISSIVE = 1, // Unlit light source markers
+    RENDER_PASS_OCCLUDER = 2, // Depth-only draws of large objects, rendered before culling against their depth
+    RENDER_PASS_DEPTH = 3     // Depth-only prepass of the opaque draws, ordered front to back before any state
+};
+
+// Vertex attribute locations fed from the per-instance buffer. A mat4 attribute occupies four locations
+const GLuint INSTANCE_MODEL_LOCATION = 3;
+const GLuint INSTANCE_UV_TRANSFORM_LOCATION = 7;
+
+// Per-instance data streamed to the GPU every frame
+struct InstanceData
+{
+    glm::mat4 Model;
+    glm::vec4 UVTransform; // Texture coordinate = uv * xy + zw
+};
+
+// Everything needed to issue one draw, referenced by index from the sorted key list
+struct DrawCommand
+{
+    glm::mat4 Model;
+    glm::vec4 UVTransform;  // Texture coordinate = uv * xy + zw
+    GLuint Program;     // Index into the queue's programs
+    GLuint Texture;     // 0 when the program does not sample a texture
+    MeshRange Mesh;
+    BoundingBox Bounds; // World space, for culling on the GPU
+    GLuint Query;       // Occlusion query the draw is conditioned on, 0 to always draw
+};
+
+// Sort key plus index of the command it describes. Only these 16 bytes move during sorting
+struct DrawItem
+{
+    uint64_t Key;
+    uint32_t Index;
+};
+
+// Consecutive sorted draws sharing every piece of state, issued as one instanced draw
+struct DrawBatch
+{
+    uint32_t Command;       // First command of the batch; its state is shared by the rest
+    GLuint BaseInstance;    // Offset of the batch in the instance buffer
+    GLsizei InstanceCount;
+};
+
+// Counters summed over every Execute since the last Clear, so a frame drawn in several passes reports all of them
+struct RenderQueueStats
+{
+    unsigned Instances;
+    unsigned Draws;
+    unsigned ProgramBinds;
+    unsigned TextureBinds;
+    unsigned VaoBinds;
+    unsigned VaoBindsElided;
+    unsigned ConditionalDraws;
+};
+
+
+// Collects draws for a frame, orders them by a 64-bit state key and issues them as instanced draws with redundant binds removed
+class RenderQueue
+{
+public:
+    // Key layout, most significant first: pass(4) | program(8) | texture(12) | mesh(12) | depth(28).
+    // The depth prepass has a single program and no texture, so its program field holds a coarse depth bucket instead
+    static const int PASS_SHIFT = 60;
+    static const int PROGRAM_SHIFT = 52;
+    static const int TEXTURE_SHIFT = 40;
+    static const int MESH_SHIFT = 28;
+    static const uint64_t DEPTH_MASK = (1ull << 28) - 1;
+    static const int DEPTH_BUCKETS = 256;
+
+    RenderQueueStats Stats = {};
+
+    // creates the instance buffer. Must run before any mesh calls SetupInstanceAttributes
+    void Create()
+    {
+        glGenBuffers(1, &instanceVbo);
+    }
+
+    // releases the instance buffer
+    void Destroy()
+    {
+        glDeleteBuffers(1, &instanceVbo);
+        instanceVbo = 0;
+    }
+
+    // points the per-instance attributes of a VAO at the shared instance buffer
+    void SetupInstanceAttributes(GLuint vao) const
+    {
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+
+        GLsizei stride = sizeof(InstanceData);
+        for (GLuint column = 0; column < 4; ++column)
+        {
+            GLuint location = INSTANCE_MODEL_LOCATION + column;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(glm::vec4) * column));
+            glVertexAttribDivisor(location, 1); // Advance once per instance, not per vertex
+            glEnableVertexAttribArray(location);
+        }
+
+        glVertexAttribPointer(INSTANCE_UV_TRANSFORM_LOCATION, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(InstanceData, UVTransform));
+        glVertexAttribDivisor(INSTANCE_UV_TRANSFORM_LOCATION, 1);
+        glEnableVertexAttribArray(INSTANCE_UV_TRANSFORM_LOCATION);
+
+        glBindVertexArray(0);
+    }
+
+    // registers a program the queue may switch to and returns its index, used in Submit
+    GLuint AddProgram(const ShaderProgram* program)
+    {
+        programs.push_back(program);
+        return (GLuint)programs.size() - 1;
+    }
+
+    // drops all draws submitted for the previous frame, keeping the allocations, and restarts the counters
+    void Clear()
+    {
+        commands.clear();
+        items.clear();
+        Stats = RenderQueueStats();
+    }
+
+    // adds a draw. depth01 is the normalized view distance, so draws sharing state are ordered front to back.
+    // A draw with a condition query is left to the GPU to skip, and never batched with others.
+    // Compact meshes get their position decode folded into the model matrix here, and their uv decode into the uv scale
+    void Submit(RenderPass pass, GLuint program, GLuint texture, const MeshRange& mesh,
+        const glm::mat4& model, const glm::vec2& uvScale, const BoundingBox& bounds, float depth01, GLuint conditionQuery = 0)
+    {
+        glm::mat4 drawModel = mesh.QuantizedPositions ? compactModelMatrix(model, mesh.PositionOffset, mesh.PositionScale) : model;
+        glm::vec4 uvTransform = mesh.QuantizedPositions ? glm::vec4(uvScale * mesh.TexCoordScale, uvScale * mesh.TexCoordOffset)
+            : glm::vec4(uvScale, 0.0f, 0.0f);
+        DrawCommand command = { drawModel, uvTransform, program, texture, mesh, bounds, conditionQuery };
+        DrawItem item = { MakeKey(pass, program, texture, mesh.Id, depth01), (uint32_t)commands.size() };
+        commands.push_back(command);
+        items.push_back(item);
+    }
+
+    // builds a sort key. Ids are masked to their field width; a collision only costs an extra bind or a split batch.
+    // Prepass draws sort by depth bucket first, so the pass runs front to back while a bucket still batches by mesh
+    static uint64_t MakeKey(RenderPass pass, GLuint program, GLuint texture, GLuint mesh, float depth01)
+    {
+        depth01 = depth01 < 0.0f ? 0.0f : (depth01 > 1.0f ? 1.0f : depth01);
+        uint64_t depth = (uint64_t)(depth01 * (float)DEPTH_MASK);
+        if (pass == RENDER_PASS_DEPTH)
+        {
+            program = (GLuint)(depth01 * (float)(DEPTH_BUCKETS - 1));
+            texture = 0;
+        }
+
+        return ((uint64_t)(pass & 0xF) << PASS_SHIFT)
+            | ((uint64_t)(program & 0xFF) << PROGRAM_SHIFT)
+            | ((uint64_t)(texture & 0xFFF) << TEXTURE_SHIFT)
+            | ((uint64_t)(mesh & 0xFFF) << MESH_SHIFT)
+            | (depth & DEPTH_MASK);
+    }
+
+    // orders the submitted items by key with an 8-bit LSD radix sort
+    void Sort()
+    {
+        scratch.resize(items.size());
+        DrawItem* src = items.data();
+        DrawItem* dst = scratch.data();
+        const size_t count = items.size();
+
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t histogram[256] = {};
+            for (size_t i = 0; i < count; ++i)
+                ++histogram[(src[i].Key >> shift) & 0xFF];
+
+            // Every key shares this digit, so the pass would only copy; skip it
+            if (count == 0 || histogram[(src[0].Key >> shift) & 0xFF] == count)
+                continue;
+
+            size_t offset = 0;
+            for (int digit = 0; digit < 256; ++digit)
+            {
+                size_t bucket = histogram[digit];
+                histogram[digit] = offset;
+                offset += bucket;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+                dst[histogram[(src[i].Key >> shift) & 0xFF]++] = src[i];
+
+            DrawItem* swap = src;
+            src = dst;
+            dst = swap;
+        }
+
+        // An odd number of scatter passes leaves the result in the scratch buffer
+        if (src != items.data())
+            std::memcpy(items.data(), src, count * sizeof(DrawItem));
+    }
+
+    // sorted items of the current frame, valid after Sort
+    const std::vector<DrawItem>& Items() const
+    {
+        return items;
+    }
+
+    // command an item refers to
+    const DrawCommand& Command(uint32_t index) const
+    {
+        return commands[index];
+    }
+
+    // pass a sort key belongs to
+    static RenderPass KeyPass(uint64_t key)
+    {
+        return (RenderPass)(key >> PASS_SHIFT);
+    }
+
+    // merges sorted draws that share program, texture and mesh into instanced draws and issues them,
+    // binding programs, textures and VAOs only when they change. Meshes in one geometry arena share a VAO.
+    // passMask selects passes by bit (1 << pass), so a pass drawn some other way can be left out
+    void Execute(unsigned passMask = ~0u)
+    {
+        buildBatches(passMask);
+
+        // One upload per frame for every instance of every batch; orphaning avoids waiting on last frame's draws
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        GLuint currentProgram = ~0u;
+        GLuint currentTexture = ~0u;
+        GLuint currentVao = ~0u;
+
+        glActiveTexture(GL_TEXTURE0);
+
+        for (size_t i = 0; i < batches.size(); ++i)
+        {
+            const DrawBatch& batch = batches[i];
+            const DrawCommand& command = commands[batch.Command];
+
+            if (command.Program != currentProgram)
+            {
+                currentProgram = command.Program;
+                programs[currentProgram]->Use();
+                ++Stats.ProgramBinds;
+            }
+            if (command.Texture != 0 && command.Texture != currentTexture)
+            {
+                currentTexture = command.Texture;
+                glBindTexture(GL_TEXTURE_2D, currentTexture);
+                ++Stats.TextureBinds;
+            }
+            if (command.Mesh.Vao != currentVao)
+            {
+                currentVao = command.Mesh.Vao;
+                glBindVertexArray(currentVao);
+                ++Stats.VaoBinds;
+            }
+            else
+                ++Stats.VaoBindsElided;
+
+            // No wait: a result still in flight draws the object rather than stalling
+            if (command.Query != 0)
+            {
+                glBeginConditionalRender(command.Query, GL_QUERY_NO_WAIT);
+                ++Stats.ConditionalDraws;
+            }
+
+            const MeshRange& mesh = command.Mesh;
+            GLsizeiptr indexSize = mesh.IndexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, mesh.IndexCount, mesh.IndexType,
+                (void*)(mesh.FirstIndex * indexSize), batch.InstanceCount, mesh.BaseVertex, batch.BaseInstance);
+            ++Stats.Draws;
+
+            if (command.Query != 0)
+                glEndConditionalRender();
+        }
+        Stats.Instances += (unsigned)instances.size();
+    }
+
+private:
+    GLuint instanceVbo = 0;
+    std::vector<const ShaderProgram*> programs;
+    std::vector<DrawCommand> commands;
+    std::vector<DrawItem> items;
+    std::vector<DrawItem> scratch;
+    std::vector<DrawBatch> batches;
+    std::vector<InstanceData> instances;
+
+    // true if two commands can be drawn by the same instanced call. Conditional draws are always drawn alone
+    static bool sameBatch(const DrawCommand& a, const DrawCommand& b)
+    {
+        return a.Program == b.Program && a.Texture == b.Texture && a.Mesh.Id == b.Mesh.Id && a.Mesh.Vao == b.Mesh.Vao
+            && a.Query == 0 && b.Query == 0;
+    }
+
+    // walks the sorted items, which keeps equal state adjacent, and packs their instance data batch by batch
+    void buildBatches(unsigned passMask)
+    {
+        batches.clear();
+        instances.clear();
+
+        uint64_t batchState = 0;
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            if ((passMask & (1u << KeyPass(items[i].Key))) == 0)
+                continue;
+
+            const DrawCommand& command = commands[items[i].Index];
+            uint64_t state = items[i].Key >> MESH_SHIFT; // Pass, program, texture and mesh; depth is ignored
+
+            if (batches.empty() || state != batchState || !sameBatch(commands[batches.back().Command], command))
+            {
+                DrawBatch batch = { items[i].Index, (GLuint)instances.size(), 0 };
+                batches.push_back(batch);
+                batchState = state;
+            }
+
+            InstanceData instance = { command.Model, command.UVTransform };
+            instances.push_back(instance);
+            ++batches.back().InstanceCount;
+        }
+    }
+};
+#endif
@@ -0,0 +1,605 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "frustum.h"
+
+// Index meaning "no node" or "no item"
+const uint32_t BVH_INVALID = 0xFFFFFFFFu;
+
+// Closest item a ray query found
+struct RayHit
+{
+    uint32_t Item;
+    float Distance;
+};
+
+
+// surface area of a box, the SAH's estimate of how often a random ray or query touches it
+inline float boxArea(const BoundingBox& box)
+{
+    glm::vec3 size = glm::max(box.Max - box.Min, glm::vec3(0.0f));
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// smallest box around two boxes
+inline BoundingBox boxUnion(const BoundingBox& a, const BoundingBox& b)
+{
+    BoundingBox result;
+    result.Min = glm::min(a.Min, b.Min);
+    result.Max = glm::max(a.Max, b.Max);
+    return result;
+}
+
+inline bool boxesOverlap(const BoundingBox& a, const BoundingBox& b)
+{
+    return a.Min.x <= b.Max.x && a.Max.x >= b.Min.x && a.Min.y <= b.Max.y && a.Max.y >= b.Min.y
+        && a.Min.z <= b.Max.z && a.Max.z >= b.Min.z;
+}
+
+// distance along a ray to where it enters a box, or a negative value if it misses within maxDistance.
+// inverseDirection is 1 / direction per component; zero components become infinities, which the slab test handles
+inline float rayBoxDistance(const glm::vec3& origin, const glm::vec3& inverseDirection, const BoundingBox& box, float maxDistance)
+{
+    float enter = 0.0f, leave = maxDistance;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float t0 = (box.Min[axis] - origin[axis]) * inverseDirection[axis];
+        float t1 = (box.Max[axis] - origin[axis]) * inverseDirection[axis];
+        if (t0 > t1)
+            std::swap(t0, t1);
+        // NaN from 0 * infinity (origin on a slab of a parallel ray) leaves the interval unchanged
+        enter = t0 > enter ? t0 : enter;
+        leave = t1 < leave ? t1 : leave;
+    }
+    return enter <= leave ? enter : -1.0f;
+}
+
+
+// Bounding volume hierarchy over the boxes of many items (scene objects), identified by index.
+// Build() bulk-builds with the binned surface area heuristic. Insert(), Remove() and Update() then keep the tree valid
+// incrementally: moved items refit their ancestors, and new items join the sibling that grows the tree least.
+// Incremental changes slowly lower quality, so Maintain() rebuilds once the SAH cost has grown by RebuildThreshold
+class SceneBvh
+{
+public:
+    static const uint32_t MAX_LEAF_ITEMS = 4;
+    float RebuildThreshold = 1.5f;
+
+    // builds the tree over boxes[i] for every i; replaces any previous contents
+    void Build(const std::vector<BoundingBox>& boxes)
+    {
+        itemBoxes = boxes;
+        itemLeaf.assign(boxes.size(), BVH_INVALID);
+        itemIndices.clear();
+        for (uint32_t i = 0; i < (uint32_t)boxes.size(); ++i)
+            itemIndices.push_back(i);
+        rebuild();
+    }
+
+    // rebuilds from the current item boxes
+    void Rebuild()
+    {
+        itemIndices.clear();
+        for (uint32_t i = 0; i < (uint32_t)itemBoxes.size(); ++i)
+        {
+            if (itemLeaf[i] != BVH_INVALID)
+                itemIndices.push_back(i);
+        }
+        rebuild();
+    }
+
+    // rebuilds when incremental changes have made the tree noticeably worse than a fresh build; returns whether it did
+    bool Maintain()
+    {
+        if (root == BVH_INVALID || Cost() <= builtCost * RebuildThreshold)
+            return false;
+        Rebuild();
+        return true;
+    }
+
+    // SAH cost of the tree relative to its root area: expected node visits plus item tests of a random query
+    float Cost() const
+    {
+        if (root == BVH_INVALID)
+            return 0.0f;
+        float rootArea = boxArea(nodes[root].Bounds);
+        if (rootArea <= 0.0f)
+            return 0.0f;
+
+        float cost = 0.0f;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            const Node& node = nodes[i];
+            if (node.Parent == FREE)
+                continue;
+            cost += boxArea(node.Bounds) / rootArea * (node.Left == BVH_INVALID ? (float)node.Count : 1.0f);
+        }
+        return cost;
+    }
+
+    // number of item slots, including removed ones
+    size_t ItemCapacity() const { return itemBoxes.size(); }
+
+    // adds an item and returns its index
+    uint32_t Insert(const BoundingBox& box)
+    {
+        uint32_t item = (uint32_t)itemBoxes.size();
+        itemBoxes.push_back(box);
+        itemLeaf.push_back(BVH_INVALID);
+
+        uint32_t leaf = allocateNode();
+        nodes[leaf].Bounds = box;
+        nodes[leaf].First = (uint32_t)itemIndices.size();
+        nodes[leaf].Count = 1;
+        itemIndices.push_back(item);
+        itemLeaf[item] = leaf;
+
+        if (root == BVH_INVALID)
+        {
+            root = leaf;
+            nodes[leaf].Parent = BVH_INVALID;
+            builtCost = 1.0f;
+            return item;
+        }
+
+        // Descend towards the cheapest sibling: the cost of pairing with a node is its grown area,
+        // plus the growth every ancestor on the way has to absorb
+        uint32_t sibling = root;
+        float inheritedCost = 0.0f;
+        while (nodes[sibling].Left != BVH_INVALID)
+        {
+            const Node& node = nodes[sibling];
+            float combinedArea = boxArea(boxUnion(node.Bounds, box));
+            float pairHere = combinedArea + inheritedCost;
+            float childInherited = inheritedCost + combinedArea - boxArea(node.Bounds);
+
+            float descendCost[2];
+            uint32_t children[2] = { node.Left, node.Right };
+            for (int c = 0; c < 2; ++c)
+            {
+                const Node& child = nodes[children[c]];
+                float grown = boxArea(boxUnion(child.Bounds, box));
+                descendCost[c] = child.Left == BVH_INVALID ? grown + childInherited : grown - boxArea(child.Bounds) + childInherited;
+            }
+            if (pairHere <= descendCost[0] && pairHere <= descendCost[1])
+                break;
+            sibling = descendCost[0] <= descendCost[1] ? children[0] : children[1];
+            inheritedCost = childInherited;
+        }
+
+        // New parent takes the sibling's place
+        uint32_t oldParent = nodes[sibling].Parent;
+        uint32_t parent = allocateNode();
+        nodes[parent].Parent = oldParent;
+        nodes[parent].Left = sibling;
+        nodes[parent].Right = leaf;
+        nodes[parent].Count = 0;
+        nodes[sibling].Parent = parent;
+        nodes[leaf].Parent = parent;
+        if (oldParent == BVH_INVALID)
+            root = parent;
+        else if (nodes[oldParent].Left == sibling)
+            nodes[oldParent].Left = parent;
+        else
+            nodes[oldParent].Right = parent;
+
+        refitUpwards(parent);
+        return item;
+    }
+
+    // removes an item; its index is not reused
+    void Remove(uint32_t item)
+    {
+        if (item >= itemLeaf.size() || itemLeaf[item] == BVH_INVALID)
+            return;
+        uint32_t leaf = itemLeaf[item];
+        itemLeaf[item] = BVH_INVALID;
+
+        // Swap the item to the end of the leaf's range and shrink it
+        Node& node = nodes[leaf];
+        for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+        {
+            if (itemIndices[i] == item)
+            {
+                std::swap(itemIndices[i], itemIndices[node.First + node.Count - 1]);
+                break;
+            }
+        }
+        --node.Count;
+        if (node.Count > 0)
+        {
+            refitUpwards(leaf);
+            return;
+        }
+
+        // Empty leaf: its sibling replaces their parent
+        uint32_t parent = node.Parent;
+        freeNode(leaf);
+        if (parent == BVH_INVALID)
+        {
+            root = BVH_INVALID;
+            return;
+        }
+        uint32_t sibling = nodes[parent].Left == leaf ? nodes[parent].Right : nodes[parent].Left;
+        uint32_t grandparent = nodes[parent].Parent;
+        nodes[sibling].Parent = grandparent;
+        if (grandparent == BVH_INVALID)
+            root = sibling;
+        else if (nodes[grandparent].Left == parent)
+            nodes[grandparent].Left = sibling;
+        else
+            nodes[grandparent].Right = sibling;
+        freeNode(parent);
+        if (grandparent != BVH_INVALID)
+            refitUpwards(grandparent);
+    }
+
+    // moves an item to new bounds, refitting its ancestors
+    void Update(uint32_t item, const BoundingBox& box)
+    {
+        if (item >= itemLeaf.size() || itemLeaf[item] == BVH_INVALID)
+            return;
+        itemBoxes[item] = box;
+        refitUpwards(itemLeaf[item]);
+    }
+
+    // calls visit(item) for every item whose box intersects the frustum. Subtrees entirely inside are
+    // reported without testing their items, subtrees entirely outside are skipped
+    template <typename Visit>
+    void QueryFrustum(const Frustum& frustum, Visit visit) const
+    {
+        if (root == BVH_INVALID)
+            return;
+        // Nodes known to be inside carry INSIDE_BIT on the stack and skip all further tests
+        std::vector<uint32_t> stack(1, root);
+        while (!stack.empty())
+        {
+            uint32_t entry = stack.back();
+            stack.pop_back();
+            uint32_t inside = entry & INSIDE_BIT;
+            const Node& node = nodes[entry & ~INSIDE_BIT];
+
+            if (!inside)
+            {
+                Frustum::Containment containment = frustum.ClassifyBox(node.Bounds);
+                if (containment == Frustum::OUTSIDE)
+                    continue;
+                if (containment == Frustum::INSIDE)
+                    inside = INSIDE_BIT;
+            }
+
+            if (node.Left != BVH_INVALID)
+            {
+                stack.push_back(node.Right | inside);
+                stack.push_back(node.Left | inside);
+                continue;
+            }
+            for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+            {
+                if (inside || frustum.IntersectsBox(itemBoxes[itemIndices[i]]))
+                    visit(itemIndices[i]);
+            }
+        }
+    }
+
+    // calls visit(item) for every item whose box overlaps a box
+    template <typename Visit>
+    void QueryBox(const BoundingBox& box, Visit visit) const
+    {
+        if (root == BVH_INVALID)
+            return;
+        std::vector<uint32_t> stack(1, root);
+        while (!stack.empty())
+        {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!boxesOverlap(node.Bounds, box))
+                continue;
+            if (node.Left != BVH_INVALID)
+            {
+                stack.push_back(node.Right);
+                stack.push_back(node.Left);
+                continue;
+            }
+            for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+            {
+                if (boxesOverlap(itemBoxes[itemIndices[i]], box))
+                    visit(itemIndices[i]);
+            }
+        }
+    }
+
+    // calls visit(item) for every item whose box comes within radius of a point
+    template <typename Visit>
+    void QuerySphere(const glm::vec3& center, float radius, Visit visit) const
+    {
+        BoundingBox bounds;
+        bounds.Min = center - glm::vec3(radius);
+        bounds.Max = center + glm::vec3(radius);
+        float radiusSquared = radius * radius;
+        QueryBox(bounds, [&](uint32_t item) {
+            const BoundingBox& box = itemBoxes[item];
+            glm::vec3 offset = center - glm::clamp(center, box.Min, box.Max);
+            if (glm::dot(offset, offset) <= radiusSquared)
+                visit(item);
+        });
+    }
+
+    // finds the closest item along a ray within maxDistance. test(item, closestSoFar) returns the distance at which
+    // the ray hits the item itself, or a negative value for a miss, so callers can intersect exact geometry.
+    // Children are visited nearest first, and nodes beyond the closest hit are skipped
+    template <typename ItemTest>
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, ItemTest test, RayHit& hit) const
+    {
+        hit.Item = BVH_INVALID;
+        hit.Distance = maxDistance;
+        if (root == BVH_INVALID)
+            return false;
+
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        std::vector<uint32_t> stack(1, root);
+        while (!stack.empty())
+        {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (rayBoxDistance(origin, inverseDirection, node.Bounds, hit.Distance) < 0.0f)
+                continue;
+
+            if (node.Left != BVH_INVALID)
+            {
+                float left = rayBoxDistance(origin, inverseDirection, nodes[node.Left].Bounds, hit.Distance);
+                float right = rayBoxDistance(origin, inverseDirection, nodes[node.Right].Bounds, hit.Distance);
+                // Push the farther child first so the nearer one is popped next
+                if (left >= 0.0f && right >= 0.0f)
+                {
+                    stack.push_back(left <= right ? node.Right : node.Left);
+                    stack.push_back(left <= right ? node.Left : node.Right);
+                }
+                else if (left >= 0.0f)
+                    stack.push_back(node.Left);
+                else if (right >= 0.0f)
+                    stack.push_back(node.Right);
+                continue;
+            }
+
+            for (uint32_t i = node.First; i < node.First + node.Count; ++i)
+            {
+                uint32_t item = itemIndices[i];
+                if (rayBoxDistance(origin, inverseDirection, itemBoxes[item], hit.Distance) < 0.0f)
+                    continue;
+                float distance = test(item, hit.Distance);
+                if (distance >= 0.0f && distance < hit.Distance)
+                {
+                    hit.Item = item;
+                    hit.Distance = distance;
+                }
+            }
+        }
+        return hit.Item != BVH_INVALID;
+    }
+
+    // closest item box along a ray
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, RayHit& hit) const
+    {
+        glm::vec3 inverseDirection(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        return Raycast(origin, direction, maxDistance, [&](uint32_t item, float closest) {
+            return rayBoxDistance(origin, inverseDirection, itemBoxes[item], closest);
+        }, hit);
+    }
+
+private:
+    static const uint32_t FREE = 0xFFFFFFFEu; // Parent value marking a node on the free list
+    static const int SAH_BINS = 12;
+    static const uint32_t INSIDE_BIT = 0x80000000u; // Frustum traversal flag; node indices stay below it
+
+    // Internal nodes have two children; leaves (Left == BVH_INVALID) own itemIndices[First, First + Count)
+    struct Node
+    {
+        BoundingBox Bounds;
+        uint32_t Parent;
+        uint32_t Left;
+        uint32_t Right;
+        uint32_t First;
+        uint32_t Count;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeNodes;
+    std::vector<uint32_t> itemIndices;      // Items grouped by leaf
+    std::vector<BoundingBox> itemBoxes;
+    std::vector<uint32_t> itemLeaf;         // Leaf holding each item, BVH_INVALID once removed
+    uint32_t root = BVH_INVALID;
+    float builtCost = 0.0f;
+
+    uint32_t allocateNode()
+    {
+        Node node = { BoundingBox(), BVH_INVALID, BVH_INVALID, BVH_INVALID, 0, 0 };
+        if (!freeNodes.empty())
+        {
+            uint32_t index = freeNodes.back();
+            freeNodes.pop_back();
+            nodes[index] = node;
+            return index;
+        }
+        nodes.push_back(node);
+        return (uint32_t)nodes.size() - 1;
+    }
+
+    void freeNode(uint32_t index)
+    {
+        nodes[index].Parent = FREE;
+        freeNodes.push_back(index);
+    }
+
+    // recomputes the bounds of a node and its ancestors, stopping once a node's bounds come out unchanged
+    void refitUpwards(uint32_t index)
+    {
+        while (index != BVH_INVALID)
+        {
+            Node& node = nodes[index];
+            BoundingBox bounds;
+            if (node.Left != BVH_INVALID)
+            {
+                bounds = boxUnion(nodes[node.Left].Bounds, nodes[node.Right].Bounds);
+            }
+            else
+            {
+                bounds = itemBoxes[itemIndices[node.First]];
+                for (uint32_t i = node.First + 1; i < node.First + node.Count; ++i)
+                    bounds = boxUnion(bounds, itemBoxes[itemIndices[i]]);
+            }
+            if (bounds.Min == node.Bounds.Min && bounds.Max == node.Bounds.Max)
+                return;
+            node.Bounds = bounds;
+            index = node.Parent;
+        }
+    }
+
+    void rebuild()
+    {
+        nodes.clear();
+        freeNodes.clear();
+        root = BVH_INVALID;
+        if (itemIndices.empty())
+        {
+            builtCost = 0.0f;
+            return;
+        }
+
+        std::vector<glm::vec3> centroids(itemBoxes.size());
+        for (size_t i = 0; i < itemIndices.size(); ++i)
+        {
+            const BoundingBox& box = itemBoxes[itemIndices[i]];
+            centroids[itemIndices[i]] = 0.5f * (box.Min + box.Max);
+        }
+
+        root = allocateNode();
+        buildNode(root, BVH_INVALID, 0, (uint32_t)itemIndices.size(), centroids);
+        builtCost = Cost();
+    }
+
+    // splits itemIndices[first, first + count) at the cheapest of SAH_BINS candidate planes per axis,
+    // or makes a leaf when no split beats testing the items directly
+    void buildNode(uint32_t index, uint32_t parent, uint32_t first, uint32_t count, const std::vector<glm::vec3>& centroids)
+    {
+        BoundingBox bounds = itemBoxes[itemIndices[first]];
+        BoundingBox centroidBounds;
+        centroidBounds.Min = centroidBounds.Max = centroids[itemIndices[first]];
+        for (uint32_t i = first + 1; i < first + count; ++i)
+        {
+            bounds = boxUnion(bounds, itemBoxes[itemIndices[i]]);
+            centroidBounds.Min = glm::min(centroidBounds.Min, centroids[itemIndices[i]]);
+            centroidBounds.Max = glm::max(centroidBounds.Max, centroids[itemIndices[i]]);
+        }
+
+        nodes[index].Bounds = bounds;
+        nodes[index].Parent = parent;
+
+        if (count <= MAX_LEAF_ITEMS)
+        {
+            makeLeaf(index, first, count);
+            return;
+        }
+
+        // Evaluate every bin boundary of every axis; cost in units of one item test, relative to this node's area
+        int bestAxis = -1, bestSplit = 0;
+        float bestCost = (float)count;
+        glm::vec3 extent = centroidBounds.Max - centroidBounds.Min;
+        float nodeArea = boxArea(bounds);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (extent[axis] <= 0.0f)
+                continue;
+
+            BoundingBox binBounds[SAH_BINS];
+            uint32_t binCounts[SAH_BINS] = {};
+            float binScale = SAH_BINS / extent[axis];
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                uint32_t item = itemIndices[i];
+                int bin = std::min(SAH_BINS - 1, (int)((centroids[item][axis] - centroidBounds.Min[axis]) * binScale));
+                binBounds[bin] = binCounts[bin] == 0 ? itemBoxes[item] : boxUnion(binBounds[bin], itemBoxes[item]);
+                ++binCounts[bin];
+            }
+
+            // Sweep from the right to get the right side of every split, then from the left
+            float rightArea[SAH_BINS];
+            uint32_t rightCount[SAH_BINS];
+            BoundingBox accumulated;
+            uint32_t accumulatedCount = 0;
+            for (int bin = SAH_BINS - 1; bin > 0; --bin)
+            {
+                if (binCounts[bin] > 0)
+                    accumulated = accumulatedCount == 0 ? binBounds[bin] : boxUnion(accumulated, binBounds[bin]);
+                accumulatedCount += binCounts[bin];
+                rightArea[bin] = accumulatedCount > 0 ? boxArea(accumulated) : 0.0f;
+                rightCount[bin] = accumulatedCount;
+            }
+
+            accumulatedCount = 0;
+            for (int split = 1; split < SAH_BINS; ++split)
+            {
+                int bin = split - 1;
+                if (binCounts[bin] > 0)
+                    accumulated = accumulatedCount == 0 ? binBounds[bin] : boxUnion(accumulated, binBounds[bin]);
+                accumulatedCount += binCounts[bin];
+                if (accumulatedCount == 0 || rightCount[split] == 0)
+                    continue;
+
+                float cost = 1.0f + (boxArea(accumulated) * accumulatedCount + rightArea[split] * rightCount[split]) / nodeArea;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if (bestAxis < 0)
+        {
+            // No split pays off, or every centroid coincides. Keep moderately sized leaves; split larger ones in half
+            if (count <= MAX_LEAF_ITEMS * 4)
+            {
+                makeLeaf(index, first, count);
+                return;
+            }
+            middle = first + count / 2;
+        }
+        else
+        {
+            float binScale = SAH_BINS / extent[bestAxis];
+            uint32_t* begin = &itemIndices[first];
+            uint32_t* split = std::partition(begin, begin + count, [&](uint32_t item) {
+                int bin = std::min(SAH_BINS - 1, (int)((centroids[item][bestAxis] - centroidBounds.Min[bestAxis]) * binScale));
+                return bin < bestSplit;
+            });
+            middle = first + (uint32_t)(split - begin);
+        }
+
+        uint32_t left = allocateNode();
+        uint32_t right = allocateNode();
+        nodes[index].Left = left;
+        nodes[index].Right = right;
+        nodes[index].Count = 0;
+        buildNode(left, index, first, middle - first, centroids);
+        buildNode(right, index, middle, first + count - middle, centroids);
+    }
+
+    void makeLeaf(uint32_t index, uint32_t first, uint32_t count)
+    {
+        nodes[index].First = first;
+        nodes[index].Count = count;
+        for (uint32_t i = first; i < first + count; ++i)
+            itemLeaf[itemIndices[i]] = index;
+    }
+};
+#endif
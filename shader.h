@@ -0,0 +1,189 @@
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Passes a value to a uniform location of the program currently in use. One overload per supported uniform type
+inline void setUniformValue(GLint location, const glm::mat4& value) { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+inline void setUniformValue(GLint location, const glm::vec4& value) { glUniform4fv(location, 1, glm::value_ptr(value)); }
+inline void setUniformValue(GLint location, const glm::vec3& value) { glUniform3fv(location, 1, glm::value_ptr(value)); }
+inline void setUniformValue(GLint location, const glm::vec2& value) { glUniform2fv(location, 1, glm::value_ptr(value)); }
+inline void setUniformValue(GLint location, const GLfloat& value) { glUniform1f(location, value); }
+inline void setUniformValue(GLint location, const GLint& value) { glUniform1i(location, value); }
+inline void setUniformValue(GLint location, const GLuint& value) { glUniform1ui(location, value); }
+
+// Returns true if a reflected GL uniform type can be written through a handle of type T
+template <typename T> inline bool uniformTypeMatches(GLenum type);
+template <> inline bool uniformTypeMatches<glm::mat4>(GLenum type) { return type == GL_FLOAT_MAT4; }
+template <> inline bool uniformTypeMatches<glm::vec4>(GLenum type) { return type == GL_FLOAT_VEC4; }
+template <> inline bool uniformTypeMatches<glm::vec3>(GLenum type) { return type == GL_FLOAT_VEC3; }
+template <> inline bool uniformTypeMatches<glm::vec2>(GLenum type) { return type == GL_FLOAT_VEC2; }
+template <> inline bool uniformTypeMatches<GLfloat>(GLenum type) { return type == GL_FLOAT; }
+template <> inline bool uniformTypeMatches<GLuint>(GLenum type) { return type == GL_UNSIGNED_INT; }
+template <> inline bool uniformTypeMatches<GLint>(GLenum type)
+{
+    // Samplers and images are bound to texture units through integer uniforms
+    switch (type)
+    {
+    case GL_INT: case GL_BOOL:
+    case GL_SAMPLER_2D: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_SHADOW:
+    case GL_IMAGE_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+// Typed handle to a uniform location resolved once at link time
+template <typename T>
+struct Uniform
+{
+    GLint Location = -1;
+
+    // passes the value to the program currently in use. Inactive uniforms (location -1) are ignored by GL
+    void Set(const T& value) const
+    {
+        setUniformValue(Location, value);
+    }
+};
+
+
+// A linked shader program together with the active uniforms and blocks reflected from it
+class ShaderProgram
+{
+public:
+    // Reflected description of an active uniform in the default block
+    struct UniformInfo
+    {
+        GLint Location;
+        GLenum Type;
+        GLint ArraySize;
+    };
+
+    // Reflected description of a uniform or shader storage block
+    struct BlockInfo
+    {
+        GLuint Index;
+        GLint Binding;
+        GLint DataSize;
+    };
+
+    GLuint ID = 0;
+    std::unordered_map<std::string, UniformInfo> Uniforms;
+    std::unordered_map<std::string, BlockInfo> UniformBlocks;
+    std::unordered_map<std::string, BlockInfo> StorageBlocks;
+
+    // queries every active uniform, uniform block and storage block of a linked program
+    void Reflect(GLuint programId)
+    {
+        ID = programId;
+        Uniforms.clear();
+        UniformBlocks.clear();
+        StorageBlocks.clear();
+
+        GLint count = 0;
+        GLint maxNameLength = 0;
+        glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(ID, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxNameLength);
+        std::vector<char> name(maxNameLength > 0 ? maxNameLength : 1);
+
+        const GLenum uniformProps[] = { GL_BLOCK_INDEX, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE };
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint values[4];
+            glGetProgramResourceiv(ID, GL_UNIFORM, i, 4, uniformProps, 4, NULL, values);
+
+            // Members of uniform blocks have no location; they are written through buffers instead
+            if (values[0] != -1)
+                continue;
+
+            glGetProgramResourceName(ID, GL_UNIFORM, i, (GLsizei)name.size(), NULL, name.data());
+            UniformInfo info = { values[2], (GLenum)values[1], values[3] };
+            Uniforms[stripArraySuffix(name.data())] = info;
+        }
+
+        reflectBlocks(GL_UNIFORM_BLOCK, GL_BUFFER_BINDING, UniformBlocks);
+        reflectBlocks(GL_SHADER_STORAGE_BLOCK, GL_BUFFER_BINDING, StorageBlocks);
+    }
+
+    // returns a handle for an active uniform. Called once after linking, never from the draw loop
+    template <typename T>
+    Uniform<T> GetUniform(const char* name) const
+    {
+        Uniform<T> handle;
+        std::unordered_map<std::string, UniformInfo>::const_iterator it = Uniforms.find(name);
+        if (it == Uniforms.end())
+        {
+            // Not fatal: GLSL compilers strip uniforms that do not contribute to the output
+            std::cout << "WARNING::SHADER::UNIFORM_NOT_ACTIVE: " << name << std::endl;
+            return handle;
+        }
+        if (!uniformTypeMatches<T>(it->second.Type))
+        {
+            std::cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH: " << name << std::endl;
+            return handle;
+        }
+        handle.Location = it->second.Location;
+        return handle;
+    }
+
+    // returns true if the program declares the named uniform block at the expected binding point
+    bool HasUniformBlock(const char* name, GLint binding) const
+    {
+        std::unordered_map<std::string, BlockInfo>::const_iterator it = UniformBlocks.find(name);
+        return it != UniformBlocks.end() && it->second.Binding == binding;
+    }
+
+    // selects the program for rendering
+    void Use() const
+    {
+        glUseProgram(ID);
+    }
+
+    // deletes the GL program object
+    void Destroy()
+    {
+        glDeleteProgram(ID);
+        ID = 0;
+    }
+
+private:
+    // GL reports array uniforms as "name[0]"; handles are looked up by the plain name
+    static std::string stripArraySuffix(const char* name)
+    {
+        std::string result(name);
+        std::string::size_type bracket = result.find('[');
+        if (bracket != std::string::npos)
+            result.erase(bracket);
+        return result;
+    }
+
+    void reflectBlocks(GLenum programInterface, GLenum bindingProp, std::unordered_map<std::string, BlockInfo>& blocks)
+    {
+        GLint count = 0;
+        GLint maxNameLength = 0;
+        glGetProgramInterfaceiv(ID, programInterface, GL_ACTIVE_RESOURCES, &count);
+        glGetProgramInterfaceiv(ID, programInterface, GL_MAX_NAME_LENGTH, &maxNameLength);
+        std::vector<char> name(maxNameLength > 0 ? maxNameLength : 1);
+
+        const GLenum blockProps[] = { bindingProp, GL_BUFFER_DATA_SIZE };
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLint values[2];
+            glGetProgramResourceiv(ID, programInterface, i, 2, blockProps, 2, NULL, values);
+            glGetProgramResourceName(ID, programInterface, i, (GLsizei)name.size(), NULL, name.data());
+
+            BlockInfo info = { (GLuint)i, values[0], values[1] };
+            blocks[name.data()] = info;
+        }
+    }
+};
+#endif
@@ -0,0 +1,378 @@
+#ifndef SOFTWARE_OCCLUSION_H
+#define SOFTWARE_OCCLUSION_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "frustum.h"
+#include "thread_pool.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SOFTWARE_OCCLUSION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Resolution of the occlusion depth buffer and of the tiles rasterized in parallel. Tile width is a multiple of 4,
+// the SIMD width, so a 4-pixel span never straddles two tiles
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = 192;
+const int OCCLUSION_TILE_WIDTH = 64;
+const int OCCLUSION_TILE_HEIGHT = 32;
+const int OCCLUSION_TILES_X = OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH;
+const int OCCLUSION_TILES_Y = OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT;
+const size_t OCCLUSION_TEST_CHUNK = 64; // Occludees tested per task
+
+// Counters of the last frame
+struct SoftwareOcclusionStats
+{
+    unsigned Occluders;
+    unsigned Triangles;     // Occluder triangles left after near clipping and binned
+    unsigned Tested;
+    unsigned Occluded;
+};
+
+
+// CPU occlusion culling in the spirit of masked occlusion culling, so occlusion never waits on the GPU.
+// A few occluder meshes are transformed, clipped against the near plane and binned into screen tiles; worker threads
+// then rasterize the tiles independently into a low resolution depth buffer, 4 pixels per SIMD step. Rasterization is
+// conservative for culling: a pixel is only written when the triangle covers all of it, with the farthest depth the
+// triangle reaches over that pixel. Occludees are tested by the screen rectangle and nearest depth of their world box,
+// first against the farthest depth of each tile, then pixel by pixel
+class SoftwareOcclusion
+{
+public:
+    ThreadPool* Workers = nullptr;  // Runs tiles and tests in parallel; everything runs on the caller when null
+    SoftwareOcclusionStats Stats = {};
+
+    SoftwareOcclusion()
+        : depth(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f), bins(OCCLUSION_TILES_X * OCCLUSION_TILES_Y),
+        tileFarthest(OCCLUSION_TILES_X * OCCLUSION_TILES_Y, 1.0f)
+    {
+    }
+
+    // starts a frame seen through a view-projection matrix; occluders added from here on are rasterized by Rasterize
+    void Begin(const glm::mat4& viewProjection)
+    {
+        frameViewProjection = viewProjection;
+        triangles.clear();
+        for (size_t i = 0; i < bins.size(); ++i)
+            bins[i].clear();
+        Stats = SoftwareOcclusionStats();
+    }
+
+    // transforms an occluder's triangles to the screen and bins them. Positions are in object space
+    void AddOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, const glm::mat4& model)
+    {
+        transformPositions(positions, frameViewProjection * model);
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            clipTriangle(clip[indices[i]], clip[indices[i + 1]], clip[indices[i + 2]]);
+        ++Stats.Occluders;
+        Stats.Triangles = (unsigned)triangles.size();
+    }
+
+    // clears the depth buffer and rasterizes every binned triangle, one tile per task
+    void Rasterize()
+    {
+        forEach(bins.size(), [this](size_t tile) { rasterizeTile(tile); });
+    }
+
+    // false when a world box is entirely hidden behind the rasterized occluders
+    bool TestBox(const BoundingBox& box) const
+    {
+        glm::vec2 screenMin(1e30f), screenMax(-1e30f);
+        float nearest = 1.0f;
+        for (int i = 0; i < 8; ++i)
+        {
+            glm::vec3 corner(i & 1 ? box.Max.x : box.Min.x, i & 2 ? box.Max.y : box.Min.y, i & 4 ? box.Max.z : box.Min.z);
+            glm::vec4 p = frameViewProjection * glm::vec4(corner, 1.0f);
+
+            // A corner behind the eye has no meaningful projection; the box straddles the camera and is kept
+            if (p.w <= 0.0f)
+                return true;
+
+            glm::vec3 screen = toScreen(p);
+            screenMin = glm::min(screenMin, glm::vec2(screen.x, screen.y));
+            screenMax = glm::max(screenMax, glm::vec2(screen.x, screen.y));
+            nearest = std::min(nearest, screen.z);
+        }
+        if (nearest <= 0.0f)
+            return true; // Reaches the near plane
+
+        // Every pixel the rectangle touches, not only those it covers
+        int x0 = std::max(0, (int)std::floor(screenMin.x)), x1 = std::min(OCCLUSION_WIDTH - 1, (int)std::floor(screenMax.x));
+        int y0 = std::max(0, (int)std::floor(screenMin.y)), y1 = std::min(OCCLUSION_HEIGHT - 1, (int)std::floor(screenMax.y));
+        if (x0 > x1 || y0 > y1)
+            return true; // Off the buffer; the frustum test owns that decision
+
+        for (int tileY = y0 / OCCLUSION_TILE_HEIGHT; tileY <= y1 / OCCLUSION_TILE_HEIGHT; ++tileY)
+        {
+            for (int tileX = x0 / OCCLUSION_TILE_WIDTH; tileX <= x1 / OCCLUSION_TILE_WIDTH; ++tileX)
+            {
+                // Nothing in this tile is as far as the box's nearest point
+                if (nearest > tileFarthest[tileY * OCCLUSION_TILES_X + tileX])
+                    continue;
+
+                int left = std::max(x0, tileX * OCCLUSION_TILE_WIDTH), right = std::min(x1, (tileX + 1) * OCCLUSION_TILE_WIDTH - 1);
+                int bottom = std::max(y0, tileY * OCCLUSION_TILE_HEIGHT), top = std::min(y1, (tileY + 1) * OCCLUSION_TILE_HEIGHT - 1);
+
+                // The farthest pixel of a tile the rectangle covers whole is inside the rectangle
+                if (right - left + 1 == OCCLUSION_TILE_WIDTH && top - bottom + 1 == OCCLUSION_TILE_HEIGHT)
+                    return true;
+                for (int y = bottom; y <= top; ++y)
+                {
+                    if (rowReaches(&depth[y * OCCLUSION_WIDTH], left, right, nearest))
+                        return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // keeps the items whose boxes are not occluded, in order, and returns how many remain. boxOf(item) returns an
+    // item's world box; items are tested in parallel chunks
+    template <typename BoxOf>
+    size_t Cull(uint32_t* items, size_t count, BoxOf boxOf)
+    {
+        visibleFlags.resize(count);
+        forEach((count + OCCLUSION_TEST_CHUNK - 1) / OCCLUSION_TEST_CHUNK, [&](size_t chunk) {
+            size_t end = std::min(count, (chunk + 1) * OCCLUSION_TEST_CHUNK);
+            for (size_t i = chunk * OCCLUSION_TEST_CHUNK; i < end; ++i)
+                visibleFlags[i] = TestBox(boxOf(items[i])) ? 1 : 0;
+        });
+
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (visibleFlags[i])
+                items[kept++] = items[i];
+        }
+        Stats.Tested += (unsigned)count;
+        Stats.Occluded += (unsigned)(count - kept);
+        return kept;
+    }
+
+private:
+    // Edge functions a*x + b*y + c, positive inside, and the depth plane, all in pixels. Edges are pulled in and
+    // depth pushed back by half a pixel's extent, so evaluating at a pixel center answers for the whole pixel
+    struct ScreenTriangle
+    {
+        float EdgeA[3], EdgeB[3], EdgeC[3];
+        float DepthA, DepthB, DepthC;
+        int MinX, MaxX, MinY, MaxY; // Pixels the triangle may cover entirely
+    };
+
+    glm::mat4 frameViewProjection;
+    std::vector<float> depth;                   // Window depth, 1 is the far plane; row 0 is the bottom of the view
+    std::vector<std::vector<uint32_t>> bins;    // Triangles overlapping each tile, in submission order
+    std::vector<float> tileFarthest;
+    std::vector<ScreenTriangle> triangles;
+    std::vector<glm::vec4> clip;                // Clip space positions of the occluder being added
+    std::vector<uint8_t> visibleFlags;
+
+    template <typename Function>
+    void forEach(size_t count, Function fn)
+    {
+        if (Workers)
+            Workers->ParallelFor(count, fn);
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+                fn(i);
+        }
+    }
+
+    static glm::vec3 toScreen(const glm::vec4& p)
+    {
+        float inverseW = 1.0f / p.w;
+        return glm::vec3((p.x * inverseW * 0.5f + 0.5f) * OCCLUSION_WIDTH, (p.y * inverseW * 0.5f + 0.5f) * OCCLUSION_HEIGHT,
+            p.z * inverseW * 0.5f + 0.5f);
+    }
+
+    // multiplies every position by the matrix, four at a time in structure-of-arrays form
+    void transformPositions(const std::vector<glm::vec3>& positions, const glm::mat4& m)
+    {
+        clip.resize(positions.size());
+        size_t i = 0;
+#if SOFTWARE_OCCLUSION_SSE2
+        for (; i + 4 <= positions.size(); i += 4)
+        {
+            const glm::vec3* p = &positions[i];
+            __m128 x = _mm_set_ps(p[3].x, p[2].x, p[1].x, p[0].x);
+            __m128 y = _mm_set_ps(p[3].y, p[2].y, p[1].y, p[0].y);
+            __m128 z = _mm_set_ps(p[3].z, p[2].z, p[1].z, p[0].z);
+
+            float out[4][4];
+            for (int row = 0; row < 4; ++row)
+            {
+                __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(m[0][row])), _mm_mul_ps(y, _mm_set1_ps(m[1][row]))),
+                    _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(m[2][row])), _mm_set1_ps(m[3][row])));
+                _mm_storeu_ps(out[row], r);
+            }
+            for (int k = 0; k < 4; ++k)
+                clip[i + k] = glm::vec4(out[0][k], out[1][k], out[2][k], out[3][k]);
+        }
+#endif
+        for (; i < positions.size(); ++i)
+            clip[i] = m * glm::vec4(positions[i], 1.0f);
+    }
+
+    // clips a triangle against the near plane (z >= -w); the part in front becomes one or two triangles
+    void clipTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+    {
+        const glm::vec4 input[3] = { a, b, c };
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const glm::vec4& p = input[i];
+            const glm::vec4& q = input[(i + 1) % 3];
+            float dp = p.z + p.w, dq = q.z + q.w;
+            if (dp >= 0.0f)
+                polygon[count++] = p;
+            if ((dp >= 0.0f) != (dq >= 0.0f))
+                polygon[count++] = p + (q - p) * (dp / (dp - dq));
+        }
+        for (int i = 1; i + 1 < count; ++i)
+            setupTriangle(polygon[0], polygon[i], polygon[i + 1]);
+    }
+
+    // projects a clipped triangle, sets up its edge and depth equations and bins it into the tiles it overlaps
+    void setupTriangle(const glm::vec4& a, const glm::vec4& b, const glm::vec4& c)
+    {
+        const glm::vec3 v[3] = { toScreen(a), toScreen(b), toScreen(c) };
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+        if (!(std::fabs(area) > 1e-6f))
+            return; // Degenerate, or not a number after projecting a point on the eye plane
+
+        // Occluders are double sided: clockwise triangles flip their edges
+        float sign = area > 0.0f ? 1.0f : -1.0f;
+        ScreenTriangle t;
+        for (int i = 0; i < 3; ++i)
+        {
+            const glm::vec3& p = v[i];
+            const glm::vec3& q = v[(i + 1) % 3];
+            t.EdgeA[i] = -(q.y - p.y) * sign;
+            t.EdgeB[i] = (q.x - p.x) * sign;
+            t.EdgeC[i] = -(t.EdgeA[i] * p.x + t.EdgeB[i] * p.y) - 0.5f * (std::fabs(t.EdgeA[i]) + std::fabs(t.EdgeB[i]));
+        }
+
+        float dz1 = v[1].z - v[0].z, dz2 = v[2].z - v[0].z;
+        t.DepthA = (dz1 * (v[2].y - v[0].y) - dz2 * (v[1].y - v[0].y)) / area;
+        t.DepthB = (dz2 * (v[1].x - v[0].x) - dz1 * (v[2].x - v[0].x)) / area;
+        t.DepthC = v[0].z - t.DepthA * v[0].x - t.DepthB * v[0].y + 0.5f * (std::fabs(t.DepthA) + std::fabs(t.DepthB));
+
+        // Pixel [x, x + 1) can only be covered entirely when it lies within the triangle's extent
+        float minX = std::min(v[0].x, std::min(v[1].x, v[2].x)), maxX = std::max(v[0].x, std::max(v[1].x, v[2].x));
+        float minY = std::min(v[0].y, std::min(v[1].y, v[2].y)), maxY = std::max(v[0].y, std::max(v[1].y, v[2].y));
+        t.MinX = (int)std::max(0.0f, std::ceil(minX));
+        t.MaxX = (int)std::min((float)OCCLUSION_WIDTH, std::floor(maxX)) - 1;
+        t.MinY = (int)std::max(0.0f, std::ceil(minY));
+        t.MaxY = (int)std::min((float)OCCLUSION_HEIGHT, std::floor(maxY)) - 1;
+        if (t.MinX > t.MaxX || t.MinY > t.MaxY)
+            return;
+
+        uint32_t index = (uint32_t)triangles.size();
+        triangles.push_back(t);
+        for (int tileY = t.MinY / OCCLUSION_TILE_HEIGHT; tileY <= t.MaxY / OCCLUSION_TILE_HEIGHT; ++tileY)
+        {
+            for (int tileX = t.MinX / OCCLUSION_TILE_WIDTH; tileX <= t.MaxX / OCCLUSION_TILE_WIDTH; ++tileX)
+                bins[tileY * OCCLUSION_TILES_X + tileX].push_back(index);
+        }
+    }
+
+    // clears one tile, rasterizes its bin and records the farthest depth left in it. Tiles share no pixels
+    void rasterizeTile(size_t tile)
+    {
+        int tileX = (int)(tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_WIDTH;
+        int tileY = (int)(tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_HEIGHT;
+        for (int y = tileY; y < tileY + OCCLUSION_TILE_HEIGHT; ++y)
+            std::fill(&depth[y * OCCLUSION_WIDTH + tileX], &depth[y * OCCLUSION_WIDTH + tileX] + OCCLUSION_TILE_WIDTH, 1.0f);
+
+        const std::vector<uint32_t>& bin = bins[tile];
+        for (size_t i = 0; i < bin.size(); ++i)
+        {
+            const ScreenTriangle& t = triangles[bin[i]];
+            int x0 = std::max(t.MinX, tileX) & ~3; // Spans start on a SIMD boundary; the edges reject the extra pixels
+            int x1 = std::min(t.MaxX, tileX + OCCLUSION_TILE_WIDTH - 1);
+            int y0 = std::max(t.MinY, tileY);
+            int y1 = std::min(t.MaxY, tileY + OCCLUSION_TILE_HEIGHT - 1);
+            for (int y = y0; y <= y1; ++y)
+                rasterizeSpan(t, &depth[y * OCCLUSION_WIDTH], x0, x1, (float)y + 0.5f);
+        }
+
+        float farthest = 0.0f;
+        for (int y = tileY; y < tileY + OCCLUSION_TILE_HEIGHT; ++y)
+        {
+            const float* row = &depth[y * OCCLUSION_WIDTH + tileX];
+            farthest = std::max(farthest, *std::max_element(row, row + OCCLUSION_TILE_WIDTH));
+        }
+        tileFarthest[tile] = farthest;
+    }
+
+    // keeps the nearer depth on every pixel of [x0, x1] of a row the triangle covers entirely. x0 is a multiple of 4
+    static void rasterizeSpan(const ScreenTriangle& t, float* row, int x0, int x1, float centerY)
+    {
+#if SOFTWARE_OCCLUSION_SSE2
+        __m128 centerX = _mm_add_ps(_mm_set1_ps((float)x0 + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+        __m128 edge0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.EdgeA[0]), centerX), _mm_set1_ps(t.EdgeB[0] * centerY + t.EdgeC[0]));
+        __m128 edge1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.EdgeA[1]), centerX), _mm_set1_ps(t.EdgeB[1] * centerY + t.EdgeC[1]));
+        __m128 edge2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.EdgeA[2]), centerX), _mm_set1_ps(t.EdgeB[2] * centerY + t.EdgeC[2]));
+        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.DepthA), centerX), _mm_set1_ps(t.DepthB * centerY + t.DepthC));
+        const __m128 step0 = _mm_set1_ps(4.0f * t.EdgeA[0]), step1 = _mm_set1_ps(4.0f * t.EdgeA[1]);
+        const __m128 step2 = _mm_set1_ps(4.0f * t.EdgeA[2]), stepZ = _mm_set1_ps(4.0f * t.DepthA);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (int x = x0; x <= x1; x += 4)
+        {
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_and_ps(_mm_cmpge_ps(edge1, zero), _mm_cmpge_ps(edge2, zero)));
+            if (_mm_movemask_ps(inside) != 0)
+            {
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+            edge0 = _mm_add_ps(edge0, step0);
+            edge1 = _mm_add_ps(edge1, step1);
+            edge2 = _mm_add_ps(edge2, step2);
+            z = _mm_add_ps(z, stepZ);
+        }
+#else
+        for (int x = x0; x <= x1; ++x)
+        {
+            float centerX = (float)x + 0.5f;
+            bool inside = true;
+            for (int e = 0; e < 3; ++e)
+                inside = inside && t.EdgeA[e] * centerX + t.EdgeB[e] * centerY + t.EdgeC[e] >= 0.0f;
+            if (inside)
+                row[x] = std::min(row[x], t.DepthA * centerX + t.DepthB * centerY + t.DepthC);
+        }
+#endif
+    }
+
+    // true if some pixel of [left, right] of a row is at least as far as nearest, so the box may show there
+    static bool rowReaches(const float* row, int left, int right, float nearest)
+    {
+        int x = left;
+#if SOFTWARE_OCCLUSION_SSE2
+        const __m128 threshold = _mm_set1_ps(nearest);
+        for (; x + 3 <= right; x += 4)
+        {
+            if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), threshold)) != 0)
+                return true;
+        }
+#endif
+        for (; x <= right; ++x)
+        {
+            if (row[x] >= nearest)
+                return true;
+        }
+        return false;
+    }
+};
+#endif
@@ -0,0 +1,347 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "image_ops.h"
+#include "ktx2.h"
+#include "mip_generator.h"
+#include "thread_pool.h"
+
+// Identifies cache files and their layout
+const uint32_t TEXTURE_CACHE_MAGIC = 0x31435854; // "TXC1"
+
+// Part of every cache key. Bump it whenever decoding, flipping or mip generation changes the pixels they produce,
+// and every cached texture is decoded again on the next start
+const uint32_t TEXTURE_DECODER_VERSION = 3;
+
+// Fixed header at the start of a cache file, followed by LevelCount level entries and the pixels of every level
+struct TextureCacheHeader
+{
+    uint32_t Magic;
+    uint32_t DecoderVersion;
+    uint64_t SourceHash;
+    uint32_t Width, Height;
+    uint32_t Channels;      // Always 4, 8 bits each; every decode is expanded to RGBA
+    uint32_t LevelCount;
+};
+
+// One mip level; Offset is from the start of the file, rows are tightly packed and run bottom-up
+struct TextureCacheLevel
+{
+    uint32_t Width, Height;
+    uint64_t Offset;
+    uint64_t Size;
+};
+
+// Counters since the cache was created, updated from any thread
+struct TextureCacheStats
+{
+    std::atomic<unsigned> Hits;
+    std::atomic<unsigned> Misses;       // Sources decoded and written to the cache
+    std::atomic<unsigned> WriteErrors;  // Sources decoded but not cached, such as in a read-only directory
+    std::atomic<uint64_t> MipMicroseconds; // Spent building the mip chains of misses, summed over threads
+};
+
+
+// 64-bit FNV-1a over a byte range
+inline uint64_t hashBytes(const uint8_t* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = NULL;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!mapping)
+            return false;
+        data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping); // The view keeps the mapping alive
+        size = data ? (size_t)fileSize.QuadPart : 0;
+#else
+        int file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            return false;
+        struct stat info;
+        if (fstat(file, &info) == 0 && info.st_size > 0)
+        {
+            void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (view != MAP_FAILED)
+            {
+                data = (const uint8_t*)view;
+                size = (size_t)info.st_size;
+            }
+        }
+        close(file); // The mapping outlives the descriptor
+#endif
+        return data != nullptr;
+    }
+
+    void Close()
+    {
+        if (!data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    const uint8_t* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+
+// A validated cache file kept mapped; its levels can be uploaded straight from the mapping. When the entry could not
+// be written, Memory holds the same file image instead, so the decode is still used once
+class CachedTexture
+{
+public:
+    MappedFile File;
+    std::vector<uint8_t> Memory;
+
+    const uint8_t* Data() const { return File.Data() ? File.Data() : Memory.data(); }
+    const TextureCacheHeader& Header() const { return *(const TextureCacheHeader*)Data(); }
+    const TextureCacheLevel& Level(uint32_t level) const
+    {
+        return ((const TextureCacheLevel*)(Data() + sizeof(TextureCacheHeader)))[level];
+    }
+    const uint8_t* Pixels(uint32_t level) const { return Data() + Level(level).Offset; }
+
+    // specifies every level of the bound 2D texture straight from the mapping or memory; the chain is complete, so no
+    // mipmaps are generated. Expects no pixel unpack buffer to be bound and the default unpack alignment of 4,
+    // which RGBA8 rows always meet
+    void Upload() const
+    {
+        const TextureCacheHeader& header = Header();
+        for (uint32_t level = 0; level < header.LevelCount; ++level)
+        {
+            const TextureCacheLevel& entry = Level(level);
+            glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGBA8, entry.Width, entry.Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, Pixels(level));
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)header.LevelCount - 1);
+    }
+};
+
+
+// On-disk cache of decoded textures: pixels already flipped for OpenGL, with their mip chain. Files are named by a
+// hash of the source's bytes and the decoder version, so an edited source or a new decoder misses and is decoded
+// again, and a warm start maps the file and uploads from it without decoding or copying. Safe to use from workers
+class TextureCache
+{
+public:
+    TextureCacheStats Stats;
+
+    TextureCache()
+    {
+        Stats.Hits = 0;
+        Stats.Misses = 0;
+        Stats.WriteErrors = 0;
+        Stats.MipMicroseconds = 0;
+    }
+
+    // uses directory for cache files, creating it if needed
+    bool Create(const std::string& cacheDirectory)
+    {
+        directory = cacheDirectory;
+#ifdef _WIN32
+        return CreateDirectoryA(directory.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+        struct stat info;
+        return mkdir(directory.c_str(), 0755) == 0 || (stat(directory.c_str(), &info) == 0 && S_ISDIR(info.st_mode));
+#endif
+    }
+
+    // maps the cached decode of a source image, decoding it and filling the cache on a miss. Returns null when the
+    // source cannot be read or decoded, or has other than 3 or 4 channels; with an unwritable cache the decode is
+    // returned in memory instead. A miss builds the mip chain across workers when given
+    std::shared_ptr<CachedTexture> Load(const std::string& source, ThreadPool* workers = nullptr)
+    {
+        std::vector<uint8_t> bytes;
+        if (!readFileBytes(source, bytes) || bytes.empty())
+            return nullptr;
+
+        uint64_t hash = hashBytes(bytes.data(), bytes.size());
+        std::string path = entryPath(hash);
+
+        std::shared_ptr<CachedTexture> cached(new CachedTexture());
+        if (cached->File.Open(path) && valid(*cached, hash))
+        {
+            ++Stats.Hits;
+            return cached;
+        }
+        cached->File.Close();
+
+        std::vector<uint8_t> entry;
+        if (!encode(bytes, hash, entry, workers))
+            return nullptr;
+        if (write(entry, path) && cached->File.Open(path) && valid(*cached, hash))
+        {
+            ++Stats.Misses;
+            return cached;
+        }
+
+        // Not cached, but the caller can still upload the decode without redoing it
+        cached->File.Close();
+        cached->Memory.swap(entry);
+        ++Stats.WriteErrors;
+        return cached;
+    }
+
+private:
+    std::string directory;
+    std::atomic<unsigned> temporaryCount{ 0 };
+
+    std::string entryPath(uint64_t hash) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.tex", (unsigned long long)(hash ^ ((uint64_t)TEXTURE_DECODER_VERSION << 56)));
+        return directory + "/" + name;
+    }
+
+    // checks a mapped file is a complete entry for this source and decoder
+    static bool valid(const CachedTexture& cached, uint64_t hash)
+    {
+        size_t size = cached.File.Size();
+        if (size < sizeof(TextureCacheHeader))
+            return false;
+        const TextureCacheHeader& header = cached.Header();
+        if (header.Magic != TEXTURE_CACHE_MAGIC || header.DecoderVersion != TEXTURE_DECODER_VERSION || header.SourceHash != hash
+            || header.Channels != 4 || header.LevelCount == 0 || header.LevelCount > 32
+            || size < sizeof(TextureCacheHeader) + header.LevelCount * sizeof(TextureCacheLevel))
+            return false;
+
+        for (uint32_t level = 0; level < header.LevelCount; ++level)
+        {
+            const TextureCacheLevel& entry = cached.Level(level);
+            if (entry.Offset > size || entry.Size > size - entry.Offset
+                || entry.Size != (uint64_t)entry.Width * entry.Height * header.Channels)
+                return false;
+        }
+        return true;
+    }
+
+    // decodes, flips, expands to RGBA and mips a source into the image of its cache file
+    bool encode(const std::vector<uint8_t>& bytes, uint64_t hash, std::vector<uint8_t>& entry, ThreadPool* workers)
+    {
+        int width, height, channels;
+        unsigned char* image = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 0);
+        if (!image || (channels != 3 && channels != 4))
+        {
+            stbi_image_free(image);
+            return false;
+        }
+
+        // Stored as the loaders upload it: flipped for OpenGL and expanded to RGBA
+        std::vector<uint8_t> level0((size_t)width * height * 4);
+        prepareForUpload(image, width, height, channels, level0.data(), workers);
+        stbi_image_free(image);
+        channels = 4;
+
+        std::chrono::steady_clock::time_point mipStart = std::chrono::steady_clock::now();
+        std::vector<MipLevel> levels;
+        buildMipChain(level0, width, height, channels, levels, MIP_FILTER_BOX, workers);
+        Stats.MipMicroseconds += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - mipStart).count();
+
+        TextureCacheHeader header = { TEXTURE_CACHE_MAGIC, TEXTURE_DECODER_VERSION, hash, (uint32_t)width, (uint32_t)height,
+            (uint32_t)channels, (uint32_t)levels.size() };
+        std::vector<TextureCacheLevel> entries(levels.size());
+        uint64_t offset = sizeof(TextureCacheHeader) + levels.size() * sizeof(TextureCacheLevel);
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            offset = (offset + 15) & ~(uint64_t)15;
+            TextureCacheLevel level = { (uint32_t)levels[i].Width, (uint32_t)levels[i].Height, offset, levels[i].Pixels.size() };
+            entries[i] = level;
+            offset += level.Size;
+        }
+
+        // Padding between levels stays zero
+        entry.assign((size_t)offset, 0);
+        std::memcpy(entry.data(), &header, sizeof(header));
+        std::memcpy(entry.data() + sizeof(header), entries.data(), entries.size() * sizeof(TextureCacheLevel));
+        for (size_t i = 0; i < levels.size(); ++i)
+            std::memcpy(entry.data() + entries[i].Offset, levels[i].Pixels.data(), levels[i].Pixels.size());
+        return true;
+    }
+
+    // writes an encoded entry under a temporary name and renames it into place, so a reader never maps a partial
+    // file and two workers decoding the same source do not collide
+    bool write(const std::vector<uint8_t>& entry, const std::string& path)
+    {
+        std::string temporary = path + "." + std::to_string(temporaryCount++) + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file)
+            return false;
+        bool written = std::fwrite(entry.data(), 1, entry.size(), file) == entry.size();
+        written = std::fclose(file) == 0 && written;
+
+#ifdef _WIN32
+        written = written && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+        written = written && std::rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+        if (!written)
+            std::remove(temporary.c_str());
+        return written;
+    }
+};
+#endif
@@ -0,0 +1,108 @@
+#ifndef TEXTURE_COOKER_H
+#define TEXTURE_COOKER_H
+
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "block_compression.h"
+#include "image_ops.h"
+#include "ktx2.h"
+#include "mip_generator.h"
+#include "thread_pool.h"
+
+// What cooking one texture produced
+struct CookedTexture
+{
+    int Width, Height, Channels;
+    BlockFormat Format;
+    unsigned Levels;
+    size_t UncompressedBytes;   // Of the mip chain as the runtime uploaded it before, RGB8 or RGBA8
+    size_t CompressedBytes;     // Of the mip chain in the KTX2 file
+    size_t LayerBytes;          // Of the texture array layer file, 0 when none was asked for
+};
+
+// encodes an image file to a KTX2 file with a full mip chain: BC1 for RGB sources, BC7 for sources with alpha.
+// Rows are flipped bottom-up first, so the runtime uploads levels as they are. Time is no concern offline, so levels
+// use the sharper Kaiser filter; they and their blocks are built across the pool.
+// With a layer destination, the image is also resampled to layerSize squared and written there as BC7 with its own
+// chain, so every texture can share one compressed array texture whatever its size and alpha
+inline bool cookTexture(const std::string& source, const std::string& destination, const std::string& layerDestination, int layerSize,
+    ThreadPool* pool, CookedTexture& result)
+{
+    int width, height, channels;
+    unsigned char* image = stbi_load(source.c_str(), &width, &height, &channels, 0);
+    if (image && channels < 3)
+    {
+        // Grey sources are rare enough to let the decoder expand them; channels still reports the source's count
+        stbi_image_free(image);
+        image = stbi_load(source.c_str(), &width, &height, &channels, 4);
+    }
+    std::vector<uint8_t> level(image ? (size_t)width * height * 4 : 0);
+    bool prepared = image && prepareForUpload(image, width, height, channels < 3 ? 4 : channels, level.data(), pool);
+    stbi_image_free(image);
+    if (!prepared)
+        return false;
+
+    result.Width = width;
+    result.Height = height;
+    result.Channels = channels;
+    result.Format = channels == 2 || channels == 4 ? BLOCK_FORMAT_BC7 : BLOCK_FORMAT_BC1; // Grey+alpha keeps its alpha
+    result.UncompressedBytes = 0;
+    result.CompressedBytes = 0;
+    result.LayerBytes = 0;
+
+    // Resampled from level 0 before the chain takes it over
+    MipLevel layer = { 0, 0, std::vector<uint8_t>() };
+    if (!layerDestination.empty())
+        resampleImage(level.data(), width, height, 4, layerSize, layerSize, layer, MIP_FILTER_KAISER, pool);
+
+    std::vector<MipLevel> mips;
+    buildMipChain(level, width, height, 4, mips, MIP_FILTER_KAISER, pool);
+
+    std::vector<std::vector<uint8_t>> levels(mips.size());
+    for (size_t i = 0; i < mips.size(); ++i)
+    {
+        compressImage(mips[i].Pixels.data(), mips[i].Width, mips[i].Height, result.Format, pool, levels[i]);
+        result.UncompressedBytes += (size_t)mips[i].Width * mips[i].Height * (channels == 4 ? 4 : 3);
+        result.CompressedBytes += levels[i].size();
+    }
+    result.Levels = (unsigned)levels.size();
+
+    if (!writeKtx2(destination, result.Format, (uint32_t)width, (uint32_t)height, levels))
+        return false;
+    if (layerDestination.empty())
+        return true;
+
+    buildMipChain(layer.Pixels, layerSize, layerSize, 4, mips, MIP_FILTER_KAISER, pool);
+    levels.assign(mips.size(), std::vector<uint8_t>());
+    for (size_t i = 0; i < mips.size(); ++i)
+    {
+        compressImage(mips[i].Pixels.data(), mips[i].Width, mips[i].Height, BLOCK_FORMAT_BC7, pool, levels[i]);
+        result.LayerBytes += levels[i].size();
+    }
+    return writeKtx2(layerDestination, BLOCK_FORMAT_BC7, (uint32_t)layerSize, (uint32_t)layerSize, levels);
+}
+
+// path of the cooked version of an image file: the same name with a .ktx2 extension
+inline std::string cookedTexturePath(const std::string& source)
+{
+    size_t dot = source.find_last_of('.');
+    size_t slash = source.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return source + ".ktx2";
+    return source.substr(0, dot) + ".ktx2";
+}
+
+// path of the cooked texture array layer of an image file: the same name with a .layer.ktx2 extension
+inline std::string cookedLayerPath(const std::string& source)
+{
+    std::string cooked = cookedTexturePath(source);
+    return cooked.substr(0, cooked.size() - 5) + ".layer.ktx2";
+}
+#endif
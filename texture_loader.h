@@ -0,0 +1,446 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <GL/glew.h>
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "image_ops.h"
+#include "ktx2.h"
+#include "mip_generator.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+
+// Counters since the loader was created
+struct TextureLoaderStats
+{
+    unsigned Requested;
+    unsigned Uploaded;
+    unsigned Failed;    // Decode errors and unsupported channel counts; those textures keep the placeholder
+    unsigned Direct;    // Uploads from client memory because the staging ring had no room
+    unsigned Cached;    // Uploads straight from a cache entry, mapped or kept in memory
+    double MipMilliseconds; // Worker time spent building mip chains of decoded images, summed over workers
+};
+
+
+// Ring of a persistently mapped pixel unpack buffer. Workers write decoded pixels straight into it; a region is
+// reused once the fence issued after its upload has signaled. Regions are released in allocation order, so one
+// slow upload holds back the space behind it. Not thread safe; the loader serializes access
+class StagingRing
+{
+public:
+    bool Create(size_t bytes)
+    {
+        capacity = bytes;
+        glGenBuffers(1, &Buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Buffer);
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)bytes, NULL, flags);
+        Mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)bytes, flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return Mapped != nullptr;
+    }
+
+    // unmaps and deletes the buffer. Every upload reading from it must have been issued
+    void Destroy()
+    {
+        for (size_t i = 0; i < regions.size(); ++i)
+        {
+            if (regions[i].Fence)
+                glDeleteSync(regions[i].Fence);
+        }
+        regions.clear();
+        if (Buffer)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &Buffer);
+        }
+        Buffer = 0;
+        Mapped = nullptr;
+        head = 0;
+    }
+
+    // reserves bytes of contiguous space, or returns false if the free space is fragmented or in flight
+    bool Allocate(size_t bytes, size_t& offset)
+    {
+        bytes = (bytes + 15) & ~(size_t)15;
+        if (regions.empty())
+            head = 0;
+
+        // With regions in flight, [tail, head) is used. head == tail means full, since an empty ring resets head
+        size_t tail = regions.empty() ? 0 : regions.front().Offset;
+        if (regions.empty() || head > tail)
+        {
+            if (capacity - head >= bytes)
+                offset = head;
+            else if (!regions.empty() && tail >= bytes)
+                offset = 0; // Wrap; the end of the buffer stays unused until the ring passes it
+            else
+                return false;
+        }
+        else if (tail - head >= bytes)
+            offset = head;
+        else
+            return false;
+
+        Region region = { offset, 0 };
+        regions.push_back(region);
+        head = offset + bytes;
+        return true;
+    }
+
+    // marks a region's upload as issued. Must run on the GL thread right after the upload command
+    void Fence(size_t offset)
+    {
+        for (size_t i = 0; i < regions.size(); ++i)
+        {
+            if (regions[i].Offset == offset && regions[i].Fence == 0)
+            {
+                regions[i].Fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                return;
+            }
+        }
+    }
+
+    // releases the regions whose uploads the GPU has finished, without waiting
+    void Reclaim()
+    {
+        while (!regions.empty() && regions.front().Fence)
+        {
+            GLenum status = glClientWaitSync(regions.front().Fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync(regions.front().Fence);
+            regions.pop_front();
+        }
+    }
+
+    GLuint Buffer = 0;
+    unsigned char* Mapped = nullptr;
+
+private:
+    // Allocated space, waiting for its upload to be issued (no fence yet) or completed
+    struct Region
+    {
+        size_t Offset;
+        GLsync Fence;
+    };
+
+    size_t capacity = 0;
+    size_t head = 0;
+    std::deque<Region> regions;
+};
+
+
+// Loads textures without blocking the render thread. Load returns a texture at once, holding a 1x1 placeholder.
+// Worker threads decode the file and write the pixels, flipped for OpenGL, directly into the staging ring. Update,
+// called once per frame on the GL thread, then only issues glTexImage2D from the ring. Workers also build the mip
+// chain on the CPU, so no glGenerateMipmap runs on the GL thread.
+// Cooked .ktx2 files are read into the ring as they are and uploaded level by level with glCompressedTexImage2D.
+// With a decoded texture cache, workers map cache entries instead (decoding only on a miss) and the GL thread uploads
+// the whole mip chain from the mapping
+class AsyncTextureLoader
+{
+public:
+    TextureLoaderStats Stats = {};
+    TextureCache* Cache = nullptr; // Optional, must outlive the loader
+
+    // maps stagingBytes of pixel unpack buffer and starts the decode workers (one per hardware thread when 0)
+    bool Create(size_t stagingBytes, unsigned threadCount = 0)
+    {
+        if (!ring.Create(stagingBytes))
+        {
+            std::cout << "ERROR::TEXTURE_LOADER::STAGING_MAP_FAILED" << std::endl;
+            ring.Destroy();
+            return false;
+        }
+        workers.reset(new ThreadPool(threadCount));
+        return true;
+    }
+
+    // waits for the decodes in flight, then releases the staging buffer and every pixel not yet uploaded.
+    // Textures handed out stay valid; their owners delete them
+    void Destroy()
+    {
+        workers.reset();
+        ready.clear();
+        ring.Destroy();
+    }
+
+    // creates a texture showing the placeholder and queues the file for decoding
+    GLuint Load(const std::string& filename)
+    {
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+
+        // set the texture wrapping parameters
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        // set texture filtering parameters; the placeholder has one level, so upload switches to mipmapped filtering
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        const GLubyte placeholder[4] = { 128, 128, 128, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++Stats.Requested;
+            ++pending;
+        }
+        if (isKtx2Path(filename))
+            workers->Submit([this, filename, texture] { readCompressed(filename, texture); });
+        else
+            workers->Submit([this, filename, texture] { decode(filename, texture); });
+        return texture;
+    }
+
+    // true while some requested texture still shows its placeholder
+    bool Busy()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending != 0;
+    }
+
+    // uploads decoded textures until about byteBudget bytes went up (at least one texture), and returns the textures
+    // that received their real image in this call. The list is valid until the next call
+    const std::vector<GLuint>& Update(size_t byteBudget = ~(size_t)0)
+    {
+        completed.clear();
+        std::deque<Decoded> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ring.Reclaim();
+            size_t bytes = 0;
+            while (!ready.empty() && (batch.empty() || bytes < byteBudget))
+            {
+                bytes += ready.front().Size;
+                batch.push_back(ready.front());
+                ready.pop_front();
+            }
+        }
+        if (batch.empty())
+            return completed;
+
+        // RGBA8 rows always meet the default unpack alignment of 4
+        for (size_t i = 0; i < batch.size(); ++i)
+            upload(batch[i]);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending -= (unsigned)batch.size();
+        return completed;
+    }
+
+private:
+    // A finished decode: data either in the ring at Offset, or in client memory when the ring was full
+    struct Decoded
+    {
+        GLuint Texture;
+        std::string Filename;
+        int Width, Height, Channels;
+        size_t Size;
+        size_t Offset;
+        std::shared_ptr<unsigned char> Pixels;  // Client memory, null when staged in the ring
+        bool Failed;
+        GLenum CompressedFormat;                // 0 for RGBA8 pixels
+        std::vector<Ktx2Level> Levels;          // Of compressed data or the mip chain, offsets relative to its start
+        std::shared_ptr<CachedTexture> Cached;  // Cache entry holding the whole chain, instead of Pixels or the ring
+    };
+
+    std::unique_ptr<ThreadPool> workers;
+    StagingRing ring;
+    std::mutex mutex;                   // Guards the ring's bookkeeping, ready, pending and Stats
+    std::deque<Decoded> ready;
+    std::vector<GLuint> completed;
+    unsigned pending = 0;               // Requested textures not uploaded or failed yet
+
+    // runs on a worker: decodes, flips the rows bottom-up as RGBA and builds the mip chain, then writes every level
+    // into the ring, or into client memory when it is full
+    void decode(const std::string& filename, GLuint texture)
+    {
+        Decoded result = { texture, filename, 0, 0, 0, 0, 0, nullptr, false, 0, std::vector<Ktx2Level>(), nullptr };
+        if (Cache)
+        {
+            result.Cached = Cache->Load(filename);
+            if (result.Cached)
+            {
+                push(result);
+                return;
+            }
+        }
+
+        unsigned char* image = stbi_load(filename.c_str(), &result.Width, &result.Height, &result.Channels, 0);
+        if (!image || (result.Channels != 3 && result.Channels != 4))
+        {
+            stbi_image_free(image);
+            result.Failed = true;
+            push(result);
+            return;
+        }
+
+        // Flipped for OpenGL and expanded to RGBA; decodes already run in parallel, so on this worker alone
+        std::vector<uint8_t> level0((size_t)result.Width * result.Height * 4);
+        prepareForUpload(image, result.Width, result.Height, result.Channels, level0.data());
+        stbi_image_free(image);
+        result.Channels = 4;
+
+        std::chrono::steady_clock::time_point mipStart = std::chrono::steady_clock::now();
+        std::vector<MipLevel> levels;
+        buildMipChain(level0, result.Width, result.Height, result.Channels, levels);
+        double mipMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mipStart).count();
+
+        for (size_t i = 0; i < levels.size(); ++i)
+        {
+            Ktx2Level level = { (uint32_t)levels[i].Width, (uint32_t)levels[i].Height, result.Size, levels[i].Pixels.size() };
+            result.Levels.push_back(level);
+            result.Size += level.Size;
+        }
+
+        bool staged;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            staged = ring.Allocate(result.Size, result.Offset);
+            Stats.MipMilliseconds += mipMilliseconds;
+        }
+        unsigned char* destination;
+        if (staged)
+            destination = ring.Mapped + result.Offset;
+        else
+        {
+            result.Pixels.reset(new unsigned char[result.Size], std::default_delete<unsigned char[]>());
+            destination = result.Pixels.get();
+        }
+        for (size_t i = 0; i < levels.size(); ++i)
+            std::memcpy(destination + result.Levels[i].Offset, levels[i].Pixels.data(), levels[i].Pixels.size());
+        push(result);
+    }
+
+    // runs on a worker: reads a cooked file straight into the ring, or into client memory when it is full. Its levels
+    // are already flipped and compressed, so nothing else happens before the upload
+    void readCompressed(const std::string& filename, GLuint texture)
+    {
+        Decoded result = { texture, filename, 0, 0, 0, 0, 0, nullptr, true, 0, std::vector<Ktx2Level>(), nullptr };
+        FILE* file = std::fopen(filename.c_str(), "rb");
+        if (!file)
+        {
+            push(result);
+            return;
+        }
+        std::fseek(file, 0, SEEK_END);
+        long size = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+        result.Size = size > 0 ? (size_t)size : 0;
+
+        bool staged;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            staged = result.Size != 0 && ring.Allocate(result.Size, result.Offset);
+        }
+        unsigned char* data;
+        if (staged)
+            data = ring.Mapped + result.Offset;
+        else
+        {
+            result.Pixels.reset(new unsigned char[result.Size], std::default_delete<unsigned char[]>());
+            data = result.Pixels.get();
+        }
+
+        // A failure still hands a staged region to the GL thread, which releases it
+        Ktx2Image header;
+        bool read = std::fread(data, 1, result.Size, file) == result.Size;
+        std::fclose(file);
+        if (read && parseKtx2(data, result.Size, header) && ktx2GlFormat(header.VkFormat) != 0)
+        {
+            result.Width = (int)header.Width;
+            result.Height = (int)header.Height;
+            result.CompressedFormat = ktx2GlFormat(header.VkFormat);
+            result.Levels = header.Levels;
+            result.Failed = false;
+        }
+        push(result);
+    }
+
+    void push(const Decoded& result)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.push_back(result);
+    }
+
+    // runs on the GL thread: replaces the placeholder with the decoded image and its mip chain
+    void upload(const Decoded& image)
+    {
+        if (image.Failed)
+        {
+            std::cout << "Failed to load texture: " << image.Filename << std::endl;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!image.Pixels && image.Size != 0)
+                ring.Fence(image.Offset);
+            ++Stats.Failed;
+            return;
+        }
+
+        // From the ring the pointer arguments are offsets into the bound unpack buffer
+        glBindTexture(GL_TEXTURE_2D, image.Texture);
+        bool staged = !image.Pixels && !image.Cached;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staged ? ring.Buffer : 0);
+        if (image.Cached)
+            image.Cached->Upload();
+        else if (image.CompressedFormat)
+        {
+            for (size_t level = 0; level < image.Levels.size(); ++level)
+            {
+                const Ktx2Level& data = image.Levels[level];
+                const void* blocks = image.Pixels ? (const void*)(image.Pixels.get() + data.Offset) : (const void*)(image.Offset + data.Offset);
+                glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, image.CompressedFormat, data.Width, data.Height, 0, (GLsizei)data.Size, blocks);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.Levels.size() - 1);
+        }
+        else
+            uploadPixels(image);
+
+        // The placeholder had a single level; now the whole chain is there to blend between
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        completed.push_back(image.Texture);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (image.Cached)
+            ++Stats.Cached;
+        else if (image.Pixels)
+            ++Stats.Direct;
+        else
+            ring.Fence(image.Offset);
+        ++Stats.Uploaded;
+    }
+
+    // uploads the mip chain of an RGBA8 texture from the ring or client memory
+    void uploadPixels(const Decoded& image)
+    {
+        for (size_t level = 0; level < image.Levels.size(); ++level)
+        {
+            const Ktx2Level& data = image.Levels[level];
+            const void* pixels = image.Pixels ? (const void*)(image.Pixels.get() + data.Offset) : (const void*)(image.Offset + data.Offset);
+            glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGBA8, data.Width, data.Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)image.Levels.size() - 1);
+    }
+};
+#endif
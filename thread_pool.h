@@ -0,0 +1,141 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running queued tasks. Tasks must not throw; Wait() blocks until the queue is drained
+// and every running task has finished. ParallelFor only waits for its own indices, so it may be called from
+// several threads at once and from inside a pool task
+class ThreadPool
+{
+public:
+    // starts one worker per hardware thread when threadCount is 0
+    explicit ThreadPool(unsigned threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::thread::hardware_concurrency();
+        if (threadCount == 0)
+            threadCount = 1;
+
+        for (unsigned i = 0; i < threadCount; ++i)
+            workers.push_back(std::thread([this] { run(); }));
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        taskReady.notify_all();
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned Size() const { return (unsigned)workers.size(); }
+
+    // queues a task for the next idle worker
+    void Submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+            ++pending;
+        }
+        taskReady.notify_one();
+    }
+
+    // blocks until every submitted task has finished
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this] { return pending == 0; });
+    }
+
+    // calls fn(i) for every i in [0, count) across the workers and returns when all calls are done.
+    // Indices are handed out one at a time, so uneven items balance themselves. The calling thread takes
+    // indices too, so a nested call still finishes when every worker is busy
+    template <typename Function>
+    void ParallelFor(size_t count, Function fn)
+    {
+        if (count == 0)
+            return;
+
+        // Helpers that start after the last index was taken find nothing to do, so they never touch fn
+        std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+        auto work = [state, count, &fn] {
+            size_t finished = 0;
+            for (size_t i = state->next++; i < count; i = state->next++)
+            {
+                fn(i);
+                ++finished;
+            }
+            if (finished == 0)
+                return;
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->done += finished;
+            if (state->done == count)
+                state->finished.notify_all();
+        };
+
+        unsigned helperCount = (unsigned)(count - 1 < Size() ? count - 1 : Size());
+        for (unsigned t = 0; t < helperCount; ++t)
+            Submit(work);
+        work();
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finished.wait(lock, [&state, count] { return state->done == count; });
+    }
+
+private:
+    // completion of one ParallelFor call, shared with its helper tasks
+    struct ParallelForState
+    {
+        std::atomic<size_t> next{0};
+        size_t done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskReady;
+    std::condition_variable allDone;
+    size_t pending = 0;     // Queued plus running tasks
+    bool stopping = false;
+
+    void run()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+
+            task();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--pending == 0)
+                allDone.notify_all();
+        }
+    }
+};
+#endif
@@ -0,0 +1,187 @@
+#ifndef VERTEX_COMPRESSION_H
+#define VERTEX_COMPRESSION_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_builder.h"
+
+// Compact vertex layout (16 bytes, half of Vertex):
+// position as 16-bit UNORM inside the mesh bounds, octahedral normal as 2x16-bit SNORM, texture coordinate as 16-bit
+// UNORM inside the mesh's texture coordinate bounds
+struct CompactVertex
+{
+    GLushort Position[4];   // xyz quantized, w unused padding
+    GLshort Normal[2];      // Octahedral encoding of the normal in quantized space
+    GLushort TexCoord[2];   // Quantized uv
+};
+
+// Attribute location of the packed normal; compact meshes leave location 1 disabled so the shader can tell them apart
+const GLuint COMPACT_NORMAL_LOCATION = 9;
+
+// Largest error the encoder accepts before a mesh keeps full precision vertices
+struct VertexCompressionTolerance
+{
+    float Position = 1.0f / 16384.0f;   // Fraction of the largest bounding box extent
+    float NormalDegrees = 0.5f;         // Angle between original and decoded normal
+    float TexCoord = 1.0f / 2048.0f;    // Absolute; half a texel of a 1024 texture, which UNORM16 meets for uv ranges up to 64
+};
+
+// How to decode a compressed mesh and the largest errors measured by decoding every vertex
+struct VertexCompressionResult
+{
+    glm::vec3 PositionOffset;   // Object position = offset + quantized position * scale
+    glm::vec3 PositionScale;
+    glm::vec2 TexCoordOffset;   // Texture coordinate = offset + quantized uv * scale
+    glm::vec2 TexCoordScale;
+    float PositionError;        // Object units
+    float NormalErrorDegrees;
+    float TexCoordError;
+};
+
+
+// normalized value a GL_SHORT SNORM component decodes to
+inline float snorm16ToFloat(GLshort value)
+{
+    float decoded = (float)value / 32767.0f;
+    return decoded < -1.0f ? -1.0f : decoded;
+}
+
+// decodes an octahedral normal, as the vertex shader does
+inline glm::vec3 octahedralDecode(const glm::vec2& encoded)
+{
+    glm::vec3 n(encoded.x, encoded.y, 1.0f - std::fabs(encoded.x) - std::fabs(encoded.y));
+    float t = n.z < 0.0f ? -n.z : 0.0f;
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+// encodes a unit normal into octahedral SNORM16, picking the rounding of each component that decodes closest
+inline void octahedralEncode(const glm::vec3& normal, GLshort out[2])
+{
+    float l1 = std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+    glm::vec2 p(normal.x / l1, normal.y / l1);
+    if (normal.z < 0.0f)
+    {
+        glm::vec2 folded((1.0f - std::fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+        p = folded;
+    }
+
+    float best = -2.0f;
+    float baseX = std::floor(p.x * 32767.0f);
+    float baseY = std::floor(p.y * 32767.0f);
+    for (int i = 0; i < 4; ++i)
+    {
+        float qx = glm::clamp(baseX + (float)(i & 1), -32767.0f, 32767.0f);
+        float qy = glm::clamp(baseY + (float)(i >> 1), -32767.0f, 32767.0f);
+        float similarity = glm::dot(octahedralDecode(glm::vec2(qx / 32767.0f, qy / 32767.0f)), normal);
+        if (similarity > best)
+        {
+            best = similarity;
+            out[0] = (GLshort)qx;
+            out[1] = (GLshort)qy;
+        }
+    }
+}
+
+// model matrix that also decodes quantized positions: model * translate(offset) * scale(scale), built column-wise
+inline glm::mat4 compactModelMatrix(const glm::mat4& model, const glm::vec3& offset, const glm::vec3& scale)
+{
+    glm::mat4 result;
+    result[0] = model[0] * scale.x;
+    result[1] = model[1] * scale.y;
+    result[2] = model[2] * scale.z;
+    result[3] = model * glm::vec4(offset, 1.0f);
+    return result;
+}
+
+// quantizes vertices into the compact layout and measures the error by decoding them again.
+// Normals are stored in quantized space (scaled by the bounds), so the usual inverse-transpose of the
+// combined model matrix gives correct world normals. Returns false if any error exceeds the tolerance
+inline bool compressVertices(const std::vector<Vertex>& vertices, std::vector<CompactVertex>& compact,
+    VertexCompressionResult& result, const VertexCompressionTolerance& tolerance = VertexCompressionTolerance())
+{
+    compact.resize(vertices.size());
+    result = VertexCompressionResult();
+    if (vertices.empty())
+        return true;
+
+    glm::vec3 boundsMin = vertices[0].Position;
+    glm::vec3 boundsMax = vertices[0].Position;
+    glm::vec2 uvMin = vertices[0].TexCoord;
+    glm::vec2 uvMax = vertices[0].TexCoord;
+    for (size_t i = 1; i < vertices.size(); ++i)
+    {
+        boundsMin = glm::min(boundsMin, vertices[i].Position);
+        boundsMax = glm::max(boundsMax, vertices[i].Position);
+        uvMin = glm::min(uvMin, vertices[i].TexCoord);
+        uvMax = glm::max(uvMax, vertices[i].TexCoord);
+    }
+
+    // A flat axis keeps scale 1; all its positions quantize to 0 and decode exactly
+    glm::vec3 extent = boundsMax - boundsMin;
+    glm::vec3 scale(extent.x > 0.0f ? extent.x : 1.0f, extent.y > 0.0f ? extent.y : 1.0f, extent.z > 0.0f ? extent.z : 1.0f);
+    result.PositionOffset = boundsMin;
+    result.PositionScale = scale;
+
+    // Texture coordinates likewise, so imported models with uvs outside [0, 1] keep full 16-bit precision
+    glm::vec2 uvExtent = uvMax - uvMin;
+    glm::vec2 uvScale(uvExtent.x > 0.0f ? uvExtent.x : 1.0f, uvExtent.y > 0.0f ? uvExtent.y : 1.0f);
+    result.TexCoordOffset = uvMin;
+    result.TexCoordScale = uvScale;
+
+    float minNormalCosine = 1.0f;
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        const Vertex& vertex = vertices[i];
+        CompactVertex& out = compact[i];
+
+        glm::vec3 decodedPosition;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float unit = glm::clamp((vertex.Position[axis] - boundsMin[axis]) / scale[axis], 0.0f, 1.0f);
+            out.Position[axis] = (GLushort)std::floor(unit * 65535.0f + 0.5f);
+            decodedPosition[axis] = boundsMin[axis] + (out.Position[axis] / 65535.0f) * scale[axis];
+        }
+        out.Position[3] = 0;
+        glm::vec3 positionError = glm::abs(decodedPosition - vertex.Position);
+        result.PositionError = glm::max(result.PositionError, glm::max(positionError.x, glm::max(positionError.y, positionError.z)));
+
+        float normalLength = glm::length(vertex.Normal);
+        if (normalLength > 0.0f)
+        {
+            glm::vec3 normal = vertex.Normal / normalLength;
+            octahedralEncode(glm::normalize(normal * scale), out.Normal);
+
+            // The shader's normal matrix undoes the scale; compare in object space
+            glm::vec3 stored = octahedralDecode(glm::vec2(snorm16ToFloat(out.Normal[0]), snorm16ToFloat(out.Normal[1])));
+            glm::vec3 decodedNormal = glm::normalize(stored / scale);
+            minNormalCosine = glm::min(minNormalCosine, glm::dot(decodedNormal, normal));
+        }
+        else
+        {
+            out.Normal[0] = out.Normal[1] = 0;
+        }
+
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            float unit = glm::clamp((vertex.TexCoord[axis] - uvMin[axis]) / uvScale[axis], 0.0f, 1.0f);
+            out.TexCoord[axis] = (GLushort)std::floor(unit * 65535.0f + 0.5f);
+            float error = std::fabs(uvMin[axis] + (out.TexCoord[axis] / 65535.0f) * uvScale[axis] - vertex.TexCoord[axis]);
+            result.TexCoordError = error > result.TexCoordError || error != error ? error : result.TexCoordError;
+        }
+    }
+    result.NormalErrorDegrees = glm::degrees(std::acos(glm::clamp(minNormalCosine, -1.0f, 1.0f)));
+
+    float largestExtent = glm::max(extent.x, glm::max(extent.y, extent.z));
+    return result.PositionError <= tolerance.Position * largestExtent
+        && result.NormalErrorDegrees <= tolerance.NormalDegrees
+        && result.TexCoordError <= tolerance.TexCoord;
+}
+#endif